@@ -13,27 +13,57 @@ TEMPLATE = app
 
 LIBS += -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_ml -lopencv_video -lopencv_features2d -lopencv_calib3d -lopencv_objdetect -lopencv_contrib -lopencv_legacy -lopencv_flann
 
+#POSIX shared memory frame source
+unix:!macx: LIBS += -lrt
+
 SOURCES += src/main.cpp\
         src/mainwindow.cpp \
     src/facetracker.cpp \
+    src/facetracktable.cpp \
+    src/facepredictor.cpp \
+    src/detectionscheduler.cpp \
+    src/framegrabber.cpp \
+    src/framesource.cpp \
+    src/sharedmemoryframesource.cpp \
+    src/v4l2framesource.cpp \
+    src/parallelcascadedetector.cpp \
+    src/cascadecache.cpp \
+    src/frameprocessing.cpp \
+    src/videoframe.cpp \
+    src/metrics.cpp \
     src/faceinvaderswidget.cpp \
     src/serial.cpp \
     src/corefeaturewidget.cpp \
     src/hardwaremanager.cpp \
-    src/aboutdialog.cpp
+    src/aboutdialog.cpp \
+    src/metricsdialog.cpp
 
 HEADERS  += src/mainwindow.h \
     src/facetracker.h \
+    src/facetracktable.h \
+    src/facepredictor.h \
+    src/detectionscheduler.h \
+    src/framegrabber.h \
+    src/framesource.h \
+    src/sharedmemoryframesource.h \
+    src/v4l2framesource.h \
+    src/parallelcascadedetector.h \
+    src/cascadecache.h \
+    src/frameprocessing.h \
+    src/videoframe.h \
+    src/metrics.h \
     src/faceinvaderswidget.h \
     src/serial.h \
     src/corefeaturewidget.h \
     src/CommunicationProtocol.h \
     src/hardwaremanager.h \
     src/Arduino/arduino_sketch.ino \
-    src/aboutdialog.h
+    src/aboutdialog.h \
+    src/metricsdialog.h
 
 FORMS    += resources/mainwindow.ui \
-    resources/aboutdialog.ui
+    resources/aboutdialog.ui \
+    resources/metricsdialog.ui
 
 ARDUINO_SOURCES += src/Arduino/arduino_sketch.ino
 
@@ -57,13 +87,20 @@ else {
     CONFIG -= debug
 }
 
+#Vectorized frame preprocessing (see src/frameprocessing.cpp), NEON is used
+#automatically when the ARM toolchain targets it. QT_ARCH is the architecture
+#of the Qt build linked against, so cross-compiles check the target, not the host
+contains(QT_ARCH, x86_64)|contains(QT_ARCH, i386)|contains(QT_ARCH, x86) {
+    QMAKE_CXXFLAGS += -mssse3
+}
+
 QMAKE_CLEAN += Makefile -r build/.[a-z]* build/*
 
 #Doxygen
 docs.depends = $(SOURCES)
 docs.commands = doxygen Doxyfile
 
-QMAKE_EXTRA_TARGETS += docs arduino arduino_upload
+QMAKE_EXTRA_TARGETS += docs arduino arduino_upload benchmark serialbenchmark
 
 RESOURCES += \
     resources/resources.qrc
@@ -73,13 +110,11 @@ OTHER_FILES += \
     docs/explanations.dox
 
 
-DEFINES +=  #DEBUG_FACETRACKING_TIMING=1
-DEFINES +=  #DEBUG_CAPTURE_TIMING=1
-DEFINES +=  #DEBUG_REPORT_FPS=1
 DEFINES +=  #DEBUG_INVADER_SHAPE=1
 DEFINES +=  #DEBUG_QTHREADS=1
 DEFINES +=  #DEBUG_MODE_SWITCHING=1
 DEFINES +=  #DEBUG_SERIAL_COMM=1
+DEFINES +=  #DEBUG_V4L2=1
 
 #Arduino Sketch
 arduino.depends = $(ARDUINO_SOURCES)
@@ -87,3 +122,9 @@ arduino.commands = make -C src/Arduino/
 
 arduino_upload.depends = arduino
 arduino_upload.commands = make -C src/Arduino/ upload
+
+#Offline FaceTracker benchmark (build/bench/facetrackerbench)
+benchmark.commands = cd bench && $(QMAKE) facetrackerbench.pro && $(MAKE)
+
+#Serial control update benchmark (build/bench/serialbench), needs the Arduino attached
+serialbenchmark.commands = cd bench && $(QMAKE) -o Makefile.serialbench serialbench.pro && $(MAKE) -f Makefile.serialbench
@@ -0,0 +1,460 @@
+/*! \file facetrackerbench.cpp
+    \brief Offline benchmark of FaceTracker on recorded video
+
+    Runs FaceTracker over every frame of a video file, image sequence or any
+    other frame source (see FrameSource::Create) for
+    every combination of the given tuning parameters and reports throughput,
+    per stage latency percentiles and how stable the detection was.
+
+    \code
+    facetrackerbench --min-feature-size 10,20,40 --scale-factor 1.1,1.2 \
+                     --processing-size 160x120,320x240 --csv results.csv recording.avi
+    facetrackerbench --threads 1,2,4 "synthetic:640x480?frames=500"
+    facetrackerbench --check-parallel face.png --threads 4
+    \endcode
+*/
+
+#include "facetracker.h"
+#include "cascadecache.h"
+#include "metrics.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryFile>
+#include <QScopedPointer>
+#include <QSize>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+
+//! One combination of tuning parameters
+struct BenchConfig
+{
+    QString classifier;
+    int minFeatureSize;
+    float scaleFactor;
+    int minNeighbors;
+    QSize processingSize;
+    int threads;
+    int detectionInterval;
+    bool roiTracking;
+    bool motionGating;
+    float frameBudget;  //!< Target frame time (ms) of the adaptive scheduler, 0 disables it
+};
+
+//! Results of running one BenchConfig over the whole file
+struct BenchResult
+{
+    int frames;
+    int detections;
+    int skipped;        //!< Frames that reused the previous result because nothing moved
+    int dropouts;       //!< Frames where a tracked face was lost
+    int targetSwitches; //!< Times the followed face changed identity
+    double jitter;      //!< Mean movement (px) of the face center between consecutive detections
+    int level;          //!< Detection level the scheduler settled on, -1 without scheduler
+    double seconds;
+    MetricSnapshot capture;
+    MetricSnapshot preprocess;
+    MetricSnapshot detect;
+};
+
+QTextStream out(stdout);
+QTextStream err(stderr);
+
+void PrintUsage()
+{
+    err << "Usage: facetrackerbench [options] <video file, image sequence or frame source URI>\n"
+        << "Every option takes a comma separated list, all combinations are run.\n"
+        << "  --classifier <xml>          (default " DEFAULT_CLASSIFIER_XML_FILENAME ")\n"
+        << "  --min-feature-size <px>     (default " << DEFAULT_MIN_FEATURE_SIZE << ")\n"
+        << "  --scale-factor <factor>     (default " << DEFAULT_SEARCH_SCALE_FACTOR << ")\n"
+        << "  --min-neighbors <count>     (default " << DEFAULT_MIN_NEIGHBORS_CUTOFF << ")\n"
+        << "  --processing-size <WxH>     (default " << DEFAULT_IMAGE_WIDTH << "x" << DEFAULT_IMAGE_HEIGHT << ")\n"
+        << "  --threads <count>           (default " << DEFAULT_DETECTION_THREADS << ")\n"
+        << "  --detection-interval <n>    (default " << DEFAULT_DETECTION_INTERVAL << ")\n"
+        << "  --roi <0|1>                 (default " << (DEFAULT_ROI_TRACKING ? 1 : 0) << ")\n"
+        << "  --motion-gate <0|1>         (default " << (DEFAULT_MOTION_GATING ? 1 : 0) << ")\n"
+        << "  --frame-budget <ms>         Adaptive scheduling target, 0 disables (default 0)\n"
+        << "Other options:\n"
+        << "  --frames <count>            Stop after this many frames\n"
+        << "  --csv <file>                Also write the results as CSV\n"
+        << "  --check-parallel <image>    Only check that the parallel detector finds the same\n"
+        << "                              faces as detectMultiScale() on the image\n";
+    err.flush();
+}
+
+bool RectLess(const cv::Rect &a, const cv::Rect &b)
+{
+    if(a.y != b.y)
+        return a.y < b.y;
+    if(a.x != b.x)
+        return a.x < b.x;
+    if(a.width != b.width)
+        return a.width < b.width;
+    return a.height < b.height;
+}
+
+/*! \brief Compares ParallelCascadeDetector to the serial detectMultiScale() on one image
+  Both the raw candidates (no grouping) and the grouped detections have to match exactly.
+  \returns true if all results are identical
+*/
+bool CheckParallel(const QString &imageFilename, const BenchConfig &config)
+{
+    cv::Mat image = cv::imread(imageFilename.toStdString(), 0);
+    if(image.empty())
+    {
+        err << "Unable to read " << imageFilename << "\n";
+        return false;
+    }
+    cv::equalizeHist(image, image);
+
+    cv::CascadeClassifier serial;
+    std::vector<cv::CascadeClassifier*> classifiers(1, &serial);
+    ParallelCascadeDetector parallel;
+    int threads = std::max(config.threads, 2);
+    //Bundled classifiers are Qt resources, OpenCV needs them on disk
+    std::string path = CascadeCache::Resolve(config.classifier.toStdString());
+    QScopedPointer<QTemporaryFile> temporaryFile;
+    if(path.empty())
+    {
+        QFile resource(config.classifier);
+        temporaryFile.reset(QTemporaryFile::createLocalFile(resource));
+        if(temporaryFile)
+        {
+            temporaryFile->close();
+            path = temporaryFile->fileName().toStdString();
+        }
+    }
+
+    if(path.empty() || !CascadeCache::Load(path, classifiers) || !parallel.Load(path, threads))
+    {
+        err << "Unable to load " << config.classifier << " for the parallel detector\n";
+        return false;
+    }
+
+    cv::Size minSize(config.minFeatureSize, config.minFeatureSize);
+    bool identical = true;
+    int neighbors[] = {0, config.minNeighbors};
+    for(int i = 0; i < 2; i++)
+    {
+        std::vector<cv::Rect> expected, actual;
+        serial.detectMultiScale(image, expected, config.scaleFactor, neighbors[i],
+                                cv::CASCADE_SCALE_IMAGE, minSize);
+        parallel.DetectMultiScale(image, actual, config.scaleFactor, neighbors[i], minSize);
+        std::sort(expected.begin(), expected.end(), RectLess);
+        std::sort(actual.begin(), actual.end(), RectLess);
+
+        bool match = expected == actual;
+        out << "min neighbors " << neighbors[i] << ": serial " << expected.size()
+            << ", parallel " << actual.size() << " (" << threads << " threads) "
+            << (match ? "identical" : "DIFFERENT") << "\n";
+        identical = identical && match;
+    }
+    out.flush();
+    return identical;
+}
+
+QSize ParseSize(const QString &text, bool *ok)
+{
+    QStringList parts = text.split('x');
+    if(parts.size() != 2)
+    {
+        *ok = false;
+        return QSize();
+    }
+
+    bool widthOk, heightOk;
+    QSize size(parts[0].toInt(&widthOk), parts[1].toInt(&heightOk));
+    *ok = widthOk && heightOk && size.width() > 0 && size.height() > 0;
+    return size;
+}
+
+BenchResult Run(const QString &video, const BenchConfig &config, int maxFrames)
+{
+    FaceTracker tracker(video.toStdString());
+    tracker.SetClassifierXmlFilename(config.classifier.toStdString());
+    tracker.SetMinFeatureSize(config.minFeatureSize);
+    tracker.SetSearchScaleFactor(config.scaleFactor);
+    tracker.SetMinNeighbors(config.minNeighbors);
+    tracker.SetProcessingImageDimensions(config.processingSize.width(), config.processingSize.height());
+    tracker.SetDetectionThreadCount(config.threads);
+    tracker.SetDetectionInterval(config.detectionInterval);
+    tracker.SetRegionOfInterestTracking(config.roiTracking);
+    tracker.SetMotionGating(config.motionGating);
+    if(config.frameBudget > 0)
+    {
+        tracker.SetTargetFrameTime(config.frameBudget);
+        tracker.SetAdaptiveScheduling(true);
+    }
+
+    BenchResult result;
+    result.frames = 0;
+    result.detections = 0;
+    result.skipped = 0;
+    result.dropouts = 0;
+    result.targetSwitches = 0;
+    result.jitter = 0;
+
+    MetricSnapshot capture = Metrics::Snapshot(Metrics::CaptureTime);
+    MetricSnapshot preprocess = Metrics::Snapshot(Metrics::PreprocessTime);
+    MetricSnapshot detect = Metrics::Snapshot(Metrics::DetectTime);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QRect previous;
+    int previousTarget = -1;
+    int jitterSamples = 0;
+    while(maxFrames <= 0 || result.frames < maxFrames)
+    {
+        QRect position = tracker.GetFacePosition();
+        if(tracker.IsEndOfStream())
+            break;
+
+        result.frames++;
+        if(tracker.WasLastFrameSkipped())
+            result.skipped++;
+        int target = tracker.GetTargetTrackId();
+        if(target >= 0 && previousTarget >= 0 && target != previousTarget)
+            result.targetSwitches++;
+        if(target >= 0)
+            previousTarget = target;
+
+        if(position.isValid())
+        {
+            result.detections++;
+            if(previous.isValid())
+            {
+                QPoint delta = position.center() - previous.center();
+                result.jitter += std::sqrt((double)(delta.x()*delta.x() + delta.y()*delta.y()));
+                jitterSamples++;
+            }
+        }
+        else if(previous.isValid())
+            result.dropouts++;
+        previous = position;
+    }
+
+    result.seconds = timer.elapsed()/1000.0;
+    if(jitterSamples > 0)
+        result.jitter /= jitterSamples;
+    result.level = tracker.GetDetectionLevel();
+
+    result.capture = Metrics::Snapshot(Metrics::CaptureTime) - capture;
+    result.preprocess = Metrics::Snapshot(Metrics::PreprocessTime) - preprocess;
+    result.detect = Metrics::Snapshot(Metrics::DetectTime) - detect;
+    return result;
+}
+
+QStringList ResultColumns(const BenchConfig &config, const BenchResult &result)
+{
+    QStringList columns;
+    columns << config.classifier
+            << QString::number(config.minFeatureSize)
+            << QString::number(config.scaleFactor)
+            << QString::number(config.minNeighbors)
+            << QString("%1x%2").arg(config.processingSize.width()).arg(config.processingSize.height())
+            << QString::number(config.threads)
+            << QString::number(config.detectionInterval)
+            << QString::number(config.roiTracking ? 1 : 0)
+            << QString::number(config.motionGating ? 1 : 0)
+            << QString::number(config.frameBudget)
+            << QString::number(result.frames)
+            << QString::number(result.seconds > 0 ? result.frames/result.seconds : 0.0, 'f', 1)
+            << QString::number(result.capture.Percentile(0.50)/1000, 'f', 2)
+            << QString::number(result.capture.Percentile(0.95)/1000, 'f', 2)
+            << QString::number(result.preprocess.Percentile(0.50)/1000, 'f', 2)
+            << QString::number(result.preprocess.Percentile(0.95)/1000, 'f', 2)
+            << QString::number(result.detect.Percentile(0.50)/1000, 'f', 2)
+            << QString::number(result.detect.Percentile(0.95)/1000, 'f', 2)
+            << QString::number(result.detect.Percentile(0.99)/1000, 'f', 2)
+            << QString::number(result.frames > 0 ? 100.0*result.detections/result.frames : 0.0, 'f', 1)
+            << QString::number(result.frames > 0 ? 100.0*result.skipped/result.frames : 0.0, 'f', 1)
+            << QString::number(result.dropouts)
+            << QString::number(result.targetSwitches)
+            << QString::number(result.jitter, 'f', 1)
+            << QString::number(result.level);
+    return columns;
+}
+
+QStringList HeaderColumns()
+{
+    QStringList columns;
+    columns << "classifier" << "min_feature" << "scale" << "neighbors" << "size" << "threads"
+            << "interval" << "roi" << "gate" << "budget_ms" << "frames" << "fps"
+            << "capture_p50_ms" << "capture_p95_ms" << "preprocess_p50_ms" << "preprocess_p95_ms"
+            << "detect_p50_ms" << "detect_p95_ms" << "detect_p99_ms"
+            << "detected_pct" << "skipped_pct" << "dropouts" << "switches" << "jitter_px" << "level";
+    return columns;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList classifiers(DEFAULT_CLASSIFIER_XML_FILENAME);
+    QStringList minFeatureSizes(QString::number(DEFAULT_MIN_FEATURE_SIZE));
+    QStringList scaleFactors(QString::number(DEFAULT_SEARCH_SCALE_FACTOR));
+    QStringList minNeighbors(QString::number(DEFAULT_MIN_NEIGHBORS_CUTOFF));
+    QStringList processingSizes(QString("%1x%2").arg(DEFAULT_IMAGE_WIDTH).arg(DEFAULT_IMAGE_HEIGHT));
+    QStringList threads(QString::number(DEFAULT_DETECTION_THREADS));
+    QStringList detectionIntervals(QString::number(DEFAULT_DETECTION_INTERVAL));
+    QStringList roiTracking(QString::number(DEFAULT_ROI_TRACKING ? 1 : 0));
+    QStringList motionGating(QString::number(DEFAULT_MOTION_GATING ? 1 : 0));
+    QStringList frameBudgets("0");
+    int maxFrames = 0;
+    QString csvFilename;
+    QString checkImage;
+    QString video;
+
+    QStringList args = app.arguments();
+    for(int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args[i];
+        if(!arg.startsWith("--"))
+        {
+            video = arg;
+            continue;
+        }
+        if(i + 1 >= args.size())
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        QString value = args[++i];
+        if(arg == "--classifier")
+            classifiers = value.split(',');
+        else if(arg == "--min-feature-size")
+            minFeatureSizes = value.split(',');
+        else if(arg == "--scale-factor")
+            scaleFactors = value.split(',');
+        else if(arg == "--min-neighbors")
+            minNeighbors = value.split(',');
+        else if(arg == "--processing-size")
+            processingSizes = value.split(',');
+        else if(arg == "--threads")
+            threads = value.split(',');
+        else if(arg == "--detection-interval")
+            detectionIntervals = value.split(',');
+        else if(arg == "--roi")
+            roiTracking = value.split(',');
+        else if(arg == "--motion-gate")
+            motionGating = value.split(',');
+        else if(arg == "--frame-budget")
+            frameBudgets = value.split(',');
+        else if(arg == "--frames")
+            maxFrames = value.toInt();
+        else if(arg == "--csv")
+            csvFilename = value;
+        else if(arg == "--check-parallel")
+            checkImage = value;
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if(video.isEmpty() && checkImage.isEmpty())
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    //Build the full sweep up front so argument errors are reported before any work
+    QList<BenchConfig> configs;
+    foreach(const QString &classifier, classifiers)
+    foreach(const QString &minFeatureSize, minFeatureSizes)
+    foreach(const QString &scaleFactor, scaleFactors)
+    foreach(const QString &neighbors, minNeighbors)
+    foreach(const QString &processingSize, processingSizes)
+    foreach(const QString &threadCount, threads)
+    foreach(const QString &interval, detectionIntervals)
+    foreach(const QString &roi, roiTracking)
+    foreach(const QString &gate, motionGating)
+    foreach(const QString &budget, frameBudgets)
+    {
+        bool ok[9];
+        BenchConfig config;
+        config.classifier = classifier;
+        config.minFeatureSize = minFeatureSize.toInt(&ok[0]);
+        config.scaleFactor = scaleFactor.toFloat(&ok[1]);
+        config.minNeighbors = neighbors.toInt(&ok[2]);
+        config.processingSize = ParseSize(processingSize, &ok[3]);
+        config.threads = threadCount.toInt(&ok[4]);
+        config.detectionInterval = interval.toInt(&ok[5]);
+        config.roiTracking = roi.toInt(&ok[6]) != 0;
+        config.motionGating = gate.toInt(&ok[7]) != 0;
+        config.frameBudget = budget.toFloat(&ok[8]);
+
+        for(int i = 0; i < 9; i++)
+        {
+            if(!ok[i])
+            {
+                err << "Invalid parameter value\n";
+                PrintUsage();
+                return 1;
+            }
+        }
+        configs.append(config);
+    }
+
+    if(!checkImage.isEmpty())
+    {
+        bool identical = true;
+        for(int i = 0; i < configs.size(); i++)
+            identical = CheckParallel(checkImage, configs[i]) && identical;
+        return identical ? 0 : 1;
+    }
+
+    QFile csvFile;
+    QTextStream csv;
+    if(!csvFilename.isEmpty())
+    {
+        csvFile.setFileName(csvFilename);
+        if(!csvFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            err << "Unable to open " << csvFilename << "\n";
+            return 1;
+        }
+        csv.setDevice(&csvFile);
+        csv << HeaderColumns().join(",") << "\n";
+    }
+
+    out << HeaderColumns().join("\t") << "\n";
+    out.flush();
+
+    for(int i = 0; i < configs.size(); i++)
+    {
+        BenchResult result;
+        try
+        {
+            result = Run(video, configs[i], maxFrames);
+        }
+        catch(std::exception &e)
+        {
+            err << "Run " << i + 1 << " of " << configs.size() << " failed: " << e.what() << "\n";
+            err.flush();
+            return 1;
+        }
+
+        QStringList columns = ResultColumns(configs[i], result);
+        out << columns.join("\t") << "\n";
+        out.flush();
+        if(csvFile.isOpen())
+        {
+            csv << columns.join(",") << "\n";
+            csv.flush();
+        }
+    }
+
+    return 0;
+}
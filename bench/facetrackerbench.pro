@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# Offline FaceTracker benchmark, see facetrackerbench.cpp
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = facetrackerbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+LIBS += -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_ml -lopencv_video -lopencv_features2d -lopencv_calib3d -lopencv_objdetect -lopencv_contrib -lopencv_legacy -lopencv_flann
+unix:!macx: LIBS += -lrt
+
+INCLUDEPATH += ../src
+
+SOURCES += facetrackerbench.cpp \
+    ../src/facetracker.cpp \
+    ../src/facetracktable.cpp \
+    ../src/facepredictor.cpp \
+    ../src/detectionscheduler.cpp \
+    ../src/framegrabber.cpp \
+    ../src/framesource.cpp \
+    ../src/sharedmemoryframesource.cpp \
+    ../src/v4l2framesource.cpp \
+    ../src/parallelcascadedetector.cpp \
+    ../src/cascadecache.cpp \
+    ../src/frameprocessing.cpp \
+    ../src/videoframe.cpp \
+    ../src/metrics.cpp
+
+HEADERS += ../src/facetracker.h \
+    ../src/facetracktable.h \
+    ../src/facepredictor.h \
+    ../src/detectionscheduler.h \
+    ../src/framegrabber.h \
+    ../src/framesource.h \
+    ../src/sharedmemoryframesource.h \
+    ../src/v4l2framesource.h \
+    ../src/parallelcascadedetector.h \
+    ../src/cascadecache.h \
+    ../src/frameprocessing.h \
+    ../src/videoframe.h \
+    ../src/metrics.h
+
+RESOURCES += ../resources/resources.qrc
+
+OBJECTS_DIR = ../build/bench/.obj
+MOC_DIR = ../build/bench/.moc
+RCC_DIR = ../build/bench/.rcc
+DESTDIR = ../build/bench
+
+CONFIG += release
+CONFIG -= debug
+
+#Same vectorized preprocessing as the application, decided by the target architecture
+contains(QT_ARCH, x86_64)|contains(QT_ARCH, i386)|contains(QT_ARCH, x86) {
+    QMAKE_CXXFLAGS += -mssse3
+}
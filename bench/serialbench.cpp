@@ -0,0 +1,205 @@
+/*! \file serialbench.cpp
+    \brief Throughput benchmark of the control update sent to the Arduino
+
+    Measures the bare round trip of the link with MESSAGE_ECHO_REQUEST
+    (echo), then sends the per frame control update to the device in three
+    ways and reports how many updates per second each one sustains:
+    - sequential: position H, position V, adjust H and adjust V requests,
+      each waiting for its response, as HardwareManager used to do
+    - pipelined: the same four requests sent at once
+    - combined: a single MESSAGE_ADJUST_POSITION_REPORT
+
+    The targets are the current position, the monitor does not move. Runs
+    with different \c --baud values show what the link rate gains.
+
+    \code
+    serialbench --port /dev/ttyACM0 --updates 200 --baud 1000000
+    \endcode
+*/
+
+#include "hardwaremanager.h"
+#include "metrics.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QThread>
+#include <unistd.h>
+
+namespace
+{
+
+//! Default time (ms) the Arduino needs to boot after the port was opened
+const int DefaultSettleTime = 4000;
+
+QTextStream out(stdout);
+QTextStream err(stderr);
+
+//! Results of sending one kind of update repeatedly
+struct BenchResult
+{
+    int updates;
+    int failures;
+    double seconds;
+    MetricSnapshot latency;
+};
+
+void PrintUsage()
+{
+    err << "Usage: serialbench [options]\n"
+        << "  --port <tty>                (default " << Serial::DefaultTTYDevice.c_str() << ")\n"
+        << "  --updates <count>           Updates per mode (default 100)\n"
+        << "  --baud <rate>               Link rate to negotiate (default " << BAUD_RATE_BOOT << ")\n"
+        << "  --settle <ms>               Wait for the Arduino to boot (default " << DefaultSettleTime << ")\n";
+}
+
+//! Sends one update the way \a mode describes, returns false if a response was missing
+bool SendUpdate(ThreadSafeAsyncSerial &serial, const QString &mode, quint8 h, quint8 v)
+{
+    HardwareComm::Message response;
+    if(mode == "echo")
+        return serial.sendMessage(HardwareComm::Message(MESSAGE_ECHO_REQUEST), response);
+    if(mode == "sequential")
+    {
+        return serial.sendMessage(HardwareComm::Message(MESSAGE_POSITION_H_REQUEST), response)
+                && serial.sendMessage(HardwareComm::Message(MESSAGE_POSITION_V_REQUEST), response)
+                && serial.sendMessage(HardwareComm::Message(MESSAGE_ADJUST_H_POSITION, h), response)
+                && serial.sendMessage(HardwareComm::Message(MESSAGE_ADJUST_V_POSITION, v), response);
+    }
+    if(mode == "pipelined")
+    {
+        SerialRequestPtr requests[4];
+        requests[0] = serial.sendRequest(HardwareComm::Message(MESSAGE_POSITION_H_REQUEST));
+        requests[1] = serial.sendRequest(HardwareComm::Message(MESSAGE_POSITION_V_REQUEST));
+        requests[2] = serial.sendRequest(HardwareComm::Message(MESSAGE_ADJUST_H_POSITION, h));
+        requests[3] = serial.sendRequest(HardwareComm::Message(MESSAGE_ADJUST_V_POSITION, v));
+
+        bool completed = true;
+        for(int i = 0; i < 4; i++)
+        {
+            requests[i]->waitForFinished();
+            completed &= requests[i]->state() == SerialRequest::Completed;
+        }
+        return completed;
+    }
+    return serial.sendMessage(HardwareComm::Message(MESSAGE_ADJUST_POSITION_REPORT, h, v), response);
+}
+
+BenchResult Run(ThreadSafeAsyncSerial &serial, const QString &mode, int updates, quint8 h, quint8 v)
+{
+    BenchResult result;
+    result.updates = updates;
+    result.failures = 0;
+
+    MetricHistogram latency;
+    QElapsedTimer total;
+    total.start();
+    for(int i = 0; i < updates; i++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        if(!SendUpdate(serial, mode, h, v))
+            result.failures++;
+        latency.Record(timer.nsecsElapsed()/1000);
+    }
+    result.seconds = total.elapsed()/1000.0;
+    result.latency = latency.Snapshot();
+    return result;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString port(Serial::DefaultTTYDevice.c_str());
+    int updates = 100;
+    int settle = DefaultSettleTime;
+    int baud = BAUD_RATE_BOOT;
+
+    QStringList args = app.arguments();
+    for(int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args[i];
+        if(i + 1 >= args.size())
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        QString value = args[++i];
+        bool ok = true;
+        if(arg == "--port")
+            port = value;
+        else if(arg == "--updates")
+            updates = value.toInt(&ok);
+        else if(arg == "--settle")
+            settle = value.toInt(&ok);
+        else if(arg == "--baud")
+            baud = value.toInt(&ok);
+        else
+            ok = false;
+
+        if(!ok)
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    qRegisterMetaType<HardwareComm::Message>("HardwareComm::Message");
+
+    ThreadSafeAsyncSerial serial;
+    if(!serial.openSerialTTY(port.toStdString()))
+    {
+        err << "Unable to open " << port << "\n";
+        return 1;
+    }
+
+    QThread reader;
+    serial.moveToThread(&reader);
+    QObject::connect(&reader, SIGNAL(started()), &serial, SLOT(begin()));
+    //There is no event loop in this thread to deliver a queued quit
+    QObject::connect(&serial, SIGNAL(finished()), &reader, SLOT(quit()), Qt::DirectConnection);
+    reader.start();
+
+    //Opening the port resets the Arduino
+    usleep(settle*1000);
+    serial.setReady();
+
+    if(baud != BAUD_RATE_BOOT && !serial.negotiateBaudRate(baud))
+    {
+        err << "The device did not switch to " << baud << " baud\n";
+        serial.stop();
+        reader.wait();
+        return 1;
+    }
+
+    //Targets at the current position keep the monitor still
+    HardwareComm::Message position;
+    if(!serial.sendMessage(HardwareComm::Message(MESSAGE_POSITION_REQUEST), position))
+    {
+        err << "No response from the device on " << port << "\n";
+        serial.stop();
+        reader.wait();
+        return 1;
+    }
+
+    out << "mode\tbaud\tupdates\tfailures\tupdates_per_s\tlatency_p50_ms\tlatency_p95_ms\n";
+    QStringList modes;
+    modes << "echo" << "sequential" << "pipelined" << "combined";
+    foreach(const QString &mode, modes)
+    {
+        BenchResult result = Run(serial, mode, updates, position.params.one, position.params.two);
+        out << mode << "\t" << baud << "\t" << result.updates << "\t" << result.failures << "\t"
+            << QString::number(result.seconds > 0 ? result.updates/result.seconds : 0.0, 'f', 1) << "\t"
+            << QString::number(result.latency.Percentile(0.50)/1000, 'f', 2) << "\t"
+            << QString::number(result.latency.Percentile(0.95)/1000, 'f', 2) << "\n";
+        out.flush();
+    }
+
+    serial.stop();
+    reader.wait();
+    return 0;
+}
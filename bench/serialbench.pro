@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Serial control update benchmark, see serialbench.cpp
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = serialbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../src
+
+SOURCES += serialbench.cpp \
+    ../src/hardwaremanager.cpp \
+    ../src/serial.cpp \
+    ../src/metrics.cpp
+
+HEADERS += ../src/hardwaremanager.h \
+    ../src/serial.h \
+    ../src/CommunicationProtocol.h \
+    ../src/metrics.h
+
+OBJECTS_DIR = ../build/serialbench/.obj
+MOC_DIR = ../build/serialbench/.moc
+DESTDIR = ../build/bench
+
+CONFIG += release
+CONFIG -= debug
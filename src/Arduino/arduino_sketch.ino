@@ -19,11 +19,22 @@ int request = 0;                  // 2 bytes Raspberry Pi request
 
 struct Message
 {
+    Message() : msg(0), param1(0), param2(0), sequence(FRAME_ASYNC_SEQUENCE) {}
+
     unsigned int msg;
     byte param1;
     byte param2;
+    byte sequence;                // sequence ID of the request, repeated in its response
 };
 
+byte rxFrame[FRAME_MAX_SIZE];     // received bytes of the frame being assembled
+byte rxSize = 0;
+
+bool baudUnconfirmed = false;     // TRUE until a frame arrives at the rate set by MESSAGE_SET_BAUD_RATE
+unsigned long baudSwitchTime = 0;
+unsigned long linkBaudRate = BAUD_RATE_BOOT;
+unsigned long lastFrameTime = 0;  // millis() of the last valid frame
+
 unsigned int requestQueue = 0;
 #define JOYSTICK_PRESSED_QUEUE              (1<<0)
 #define POSITION_H_REACHED_QUEUE            (1<<1)
@@ -39,6 +50,12 @@ int requestedH = 0;
 int requestedV = 0;
 bool adjustingV = false;
 
+unsigned long streamInterval = 0; // ms between streamed position samples, 0: not streaming
+int streamDeadband = 0;            // change of either axis needed to send a sample, 0: send every sample
+unsigned long lastStreamTime = 0;
+int lastStreamH = -1;
+int lastStreamV = -1;
+
 const int actuatorVMax = 95;
 const int actuatorVMin = 22;
 const int actuatorHMax = 140;
@@ -57,9 +74,15 @@ void setVActuatorDirection(ActuatorDirection dir);
 void setHActuatorDirection(ActuatorDirection dir);
 byte getVPosition();
 byte getHPosition();
+void setRequestedH(byte position);
+void setRequestedV(byte position);
+void streamPosition();
 bool performSimple(Message &msg);
 void sendMessage(Message &msg);
 bool getMessage(Message &msg);
+bool decodeFrame(Message &msg);
+void dropFrameBytes(byte count);
+void setBaudRate(unsigned long baud, bool confirm);
 
 void setup()
 {
@@ -83,7 +106,7 @@ void setup()
 
     pinMode(5, OUTPUT);
     digitalWrite(5, LOW);
-    Serial.begin(9600);
+    Serial.begin(BAUD_RATE_BOOT);
 
     attachInterrupt(0, joystickPressed, FALLING);
     manualModeEnabled = true;
@@ -94,44 +117,102 @@ void loop()
     processQueue();
     if(getMessage(lastMSG))
         performSimple(lastMSG);
+    else if(baudUnconfirmed && millis() - baudSwitchTime > BAUD_RATE_CONFIRM_TIMEOUT)
+        setBaudRate(BAUD_RATE_BOOT, false);    // the host never got to the new rate
+    else if(linkBaudRate != BAUD_RATE_BOOT && millis() - lastFrameTime > BAUD_RATE_IDLE_TIMEOUT)
+        setBaudRate(BAUD_RATE_BOOT, false);    // the host lost the link, reopening the port need not reset us
 
     if(manualModeEnabled)
         processManualMode();
     if(adjustingH || adjustingV)
         performAdjust();
+    if(streamInterval > 0)
+        streamPosition();
 }
 
 bool getMessage(Message &msg)
 {
-    if(Serial.available() >= 2)
+    while(Serial.available() > 0)
     {
-        byte lsb = Serial.read();
-        byte msb = Serial.read();
-        msg.msg = word(msb, lsb);
-        //msg.param1 = Serial.parseInt();
-        //Serial.print("Got: "); Serial.println(msg.msg);
-        while(GET_MSG_PARAM_COUNT(msg.msg) > Serial.available())
+        byte data = Serial.read();
+        if(rxSize == 0 && data != FRAME_START)
+            continue;               // not in a frame, scan for the start byte
+        rxFrame[rxSize++] = data;
+
+        while(rxSize >= FRAME_HEADER_SIZE)
         {
-            //wait extra bytes
+            byte length = rxFrame[1];
+            if(length < FRAME_MIN_LENGTH || length > FRAME_MAX_LENGTH)
+            {
+                dropFrameBytes(1);
+                continue;
+            }
+            if(rxSize < FRAME_HEADER_SIZE + length + 1)
+                break;              // wait for the rest of the frame
+
+            if(decodeFrame(msg))
+            {
+                dropFrameBytes(FRAME_HEADER_SIZE + length + 1);
+                baudUnconfirmed = false;
+                lastFrameTime = millis();
+                return true;
+            }
+            dropFrameBytes(1);
         }
-        if(GET_MSG_PARAM_COUNT(msg.msg) >= 1)
-            msg.param1 = Serial.read();
-        if(GET_MSG_PARAM_COUNT(msg.msg) >= 2)
-            msg.param2 = Serial.read();
     }
-    else
+    return false;
+}
+
+bool decodeFrame(Message &msg)
+{
+    byte length = rxFrame[1];
+    if(frameCrc8(rxFrame + 1, length + 1) != rxFrame[FRAME_HEADER_SIZE + length])
         return false;
-    return true;
+
+    msg.sequence = rxFrame[2];
+    msg.msg = word(rxFrame[4], rxFrame[3]);
+    msg.param1 = length > 3 ? rxFrame[5] : 0;
+    msg.param2 = length > 4 ? rxFrame[6] : 0;
+    return FRAME_LENGTH(msg.msg) == length;
+}
+
+//Removes count bytes from the front of rxFrame, and everything up to the next start byte
+void dropFrameBytes(byte count)
+{
+    while(count < rxSize && rxFrame[count] != FRAME_START)
+        count++;
+    if(count > rxSize)
+        count = rxSize;
+    rxSize -= count;
+    memmove(rxFrame, rxFrame + count, rxSize);
 }
+
+void setBaudRate(unsigned long baud, bool confirm)
+{
+    Serial.flush();                 // the ACK still goes out at the old rate
+    Serial.end();
+    Serial.begin(baud);
+    rxSize = 0;
+    linkBaudRate = baud;
+    baudUnconfirmed = confirm;
+    baudSwitchTime = millis();
+    lastFrameTime = baudSwitchTime;
+}
+
 void sendMessage(Message &msg)
 {
-    Serial.write(lowByte(msg.msg));
-    Serial.write(highByte(msg.msg));
-    //Serial.print("Sending:" ); Serial.println(msg.msg, DEC);
-    if(GET_MSG_PARAM_COUNT(msg.msg) >= 1)
-        Serial.write(msg.param1);
-    if(GET_MSG_PARAM_COUNT(msg.msg) >= 2)
-        Serial.write(msg.param2);
+    byte frame[FRAME_MAX_SIZE];
+    byte length = FRAME_LENGTH(msg.msg);
+    frame[0] = FRAME_START;
+    frame[1] = length;
+    frame[2] = msg.sequence;
+    frame[3] = lowByte(msg.msg);
+    frame[4] = highByte(msg.msg);
+    frame[5] = msg.param1;
+    frame[6] = msg.param2;
+    frame[FRAME_HEADER_SIZE + length] = frameCrc8(frame + 1, length + 1);
+
+    Serial.write(frame, FRAME_HEADER_SIZE + length + 1);
     Serial.flush();
 }
 
@@ -139,12 +220,25 @@ bool performSimple(Message &msg)
 {
     bool performed = true;
     Message response;
+    response.sequence = msg.sequence;
     switch(msg.msg)
     {
     case MESSAGE_ECHO_REQUEST:
         response.msg = MESSAGE_ECHO_RESPONSE;
         break;
 
+    case MESSAGE_SET_BAUD_RATE:
+        if(baudRateFromCode(msg.param1) == 0)
+        {
+            response.msg = MESSAGE_NACK;
+            performed = false;
+            break;
+        }
+        response.msg = MESSAGE_ACK;
+        sendMessage(response);
+        setBaudRate(baudRateFromCode(msg.param1), true);
+        return true;
+
     case MESSAGE_POSITION_H_REQUEST:
         response.msg = MESSAGE_POSITION_H_RESPONSE;
         response.param1 = map(getHPosition(), actuatorHMin, actuatorHMax, 0, 255);
@@ -181,26 +275,39 @@ bool performSimple(Message &msg)
         break;
 
     case MESSAGE_ADJUST_H_POSITION:
-        requestedH = map(msg.param1, 0, 255, actuatorHMin, actuatorHMax);
-        if(requestedH < actuatorHMin)
-            requestedH = actuatorHMin;
-        if(requestedH > actuatorHMax)
-            requestedH = actuatorHMax;
-
-        adjustingH = true;
-
+        setRequestedH(msg.param1);
         response.msg = MESSAGE_ACK;
         break;
 
     case MESSAGE_ADJUST_V_POSITION:
-        requestedV = map(msg.param1, 0, 255, actuatorVMin, actuatorVMax);
-        if(requestedV < actuatorVMin)
-            requestedV = actuatorVMin;
-        if(requestedV > actuatorVMax)
-            requestedV = actuatorVMax;
+        setRequestedV(msg.param1);
+        response.msg = MESSAGE_ACK;
+        break;
 
-        adjustingV = true;
+    case MESSAGE_ADJUST_POSITION_REPORT:
+    case MESSAGE_ADJUST_H_POSITION_REPORT:
+    case MESSAGE_ADJUST_V_POSITION_REPORT:
+        //Report where the monitor is before it starts moving
+        response.msg = MESSAGE_POSITION_RESPONSE;
+        response.param1 = map(getHPosition(), actuatorHMin, actuatorHMax, 0, 255);
+        response.param2 = map(getVPosition(), actuatorVMin, actuatorVMax, 0, 255);
 
+        if(msg.msg & MESSAGE_DIRECTION_H)
+            setRequestedH(msg.param1);
+        if(msg.msg & MESSAGE_DIRECTION_V)
+            setRequestedV(msg.param2);
+        break;
+
+    case MESSAGE_POSITION_SUBSCRIBE:
+        streamInterval = max(1, msg.param1)*10UL;
+        streamDeadband = msg.param2;
+        lastStreamH = -1;           // the first sample is always sent
+        lastStreamV = -1;
+        response.msg = MESSAGE_ACK;
+        break;
+
+    case MESSAGE_POSITION_UNSUBSCRIBE:
+        streamInterval = 0;
         response.msg = MESSAGE_ACK;
         break;
 
@@ -214,6 +321,50 @@ bool performSimple(Message &msg)
     return performed;
 }
 
+void streamPosition()
+{
+    if(millis() - lastStreamTime < streamInterval)
+        return;
+    lastStreamTime = millis();
+
+    int h = map(getHPosition(), actuatorHMin, actuatorHMax, 0, 255);
+    int v = map(getVPosition(), actuatorVMin, actuatorVMax, 0, 255);
+    bool moved = abs(h - lastStreamH) > streamDeadband || abs(v - lastStreamV) > streamDeadband;
+    if(streamDeadband > 0 && lastStreamH >= 0 && !moved)
+        return;
+
+    lastStreamH = h;
+    lastStreamV = v;
+
+    Message msg;
+    msg.msg = MESSAGE_POSITION_UPDATE;
+    msg.param1 = h;
+    msg.param2 = v;
+    sendMessage(msg);
+}
+
+void setRequestedH(byte position)
+{
+    requestedH = map(position, 0, 255, actuatorHMin, actuatorHMax);
+    if(requestedH < actuatorHMin)
+        requestedH = actuatorHMin;
+    if(requestedH > actuatorHMax)
+        requestedH = actuatorHMax;
+
+    adjustingH = true;
+}
+
+void setRequestedV(byte position)
+{
+    requestedV = map(position, 0, 255, actuatorVMin, actuatorVMax);
+    if(requestedV < actuatorVMin)
+        requestedV = actuatorVMin;
+    if(requestedV > actuatorVMax)
+        requestedV = actuatorVMax;
+
+    adjustingV = true;
+}
+
 byte getHPosition()
 {
     return map(analogRead(horiz_wiper), 0, 1023, 0, 255);
@@ -28,6 +28,11 @@
 #define MESSAGE_ECHO_REQUEST        (MESSAGE_ECHO | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_0)
 #define MESSAGE_ECHO_RESPONSE       (MESSAGE_ECHO | MESSAGE_TYPE_RESPONSE | MESSAGE_PARAM_COUNT_0)
 
+//Switches the link to baudRateFromCode(param), ACKed at the old rate. The device goes back to
+//BAUD_RATE_BOOT unless a valid frame arrives at the new rate within BAUD_RATE_CONFIRM_TIMEOUT ms,
+//and later whenever no valid frame arrives for BAUD_RATE_IDLE_TIMEOUT ms.
+#define MESSAGE_SET_BAUD_RATE       (MESSAGE_ECHO | MESSAGE_BOOL_TRUE | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_1)
+
 //decimal 2114
 #define MESSAGE_ACK                 (MESSAGE_ACKNOWLEDGEMENT | MESSAGE_BOOL_TRUE | MESSAGE_TYPE_RESPONSE | MESSAGE_PARAM_COUNT_0)
 #define MESSAGE_NACK                (MESSAGE_ACKNOWLEDGEMENT | MESSAGE_BOOL_FALSE | MESSAGE_TYPE_RESPONSE | MESSAGE_PARAM_COUNT_0)
@@ -50,6 +55,16 @@
 #define MESSAGE_POSITION_V_RESPONSE  (MESSAGE_POSITION | MESSAGE_DIRECTION_V | MESSAGE_TYPE_RESPONSE | MESSAGE_PARAM_COUNT_1)
 #define MESSAGE_POSITION_UPDATE     (MESSAGE_POSITION | MESSAGE_TYPE_ASYNC | MESSAGE_PARAM_COUNT_2)
 
+//Streams MESSAGE_POSITION_UPDATE, params: sample interval (10 ms units), deadband (position units, 0 sends every sample)
+#define MESSAGE_POSITION_SUBSCRIBE      (MESSAGE_POSITION | MESSAGE_BOOL_TRUE | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_2)
+#define MESSAGE_POSITION_UNSUBSCRIBE    (MESSAGE_POSITION | MESSAGE_BOOL_FALSE | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_0)
+
+//Targets of the axes named by the direction bits (params: h, v), answered with MESSAGE_POSITION_RESPONSE
+//holding the position before the move. One round trip per control update.
+#define MESSAGE_ADJUST_POSITION_REPORT      (MESSAGE_ADJUST_POSITION | MESSAGE_POSITION | MESSAGE_DIRECTION_H | MESSAGE_DIRECTION_V | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_2)
+#define MESSAGE_ADJUST_H_POSITION_REPORT    (MESSAGE_ADJUST_POSITION | MESSAGE_POSITION | MESSAGE_DIRECTION_H | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_2)
+#define MESSAGE_ADJUST_V_POSITION_REPORT    (MESSAGE_ADJUST_POSITION | MESSAGE_POSITION | MESSAGE_DIRECTION_V | MESSAGE_TYPE_REQUEST | MESSAGE_PARAM_COUNT_2)
+
 #define MESSAGE_POSITION_REACHED    (MESSAGE_POSITION_REACHED_BIT | MESSAGE_TYPE_ASYNC | MESSAGE_PARAM_COUNT_2)
 #define MESSAGE_POSITION_H_REACHED  (MESSAGE_POSITION_REACHED_BIT | MESSAGE_DIRECTION_H | MESSAGE_TYPE_ASYNC | MESSAGE_PARAM_COUNT_1)
 #define MESSAGE_POSITION_V_REACHED  (MESSAGE_POSITION_REACHED_BIT | MESSAGE_DIRECTION_V | MESSAGE_TYPE_ASYNC | MESSAGE_PARAM_COUNT_1)
@@ -58,4 +73,58 @@
 #define GET_MSG_PARAM_COUNT(msg)    ((unsigned)(msg & MESSAGE_PARAM_MASK)>>14)
 
 
+//Framing (protocol v2), every message travels in a frame:
+//  START LEN SEQ MSG_LSB MSG_MSB [PARAM1] [PARAM2] CRC
+//LEN counts the bytes from SEQ to the last param, CRC is frameCrc8() of LEN up to the last param.
+//Requests carry a sequence ID (1 .. 255) their response repeats, async messages use FRAME_ASYNC_SEQUENCE.
+//A receiver that finds a bad length or CRC drops the start byte and scans for the next one.
+#define PROTOCOL_VERSION            2
+#define FRAME_START                 0xA5
+#define FRAME_ASYNC_SEQUENCE        0
+#define FRAME_HEADER_SIZE           2   // START, LEN
+#define FRAME_MIN_LENGTH            3
+#define FRAME_MAX_LENGTH            5
+#define FRAME_MAX_SIZE              (FRAME_HEADER_SIZE + FRAME_MAX_LENGTH + 1)
+
+#define FRAME_LENGTH(msg)           (3 + GET_MSG_PARAM_COUNT(msg))
+#define FRAME_SIZE(msg)             (FRAME_HEADER_SIZE + FRAME_LENGTH(msg) + 1)
+
+//Link rates, codes sent with MESSAGE_SET_BAUD_RATE. 500000 and 1000000 are exact on a 16 MHz AVR.
+#define BAUD_RATE_BOOT              9600
+#define BAUD_RATE_CODE_COUNT        7
+#define BAUD_RATE_CONFIRM_TIMEOUT   1000
+//Time (ms) without a valid frame after which the device goes back to BAUD_RATE_BOOT. Longer than
+//two heartbeats of the host, shorter than its handshake, so a host that reconnects finds it there.
+#define BAUD_RATE_IDLE_TIMEOUT      2500
+
+//Returns the rate (baud) of a MESSAGE_SET_BAUD_RATE code, 0 if unknown
+static inline unsigned long baudRateFromCode(unsigned char code)
+{
+    switch(code)
+    {
+    case 0: return 9600;
+    case 1: return 19200;
+    case 2: return 38400;
+    case 3: return 57600;
+    case 4: return 115200;
+    case 5: return 500000;
+    case 6: return 1000000;
+    default: return 0;
+    }
+}
+
+//CRC-8 of the frame, polynomial x^8 + x^2 + x + 1 (0x07), initial value 0
+static inline unsigned char frameCrc8(const unsigned char *data, unsigned int size)
+{
+    unsigned char crc = 0;
+    while(size--)
+    {
+        crc ^= *data++;
+        for(unsigned char bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+    }
+    return crc;
+}
+
+
 #endif // COMMUNICATIONPROTOCOL_H
@@ -0,0 +1,488 @@
+#include "cascadecache.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QResource>
+#include <QStringList>
+#include <cstring>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+namespace
+{
+//! Bias the old format evaluation subtracts from every stage threshold
+const float OldStageThresholdBias = 0.0001f;
+
+//! Start of a cache entry, followed by the arrays it counts and the features
+struct CacheHeader
+{
+    static const quint32 Magic = 0x43434C4C;   //!< "LLCC"
+    static const quint32 Version = 1;
+
+    quint32 magic;
+    quint32 version;
+    quint32 stageSize;      //!< sizeof() of the structures below, entries from other builds are rejected
+    quint32 treeSize;
+    quint32 nodeSize;
+    qint32 stageType;
+    qint32 featureType;
+    qint32 categoryCount;
+    qint32 stumpBased;
+    qint32 width;
+    qint32 height;
+    quint32 stageCount;
+    quint32 treeCount;
+    quint32 nodeCount;
+    quint32 leafCount;
+    quint32 subsetCount;
+    quint32 featuresSize;   //!< Bytes of the features in compact YAML
+};
+
+//! Writes \a node in flow style, the smallest text OpenCV reads back
+void WriteNode(cv::FileStorage &storage, const cv::FileNode &node)
+{
+    switch(node.type() & cv::FileNode::TYPE_MASK)
+    {
+    case cv::FileNode::SEQ:
+        storage << "[:";
+        for(cv::FileNodeIterator itr = node.begin(); itr != node.end(); ++itr)
+            WriteNode(storage, *itr);
+        storage << "]";
+        break;
+    case cv::FileNode::MAP:
+        storage << "{:";
+        for(cv::FileNodeIterator itr = node.begin(); itr != node.end(); ++itr)
+        {
+            storage << (*itr).name();
+            WriteNode(storage, *itr);
+        }
+        storage << "}";
+        break;
+    case cv::FileNode::INT:
+        storage << (int)node;
+        break;
+    case cv::FileNode::REAL:
+        storage << (double)node;
+        break;
+    case cv::FileNode::STR:
+        storage << (std::string)node;
+        break;
+    }
+}
+
+template<typename T>
+void AppendArray(QByteArray &bytes, const std::vector<T> &array)
+{
+    if(!array.empty())
+        bytes.append((const char *)&array[0], array.size()*sizeof(T));
+}
+
+template<typename T>
+const uchar *ReadArray(const uchar *bytes, quint32 count, std::vector<T> &array)
+{
+    array.resize(count);
+    if(count > 0)
+        memcpy(&array[0], bytes, count*sizeof(T));
+    return bytes + count*sizeof(T);
+}
+
+/*! \brief The parsed form of a cascade, as cv::CascadeClassifier keeps it
+
+  OpenCV 2.4 keeps the parsed cascade protected, deriving from
+  cv::CascadeClassifier is the only way to read it out and to hand it to
+  other classifiers without parsing the file again. The features are the
+  one part only the feature evaluator can read, they are kept as compact
+  YAML for it.
+*/
+class ParsedCascade : public cv::CascadeClassifier
+{
+public:
+    /*! \brief Takes the cascade from the root node of a classifier file
+      Old format Haar cascades are converted to the current format.
+      \param keepFeatures Also keep the features for ParsedCascade::Serialize
+    */
+    bool Parse(const cv::FileNode &root, bool keepFeatures);
+    //! \brief Takes the cascade from a cache entry written by ParsedCascade::Serialize
+    bool Deserialize(const uchar *bytes, qint64 size);
+    QByteArray Serialize() const;
+
+    //! \brief Gives each classifier a copy of the cascade and its own feature evaluator
+    bool AssignTo(const std::vector<cv::CascadeClassifier*> &classifiers) const;
+
+private:
+    bool ConvertOldFormat(const cv::FileNode &root);
+    //! \brief Appends the feature of an old format node to \a storage
+    bool WriteOldFeature(cv::FileStorage &storage, const cv::FileNode &feature);
+    //! \brief Returns the new format reference to a child of an old format node
+    int OldChild(const cv::FileNode &node, const char *value, const char *child, int &leafCount);
+
+    std::string m_features;     //!< Features as compact YAML, set when converted or kept
+    cv::FileNode m_featureNode; //!< Features of the file being parsed, valid while it is open
+};
+
+bool ParsedCascade::Parse(const cv::FileNode &root, bool keepFeatures)
+{
+    m_features.clear();
+    m_featureNode = cv::FileNode();
+
+    //Old format cascades have no stage type
+    if(root["stageType"].empty())
+        return ConvertOldFormat(root);
+
+    if(!data.read(root) || root["features"].empty())
+        return false;
+
+    m_featureNode = root["features"];
+    if(keepFeatures)
+    {
+        cv::FileStorage storage(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+        storage << "features";
+        WriteNode(storage, m_featureNode);
+        m_features = storage.releaseAndGetString();
+    }
+    return true;
+}
+
+bool ParsedCascade::ConvertOldFormat(const cv::FileNode &root)
+{
+    cv::FileNode size = root["size"];
+    cv::FileNode stages = root["stages"];
+    if(size.size() != 2 || stages.empty())
+        return false;
+
+    data.stageType = BOOST;
+    data.featureType = cv::FeatureEvaluator::HAAR;
+    data.ncategories = 0;
+    data.isStumpBased = true;
+    data.origWinSize = cv::Size((int)size[0], (int)size[1]);
+    data.stages.clear();
+    data.classifiers.clear();
+    data.nodes.clear();
+    data.leaves.clear();
+    data.subsets.clear();
+
+    cv::FileStorage features(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    features << "features" << "[";
+
+    int stageIndex = 0;
+    for(cv::FileNodeIterator stageItr = stages.begin(); stageItr != stages.end(); ++stageItr, stageIndex++)
+    {
+        const cv::FileNode &stageNode = *stageItr;
+        //Tree shaped cascades have no counterpart in the current format
+        if((!stageNode["parent"].empty() && (int)stageNode["parent"] != stageIndex - 1)
+                || (!stageNode["next"].empty() && (int)stageNode["next"] != -1))
+            return false;
+
+        cv::FileNode trees = stageNode["trees"];
+        Data::Stage stage;
+        stage.first = (int)data.classifiers.size();
+        stage.ntrees = (int)trees.size();
+        stage.threshold = (float)stageNode["stage_threshold"] - OldStageThresholdBias;
+        data.stages.push_back(stage);
+
+        for(cv::FileNodeIterator treeItr = trees.begin(); treeItr != trees.end(); ++treeItr)
+        {
+            const cv::FileNode &tree = *treeItr;
+            Data::DTree dtree;
+            dtree.nodeCount = (int)tree.size();
+            if(dtree.nodeCount < 1)
+                return false;
+            data.isStumpBased = data.isStumpBased && dtree.nodeCount == 1;
+
+            int leafCount = 0;
+            for(cv::FileNodeIterator nodeItr = tree.begin(); nodeItr != tree.end(); ++nodeItr)
+            {
+                const cv::FileNode &node = *nodeItr;
+                if(!WriteOldFeature(features, node["feature"]))
+                    return false;
+
+                Data::DTreeNode dnode;
+                dnode.featureIdx = (int)data.nodes.size();
+                dnode.threshold = (float)node["threshold"];
+                dnode.left = OldChild(node, "left_val", "left_node", leafCount);
+                dnode.right = OldChild(node, "right_val", "right_node", leafCount);
+                data.nodes.push_back(dnode);
+            }
+
+            //The evaluation expects nodeCount + 1 leaves per tree
+            if(leafCount != dtree.nodeCount + 1)
+                return false;
+            data.classifiers.push_back(dtree);
+        }
+    }
+
+    features << "]";
+    m_features = features.releaseAndGetString();
+    return true;
+}
+
+bool ParsedCascade::WriteOldFeature(cv::FileStorage &storage, const cv::FileNode &feature)
+{
+    cv::FileNode rects = feature["rects"];
+    int count = (int)rects.size();
+    if(count < 1 || count > 3)
+        return false;
+
+    int rect[3][4];
+    float weight[3];
+    double area0 = 0, sum0 = 0;
+    for(int k = 0; k < count; k++)
+    {
+        cv::FileNode values = rects[k];
+        if(values.size() != 5)
+            return false;
+        for(int i = 0; i < 4; i++)
+            rect[k][i] = (int)values[i];
+        weight[k] = (float)values[4];
+
+        if(k == 0)
+            area0 = rect[k][2]*rect[k][3];
+        else
+            sum0 += weight[k]*rect[k][2]*rect[k][3];
+    }
+    //The old format evaluation balances the first rectangle against the others
+    if(count > 1 && area0 > 0)
+        weight[0] = (float)(-sum0/area0);
+
+    storage << "{:" << "rects" << "[:";
+    for(int k = 0; k < count; k++)
+        storage << "[:" << rect[k][0] << rect[k][1] << rect[k][2] << rect[k][3] << weight[k] << "]";
+    storage << "]" << "tilted" << (int)feature["tilted"] << "}";
+    return true;
+}
+
+int ParsedCascade::OldChild(const cv::FileNode &node, const char *value, const char *child, int &leafCount)
+{
+    if(node[child].empty())
+    {
+        //Leaves are referenced by their negated index within the tree
+        data.leaves.push_back((float)node[value]);
+        return -(leafCount++);
+    }
+    return (int)node[child];
+}
+
+bool ParsedCascade::Deserialize(const uchar *bytes, qint64 size)
+{
+    if(size < (qint64)sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if(header.magic != CacheHeader::Magic || header.version != CacheHeader::Version
+            || header.stageSize != sizeof(Data::Stage) || header.treeSize != sizeof(Data::DTree)
+            || header.nodeSize != sizeof(Data::DTreeNode))
+        return false;
+
+    qint64 expected = (qint64)sizeof(header) + (qint64)header.stageCount*sizeof(Data::Stage)
+            + (qint64)header.treeCount*sizeof(Data::DTree) + (qint64)header.nodeCount*sizeof(Data::DTreeNode)
+            + (qint64)header.leafCount*sizeof(float) + (qint64)header.subsetCount*sizeof(int)
+            + header.featuresSize;
+    if(expected != size)
+        return false;
+
+    data.stageType = header.stageType;
+    data.featureType = header.featureType;
+    data.ncategories = header.categoryCount;
+    data.isStumpBased = header.stumpBased != 0;
+    data.origWinSize = cv::Size(header.width, header.height);
+
+    const uchar *next = bytes + sizeof(header);
+    next = ReadArray(next, header.stageCount, data.stages);
+    next = ReadArray(next, header.treeCount, data.classifiers);
+    next = ReadArray(next, header.nodeCount, data.nodes);
+    next = ReadArray(next, header.leafCount, data.leaves);
+    next = ReadArray(next, header.subsetCount, data.subsets);
+    m_features.assign((const char *)next, header.featuresSize);
+    m_featureNode = cv::FileNode();
+    return !data.stages.empty();
+}
+
+QByteArray ParsedCascade::Serialize() const
+{
+    CacheHeader header;
+    header.magic = CacheHeader::Magic;
+    header.version = CacheHeader::Version;
+    header.stageSize = sizeof(Data::Stage);
+    header.treeSize = sizeof(Data::DTree);
+    header.nodeSize = sizeof(Data::DTreeNode);
+    header.stageType = data.stageType;
+    header.featureType = data.featureType;
+    header.categoryCount = data.ncategories;
+    header.stumpBased = data.isStumpBased ? 1 : 0;
+    header.width = data.origWinSize.width;
+    header.height = data.origWinSize.height;
+    header.stageCount = data.stages.size();
+    header.treeCount = data.classifiers.size();
+    header.nodeCount = data.nodes.size();
+    header.leafCount = data.leaves.size();
+    header.subsetCount = data.subsets.size();
+    header.featuresSize = m_features.size();
+
+    QByteArray bytes((const char *)&header, sizeof(header));
+    AppendArray(bytes, data.stages);
+    AppendArray(bytes, data.classifiers);
+    AppendArray(bytes, data.nodes);
+    AppendArray(bytes, data.leaves);
+    AppendArray(bytes, data.subsets);
+    bytes.append(m_features.data(), m_features.size());
+    return bytes;
+}
+
+bool ParsedCascade::AssignTo(const std::vector<cv::CascadeClassifier*> &classifiers) const
+{
+    //Converted and cached features are only available as text
+    cv::FileStorage storage;
+    cv::FileNode features = m_featureNode;
+    if(features.empty())
+    {
+        if(m_features.empty() || !storage.open(m_features, cv::FileStorage::READ | cv::FileStorage::MEMORY))
+            return false;
+        features = storage["features"];
+    }
+
+    for(size_t i = 0; i < classifiers.size(); i++)
+    {
+        //Evaluators keep pointers into the image they search, every classifier
+        //needs its own and they cannot share a clone
+        cv::Ptr<cv::FeatureEvaluator> evaluator = cv::FeatureEvaluator::create(data.featureType);
+        if(evaluator.empty() || !evaluator->read(features))
+            return false;
+
+        cv::CascadeClassifier &classifier = *classifiers[i];
+        classifier.*(&ParsedCascade::data) = data;
+        classifier.*(&ParsedCascade::featureEvaluator) = evaluator;
+        (classifier.*(&ParsedCascade::oldCascade)).release();
+    }
+    return true;
+}
+
+bool LoadOneByOne(const std::string &path, const std::vector<cv::CascadeClassifier*> &classifiers)
+{
+    for(size_t i = 0; i < classifiers.size(); i++)
+    {
+        try
+        {
+            classifiers[i]->load(path);
+        }
+        catch (...) { }
+
+        if(classifiers[i]->empty())
+            return false;
+    }
+    return true;
+}
+
+//! Removes the entries of \a baseName other than \a keep
+void RemoveStaleEntries(const QDir &directory, const QString &baseName, const QString &keep)
+{
+    foreach(const QString &entry, directory.entryList(QStringList(baseName + "-*"), QDir::Files))
+    {
+        if(entry != keep)
+            QFile::remove(directory.filePath(entry));
+    }
+}
+}
+
+std::string CascadeCache::Resolve(const std::string &filename)
+{
+    QString name(filename.c_str());
+    QResource info(name);
+    if(!info.isValid())
+        return filename;
+
+    //Resources only change with the binary, its modification time stands in for a build id
+    qint64 build = QFileInfo(QCoreApplication::applicationFilePath()).lastModified().toTime_t();
+    QString baseName = QFileInfo(name).completeBaseName();
+    QString entry = QString("%1-%2-%3.cascade").arg(baseName).arg(info.size()).arg(build, 0, 16);
+    QDir directory(Directory());
+    QString cached = directory.filePath(entry);
+    if(QFileInfo(cached).exists())
+        return cached.toStdString();
+
+    QFile resource(name);
+    if(!resource.open(QIODevice::ReadOnly) || !directory.mkpath("."))
+        return std::string();
+    QByteArray contents = resource.readAll();
+
+    ParsedCascade cascade;
+    QByteArray serialized;
+    try
+    {
+        cv::FileStorage storage(std::string(contents.constData(), contents.size()),
+                                cv::FileStorage::READ | cv::FileStorage::MEMORY);
+        if(cascade.Parse(storage.getFirstTopLevelNode(), true))
+            serialized = cascade.Serialize();
+    }
+    catch (...) { }
+    if(serialized.isEmpty())
+        return std::string();
+
+    //Written under a temporary name first, a crash never leaves a truncated entry behind
+    QFile file(cached + ".part");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return std::string();
+
+    bool written = file.write(serialized) == serialized.size();
+    file.close();
+    if(!written || !file.rename(cached))
+    {
+        file.remove();
+        return QFileInfo(cached).exists() ? cached.toStdString() : std::string();
+    }
+
+    //Entries of previous builds are never used again
+    RemoveStaleEntries(directory, baseName, entry);
+    return cached.toStdString();
+}
+
+bool CascadeCache::Load(const std::string &path, const std::vector<cv::CascadeClassifier*> &classifiers)
+{
+    if(classifiers.empty())
+        return true;
+
+    QFile file(QString(path.c_str()));
+    if(file.open(QIODevice::ReadOnly) && file.size() > 0)
+    {
+        uchar *bytes = file.map(0, file.size());
+        if(bytes)
+        {
+            ParsedCascade cascade;
+            bool cached = cascade.Deserialize(bytes, file.size());
+            file.unmap(bytes);
+            if(cached)
+                return cascade.AssignTo(classifiers);
+        }
+    }
+
+    //Classifier files outside the cache are parsed once for all classifiers
+    bool loaded = false;
+    try
+    {
+        cv::FileStorage storage(path, cv::FileStorage::READ);
+        ParsedCascade cascade;
+        loaded = storage.isOpened() && cascade.Parse(storage.getFirstTopLevelNode(), false)
+                && cascade.AssignTo(classifiers);
+    }
+    catch (...) { }
+
+    //Tree shaped old format cascades are left to OpenCV
+    if(!loaded)
+        return LoadOneByOne(path, classifiers);
+    return true;
+}
+
+QString CascadeCache::Directory()
+{
+#if QT_VERSION >= 0x050000
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+    QString directory = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+#endif
+    return QDir(directory).filePath("cascades");
+}
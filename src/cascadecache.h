@@ -0,0 +1,52 @@
+/*! \file cascadecache.h
+    \brief Defines the on disk cache of the bundled cascade classifiers
+
+    Classifiers bundled as Qt resources used to be extracted to a temporary
+    file and parsed as XML on every start. They are now parsed once and the
+    parsed cascade is kept in a binary file in the user cache directory,
+    which later starts memory map and copy straight into the classifiers.
+    \sa CascadeCache::Resolve, CascadeCache::Load
+*/
+
+#ifndef CASCADECACHE_H
+#define CASCADECACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <string>
+#include <vector>
+
+namespace CascadeCache
+{
+
+/*! \brief Returns a path on disk the classifier \a filename can be loaded from
+
+  Qt resources are looked up in the cache by their name, size and the
+  modification time of the application binary, so a rebuilt binary never
+  picks up a stale cache entry and a hit never reads the resource. On a miss
+  the resource is parsed, old format Haar cascades are converted to the
+  current format, and the result is written to the cache in binary form.
+  Entries of earlier builds are removed then.
+  \param filename Path of the classifier xml file, may be a Qt resource path
+  \returns \a filename itself if it is not a resource, an empty string if the
+           cache directory is not writable or the cascade cannot be cached
+*/
+std::string Resolve(const std::string &filename);
+
+/*! \brief Loads every classifier in \a classifiers from \a path
+
+  \a path is either a cache entry (see CascadeCache::Resolve), which is
+  memory mapped and needs no parsing apart from the feature rectangles, or a
+  classifier xml file, which is parsed once for all classifiers. Old format
+  Haar cascades are converted to the current format either way, only tree
+  shaped ones are left to cv::CascadeClassifier::load, one classifier at a time.
+  \returns true if every classifier loaded
+*/
+bool Load(const std::string &path, const std::vector<cv::CascadeClassifier*> &classifiers);
+
+//! \brief Directory the cache is kept in
+QString Directory();
+
+}
+
+#endif // CASCADECACHE_H
@@ -0,0 +1,83 @@
+#include "detectionscheduler.h"
+
+namespace
+{
+//! From most accurate to cheapest, each step costs roughly a third less than the one before
+const DetectionLevel Levels[] =
+{
+    { 1.0f,   1.1f, 0.5f,  5 },
+    { 1.0f,   1.2f, 0.5f,  10 },
+    { 0.75f,  1.2f, 0.4f,  10 },
+    { 0.5f,   1.2f, 0.4f,  15 },
+    { 0.5f,   1.3f, 0.3f,  20 },
+    { 0.375f, 1.3f, 0.3f,  30 },
+    { 0.25f,  1.4f, 0.25f, 30 }
+};
+
+const int LevelCount = sizeof(Levels)/sizeof(Levels[0]);
+}
+
+DetectionScheduler::DetectionScheduler() :
+    m_level(0), m_targetFrameTime(DEFAULT_TARGET_FRAME_TIME), m_total(0), m_samples(0)
+{
+}
+
+void DetectionScheduler::Reset()
+{
+    SetLevel(0);
+}
+
+bool DetectionScheduler::AddSample(qint64 microseconds)
+{
+    m_total += microseconds;
+    if(++m_samples < DEFAULT_SCHEDULER_WINDOW)
+        return false;
+
+    float mean = (float)m_total/m_samples/1000.0f;
+    m_total = 0;
+    m_samples = 0;
+
+    if(mean > m_targetFrameTime && m_level + 1 < LevelCount)
+    {
+        SetLevel(m_level + 1);
+        return true;
+    }
+    if(mean < m_targetFrameTime*DEFAULT_SCHEDULER_HEADROOM && m_level > 0)
+    {
+        SetLevel(m_level - 1);
+        return true;
+    }
+    return false;
+}
+
+const DetectionLevel &DetectionScheduler::GetLevel() const
+{
+    return Levels[m_level];
+}
+
+int DetectionScheduler::GetLevelIndex() const
+{
+    return m_level;
+}
+
+int DetectionScheduler::GetLevelCount()
+{
+    return LevelCount;
+}
+
+float DetectionScheduler::GetTargetFrameTime() const
+{
+    return m_targetFrameTime;
+}
+
+void DetectionScheduler::SetTargetFrameTime(float milliseconds)
+{
+    m_targetFrameTime = milliseconds;
+}
+
+void DetectionScheduler::SetLevel(int level)
+{
+    m_level = level;
+    m_total = 0;
+    m_samples = 0;
+}
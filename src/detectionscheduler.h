@@ -0,0 +1,78 @@
+/*! \file detectionscheduler.h
+    \brief Defines the controller that fits face detection into a frame time budget
+
+    \sa DetectionScheduler, FaceTracker::SetAdaptiveScheduling
+*/
+
+#ifndef DETECTIONSCHEDULER_H
+#define DETECTIONSCHEDULER_H
+
+#include <QtGlobal>
+
+//! \brief Default target time (ms) to process one frame
+#define DEFAULT_TARGET_FRAME_TIME       33.0f
+//! \brief Default number of frames measured before the detection level is reconsidered
+#define DEFAULT_SCHEDULER_WINDOW        10
+//! \brief Default fraction of the budget below which a more accurate level is tried
+#define DEFAULT_SCHEDULER_HEADROOM      0.5f
+
+/*! \brief Tuning parameters of one point on the accuracy / speed trade-off
+  \sa DetectionScheduler
+*/
+struct DetectionLevel
+{
+    float resolution;       //!< Processing resolution as a fraction of FaceTracker::SetProcessingImageDimensions
+    float scaleFactor;      //!< Search scale factor, see FaceTracker::SetSearchScaleFactor
+    float roiPadding;       //!< Padding around the last face, see FaceTracker::SetROIPadding
+    int fullScanInterval;   //!< Region of interest searches between full scans, see FaceTracker::SetFullScanInterval
+};
+
+/*! \brief Picks the most accurate detection level that keeps up with the frame time budget.
+
+  The levels form a fixed ladder from most accurate (level 0) to cheapest.
+  The time spent on every frame is fed to DetectionScheduler::AddSample. Every
+  DEFAULT_SCHEDULER_WINDOW frames the mean is compared to the budget: the
+  scheduler steps to a cheaper level when it is over budget and to a more
+  accurate one when it used less than DEFAULT_SCHEDULER_HEADROOM of it. The
+  gap between the two thresholds keeps it from oscillating between levels.
+
+  Measurements restart after every change so decisions are only based on
+  frames processed at the current level.
+*/
+class DetectionScheduler
+{
+public:
+    DetectionScheduler();
+
+    //! \brief Returns to the most accurate level and forgets all measurements
+    void Reset();
+
+    /*! \brief Adds the time spent on one frame
+      \param microseconds Preprocessing and detection time of the frame
+      \returns true if the level changed
+    */
+    bool AddSample(qint64 microseconds);
+
+    //! \brief Returns the parameters of the current level
+    const DetectionLevel &GetLevel() const;
+    //! \brief Returns the index of the current level, 0 being the most accurate
+    int GetLevelIndex() const;
+    //! \brief Returns the number of levels
+    static int GetLevelCount();
+
+    //! \brief Getter for the target time (ms) to process one frame
+    float GetTargetFrameTime() const;
+    //! \brief Setter for the target time (ms) to process one frame
+    void SetTargetFrameTime(float milliseconds);
+
+private:
+    //! \brief Moves to \a level and restarts the measurements
+    void SetLevel(int level);
+
+    int m_level;
+    float m_targetFrameTime;
+    qint64 m_total;     //!< Sum of the samples (us) since the last decision
+    int m_samples;      //!< Number of samples since the last decision
+};
+
+#endif // DETECTIONSCHEDULER_H
@@ -421,12 +421,12 @@ void FaceInvadersWidget::initScreen()
     emit faceImageUpdatesRequest();
 }
 
-void FaceInvadersWidget::updatePlayerImage(QImageSharedPointer image)
+void FaceInvadersWidget::updatePlayerImage(VideoFrame image)
 {
-    if(image.data() == NULL)
+    if(image.IsNull())
         return;
 
-    m_scene->setPlayerImage(QPixmap::fromImage(*image));
+    m_scene->setPlayerImage(QPixmap::fromImage(image.GetImage()));
 
     this->viewport()->update();
 }
@@ -26,12 +26,8 @@
 #include <QGraphicsSimpleTextItem>
 #include <QPoint>
 #include <QPixmap>
-#include <QSharedPointer>
 #include <QTimer>
-
-
-typedef QSharedPointer<QImage> QImageSharedPointer;
-Q_DECLARE_METATYPE(QImageSharedPointer);
+#include "videoframe.h"
 
 //Forward declaration
 class PlayerItem;
@@ -259,7 +255,7 @@ public slots:
     void initScreen();
 
     //! \brief Sets the player image
-    void updatePlayerImage(QImageSharedPointer image);
+    void updatePlayerImage(VideoFrame image);
 
 protected:
     //! \brief Used to maintain aspect ratio, \seeqtdoc
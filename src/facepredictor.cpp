@@ -0,0 +1,107 @@
+#include "facepredictor.h"
+
+namespace
+{
+const int StateSize = 8;
+const int MeasurementSize = 4;
+}
+
+FacePredictor::FacePredictor() :
+    m_filter(StateSize, MeasurementSize, 0, CV_32F), m_valid(false), m_lastTimestamp(0)
+{
+    //Measurements observe the first half of the state directly
+    m_filter.measurementMatrix = cv::Mat::zeros(MeasurementSize, StateSize, CV_32F);
+    for(int i = 0; i < MeasurementSize; i++)
+        m_filter.measurementMatrix.at<float>(i, i) = 1.0f;
+
+    m_filter.measurementNoiseCov = cv::Mat::zeros(MeasurementSize, MeasurementSize, CV_32F);
+    m_filter.measurementNoiseCov.at<float>(0, 0) = DEFAULT_PREDICTION_POSITION_NOISE*DEFAULT_PREDICTION_POSITION_NOISE;
+    m_filter.measurementNoiseCov.at<float>(1, 1) = DEFAULT_PREDICTION_POSITION_NOISE*DEFAULT_PREDICTION_POSITION_NOISE;
+    m_filter.measurementNoiseCov.at<float>(2, 2) = DEFAULT_PREDICTION_SIZE_NOISE*DEFAULT_PREDICTION_SIZE_NOISE;
+    m_filter.measurementNoiseCov.at<float>(3, 3) = DEFAULT_PREDICTION_SIZE_NOISE*DEFAULT_PREDICTION_SIZE_NOISE;
+}
+
+void FacePredictor::Reset()
+{
+    m_valid = false;
+}
+
+void FacePredictor::Update(const QRect &rect, qint64 timestamp)
+{
+    if(!rect.isValid())
+        return;
+
+    cv::Mat measurement = (cv::Mat_<float>(MeasurementSize, 1) <<
+                           rect.x() + rect.width()*0.5f, rect.y() + rect.height()*0.5f,
+                           (float)rect.width(), (float)rect.height());
+
+    if(!m_valid || timestamp - m_lastTimestamp > DEFAULT_PREDICTION_RESET_GAP)
+    {
+        //Start at rest, with the velocity entirely uncertain
+        m_filter.statePost = cv::Mat::zeros(StateSize, 1, CV_32F);
+        measurement.copyTo(m_filter.statePost.rowRange(0, MeasurementSize));
+        m_filter.errorCovPost = cv::Mat::zeros(StateSize, StateSize, CV_32F);
+        for(int i = 0; i < MeasurementSize; i++)
+        {
+            m_filter.errorCovPost.at<float>(i, i) = m_filter.measurementNoiseCov.at<float>(i, i);
+            m_filter.errorCovPost.at<float>(i + MeasurementSize, i + MeasurementSize) = 1.0f;
+        }
+
+        m_valid = true;
+        m_lastTimestamp = timestamp;
+        return;
+    }
+
+    if(timestamp <= m_lastTimestamp)
+        return;
+
+    SetTimeStep((float)(timestamp - m_lastTimestamp));
+    m_filter.predict();
+    m_filter.correct(measurement);
+    m_lastTimestamp = timestamp;
+}
+
+QRect FacePredictor::Predict(qint64 timestamp) const
+{
+    if(!m_valid || timestamp - m_lastTimestamp > DEFAULT_PREDICTION_RESET_GAP)
+        return QRect(1, 1, 0, 0);
+
+    //Never extrapolate into the past or too far into the future
+    float dt = (float)qBound((qint64)0, timestamp - m_lastTimestamp, (qint64)DEFAULT_PREDICTION_HORIZON);
+    const cv::Mat &state = m_filter.statePost;
+    float centerX = state.at<float>(0) + dt*state.at<float>(4);
+    float centerY = state.at<float>(1) + dt*state.at<float>(5);
+    float width = std::max(1.0f, state.at<float>(2) + dt*state.at<float>(6));
+    float height = std::max(1.0f, state.at<float>(3) + dt*state.at<float>(7));
+
+    return QRect(cvRound(centerX - width/2), cvRound(centerY - height/2), cvRound(width), cvRound(height));
+}
+
+bool FacePredictor::IsValid() const
+{
+    return m_valid;
+}
+
+qint64 FacePredictor::GetLastTimestamp() const
+{
+    return m_lastTimestamp;
+}
+
+void FacePredictor::SetTimeStep(float dt)
+{
+    m_filter.transitionMatrix = cv::Mat::eye(StateSize, StateSize, CV_32F);
+    for(int i = 0; i < MeasurementSize; i++)
+        m_filter.transitionMatrix.at<float>(i, i + MeasurementSize) = dt;
+
+    //Piecewise white noise acceleration model
+    const float q = DEFAULT_PREDICTION_ACCELERATION;
+    m_filter.processNoiseCov = cv::Mat::zeros(StateSize, StateSize, CV_32F);
+    for(int i = 0; i < MeasurementSize; i++)
+    {
+        int v = i + MeasurementSize;
+        m_filter.processNoiseCov.at<float>(i, i) = q*dt*dt*dt/3;
+        m_filter.processNoiseCov.at<float>(i, v) = q*dt*dt/2;
+        m_filter.processNoiseCov.at<float>(v, i) = q*dt*dt/2;
+        m_filter.processNoiseCov.at<float>(v, v) = q*dt;
+    }
+}
@@ -0,0 +1,68 @@
+/*! \file facepredictor.h
+    \brief Defines the Kalman filter that predicts where the tracked face is heading
+
+    \sa FacePredictor, FaceTracker::GetPredictedPosition
+*/
+
+#ifndef FACEPREDICTOR_H
+#define FACEPREDICTOR_H
+
+#include <opencv2/opencv.hpp>
+#include <QRect>
+
+//! \brief Default standard deviation (px) of the measured face center
+#define DEFAULT_PREDICTION_POSITION_NOISE   3.0f
+//! \brief Default standard deviation (px) of the measured face size
+#define DEFAULT_PREDICTION_SIZE_NOISE       6.0f
+//! \brief Default spectral density (px^2/ms^3) of the random acceleration of the face
+#define DEFAULT_PREDICTION_ACCELERATION     0.001f
+//! \brief Default furthest (ms) a position is extrapolated past the last measurement
+#define DEFAULT_PREDICTION_HORIZON          250
+//! \brief Default gap (ms) between measurements after which the filter starts over
+#define DEFAULT_PREDICTION_RESET_GAP        500
+
+/*! \brief Constant velocity Kalman filter on the center and size of a face.
+
+  The state holds the center, width and height of the face and their rates of
+  change per millisecond. Measurements may arrive at irregular intervals, the
+  filter is propagated by the actual time between them. Predictions for any
+  timestamp are computed from the filtered state without modifying it, so
+  every consumer can ask for the latency it needs to compensate.
+
+  All timestamps are in milliseconds on the clock of FrameGrabber::Timestamp.
+*/
+class FacePredictor
+{
+public:
+    FacePredictor();
+
+    //! \brief Forgets the current face, the next measurement starts a new one
+    void Reset();
+
+    /*! \brief Feeds the position of the face measured in the frame taken at \a timestamp
+      Measurements older than the last one are ignored.
+    */
+    void Update(const QRect &rect, qint64 timestamp);
+
+    /*! \brief Returns where the face is expected to be at \a timestamp
+      Extrapolation stops DEFAULT_PREDICTION_HORIZON ms after the last measurement.
+      \returns An invalid rectangle if there is no recent measurement
+    */
+    QRect Predict(qint64 timestamp) const;
+
+    //! \brief Returns true if the filter holds a face
+    bool IsValid() const;
+
+    //! \brief Returns the timestamp of the last measurement
+    qint64 GetLastTimestamp() const;
+
+private:
+    //! \brief Sets the transition and process noise matrices for a step of \a dt ms
+    void SetTimeStep(float dt);
+
+    cv::KalmanFilter m_filter;  //!< State (cx, cy, w, h, vcx, vcy, vw, vh), measurement (cx, cy, w, h)
+    bool m_valid;
+    qint64 m_lastTimestamp;
+};
+
+#endif // FACEPREDICTOR_H
@@ -1,4 +1,7 @@
 #include "facetracker.h"
+#include "frameprocessing.h"
+#include "cascadecache.h"
+#include "metrics.h"
 #include <stdexcept>
 #include <sstream>
 #include <limits>
@@ -6,71 +9,126 @@
 #include <QFile>
 #include <QTemporaryFile>
 #include <QDebug>
-#include <QResource>
 #include <QElapsedTimer>
 
 const QRect FaceTracker::InvalidQRect(1,1,0,0);
 
 FaceTracker::FaceTracker()
 {
-    Init(0);
+    Init();
+    OpenDevice(0);
 }
 
 FaceTracker::FaceTracker(int deviceID)
 {
-    Init(deviceID);
+    Init();
+    OpenDevice(deviceID);
+}
+
+FaceTracker::FaceTracker(const std::string &uri)
+{
+    Init();
+
+    if(!m_grabber.Open(uri))
+    {
+        std::ostringstream error;
+        error << "Unable to open frame source: " << uri;
+        throw std::invalid_argument(error.str());
+    }
+
+    m_grabber.start();
+}
+
+FaceTracker::FaceTracker(FrameSource *source)
+{
+    Init();
+
+    if(!m_grabber.Open(source))
+        throw std::invalid_argument("Unable to open frame source.");
+
+    m_grabber.start();
+}
+
+FaceTracker::~FaceTracker()
+{
+    m_grabber.Stop();
+    delete m_classifierFile;
 }
 
 void FaceTracker::ResetTracker()
 {
     //Sets invalid, empty, and null flags for the QRect
     m_lastPosition.setCoords(1,1,0,0);
+    m_faceTemplate.release();
+    m_targetTrackId = -1;
+    m_predictor.Reset();
+    m_motionReference.release();
 }
 
 QRect FaceTracker::GetFacePosition(bool normalized)
 {
-#ifdef DEBUG_FACETRACKING_TIMING
-    QElapsedTimer timer;
-    timer.start();
-#endif
     cv::Mat cameraFrame;
     GetProcessReadyWebcamImage(cameraFrame);
     if(cameraFrame.empty())
         return InvalidQRect;
 
-    std::vector<cv::Rect> faceRects;
-    m_faceDetector.detectMultiScale(cameraFrame, faceRects,
-                                  m_searchScaleFactor, m_minNeighbors,
-                                  cv::CASCADE_SCALE_IMAGE | m_additionalFlags,
-                                    m_minFeatureSize);
+    QElapsedTimer timer;
+    timer.start();
 
-    //No Faces detected
-    if(faceRects.size() == 0)
-        return InvalidQRect;
+    //Nothing moved since the last searched frame, the last result still holds
+    m_lastFrameSkipped = SkipUnchangedFrame(cameraFrame);
+    if(m_lastFrameSkipped)
+    {
+        m_predictor.Update(m_lastPosition, m_frameTimestamp);
+        Metrics::RecordElapsed(Metrics::DetectTime, timer);
+        return GetLastPosition(normalized);
+    }
 
-    //Select new face to track
-    if(!m_lastPosition.isValid())
+    //Cheap inter-frame tracking while the cascade is not due
+    if(TrackBetweenDetections(cameraFrame))
     {
-        m_lastPosition = SelectFace2Track(faceRects);
-        return m_lastPosition;
+        m_tracks.Correct(m_targetTrackId, m_lastPosition);
+        m_predictor.Update(m_lastPosition, m_frameTimestamp);
+        FinishFrame(timer);
+        return GetLastPosition(normalized);
     }
 
-    //Find face closest to where the tracked face was last time
-    m_lastPosition = findClosest(faceRects,m_lastPosition.center());
+    std::vector<cv::Rect> faceRects;
+    cv::Rect searchArea;
+    if(!DetectAroundLastPosition(cameraFrame, faceRects, searchArea))
+    {
+        RunCascade(cameraFrame, faceRects, m_minFeatureSize);
+        searchArea = cv::Rect(0, 0, cameraFrame.cols, cameraFrame.rows);
+        m_framesSinceFullScan = 0;
+    }
+    m_tracks.Update(faceRects, searchArea);
 
-#ifdef DEBUG_FACETRACKING_TIMING
-    qDebug() << "Face Detection took: " << timer.elapsed() << " ms";
-#endif
+    //Only pick a new face once the tracked one is gone for good
+    const FaceTrack *target = m_tracks.Find(m_targetTrackId);
+    if(!target)
+    {
+        m_targetTrackId = m_tracks.FindClosest(QPoint(m_imageWidth/2, m_imageHeight/2));
+        target = m_tracks.Find(m_targetTrackId);
+        //The motion of the old face says nothing about the new one
+        m_predictor.Reset();
+    }
 
-    if(normalized)
+    //Tracked face not detected in this frame, report no face rather than jump to another one
+    if(!target || target->missed > 0)
     {
-        return QRect(100*m_lastPosition.x()/m_imageWidth,
-                     100*m_lastPosition.y()/m_imageHeight,
-                     100*m_lastPosition.width()/m_imageWidth,
-                     100*m_lastPosition.height()/m_imageHeight);
+        m_lastPosition = InvalidQRect;
+        m_faceTemplate.release();
+        FinishFrame(timer);
+        return InvalidQRect;
     }
 
-    return m_lastPosition;
+    m_lastPosition = target->rect;
+    UpdateFaceTemplate(cameraFrame);
+    m_predictor.Update(m_lastPosition, m_frameTimestamp);
+
+    FinishFrame(timer);
+
+    return GetLastPosition(normalized);
 }
 
 QList<QRect> FaceTracker::GetAllFacesPositions(bool normalized)
@@ -81,28 +139,50 @@ QList<QRect> FaceTracker::GetAllFacesPositions(bool normalized)
         return QList<QRect>();
 
     std::vector<cv::Rect> faceRects;
-    m_faceDetector.detectMultiScale(cameraFrame, faceRects,
-                                  m_searchScaleFactor, m_minNeighbors,
-                                  cv::CASCADE_SCALE_IMAGE | m_additionalFlags);
+    RunCascade(cameraFrame, faceRects, m_minFeatureSize);
+    m_tracks.Update(faceRects, cv::Rect(0, 0, cameraFrame.cols, cameraFrame.rows));
     QList<QRect> qFaceRects;
 
-    if(normalized)
-    {
-        for(std::vector<cv::Rect>::const_iterator itr = faceRects.begin();
-            itr != faceRects.end(); ++itr)
-            qFaceRects.append(QRect(itr->x, itr->y, itr->width, itr->height));
-    }
-    else
+    for(std::vector<cv::Rect>::const_iterator itr = faceRects.begin();
+        itr != faceRects.end(); ++itr)
+        qFaceRects.append(ToOutputRect(QRect(itr->x, itr->y, itr->width, itr->height), normalized));
+
+    return qFaceRects;
+}
+
+QList<FaceTrack> FaceTracker::GetTracks(bool normalized)
+{
+    QList<FaceTrack> tracks;
+    const QList<FaceTrack> &table = m_tracks.GetTracks();
+    for(int i = 0; i < table.size(); i++)
     {
-        for(std::vector<cv::Rect>::const_iterator itr = faceRects.begin();
-            itr != faceRects.end(); ++itr)
-            qFaceRects.append(QRect(100*(itr->x)/m_imageWidth,
-                                    100*(itr->y)/m_imageHeight,
-                                    100*(itr->width)/m_imageWidth,
-                                    100*(itr->height)/m_imageHeight));
+        if(!m_tracks.IsConfirmed(table[i]))
+            continue;
+
+        FaceTrack track = table[i];
+        QRect start = ToOutputRect(track.rect, normalized);
+        QRect end = ToOutputRect(track.rect.translated(qRound(track.velocity.x()), qRound(track.velocity.y())),
+                                 normalized);
+        track.rect = start;
+        track.velocity = QPointF(end.topLeft() - start.topLeft());
+        tracks.append(track);
     }
+    return tracks;
+}
 
-    return qFaceRects;
+QRect FaceTracker::GetPredictedPosition(qint64 timestamp, bool normalized)
+{
+    return ToOutputRect(m_predictor.Predict(timestamp), normalized);
+}
+
+qint64 FaceTracker::GetLastFrameTimestamp()
+{
+    return m_frameTimestamp;
+}
+
+int FaceTracker::GetTargetTrackId()
+{
+    return m_targetTrackId;
 }
 
 QRect FaceTracker::GetBestFacePosition(bool normalized)
@@ -113,24 +193,26 @@ QRect FaceTracker::GetBestFacePosition(bool normalized)
         return InvalidQRect;
 
     std::vector<cv::Rect> faceRects;
-    m_faceDetector.detectMultiScale(cameraFrame, faceRects,
-                                  m_searchScaleFactor, m_minNeighbors,
-                                  cv::CASCADE_FIND_BIGGEST_OBJECT | cv::CASCADE_DO_ROUGH_SEARCH | m_additionalFlags);
+    RunCascade(cameraFrame, faceRects, m_minFeatureSize);
 
     //No Faces detected
     if(faceRects.size() == 0)
         return InvalidQRect;
 
-    if(normalized)
-        m_lastPosition.setRect(faceRects[0].x, faceRects[0].y,
-                               faceRects[0].width, faceRects[0].height);
-    else
-        m_lastPosition.setRect(100*faceRects[0].x/m_imageWidth,
-                               100*faceRects[0].y/m_imageHeight,
-                               100*faceRects[0].width/m_imageWidth,
-                               100*faceRects[0].height/m_imageHeight);
+    //CASCADE_FIND_BIGGEST_OBJECT only applies to old format cascades, pick
+    //the biggest face here so both cascade formats and the parallel
+    //detector behave the same
+    size_t biggest = 0;
+    for(size_t i = 1; i < faceRects.size(); i++)
+    {
+        if(faceRects[i].area() > faceRects[biggest].area())
+            biggest = i;
+    }
 
-    return m_lastPosition;
+    m_lastPosition.setRect(faceRects[biggest].x, faceRects[biggest].y,
+                           faceRects[biggest].width, faceRects[biggest].height);
+
+    return GetLastPosition(normalized);
 }
 
 QRect FaceTracker::SelectFace2Track(std::vector<cv::Rect> faceRects)
@@ -157,6 +239,24 @@ float FaceTracker::GetSearchScaleFactor()
 void FaceTracker::SetSearchScaleFactor(float searchScaleFactor)
 {
     m_searchScaleFactor = searchScaleFactor;
+    m_manualLevel.scaleFactor = searchScaleFactor;
+}
+
+int FaceTracker::GetDetectionThreadCount()
+{
+    return m_detectionThreads;
+}
+
+void FaceTracker::SetDetectionThreadCount(int threads)
+{
+    m_detectionThreads = (threads < 1) ? 1 : threads;
+
+    if(m_detectionThreads == 1)
+        m_parallelDetector.Unload();
+    //Old format cascades stay on the serial path
+    else if(!m_parallelDetector.Load(m_classifierPath, m_detectionThreads)
+            && !m_faceDetector.isOldFormatCascade())
+        throw std::runtime_error("Unable to load classifier xml file.");
 }
 
 int FaceTracker::GetMinNeighbors()
@@ -169,13 +269,145 @@ void FaceTracker::SetMinNeighbors(int minNeighbors)
     m_minNeighbors = minNeighbors;
 }
 
+void FaceTracker::SetRegionOfInterestTracking(bool enable)
+{
+    m_roiTracking = enable;
+    m_framesSinceFullScan = 0;
+}
+
+bool FaceTracker::IsRegionOfInterestTrackingEnabled()
+{
+    return m_roiTracking;
+}
+
+float FaceTracker::GetROIPadding()
+{
+    return m_roiPadding;
+}
+
+void FaceTracker::SetROIPadding(float padding)
+{
+    m_roiPadding = padding;
+    m_manualLevel.roiPadding = padding;
+}
+
+int FaceTracker::GetFullScanInterval()
+{
+    return m_fullScanInterval;
+}
+
+void FaceTracker::SetFullScanInterval(int frames)
+{
+    m_fullScanInterval = frames;
+    m_manualLevel.fullScanInterval = frames;
+}
+
+void FaceTracker::SetDetectionInterval(int frames)
+{
+    m_detectionInterval = frames;
+}
+
+int FaceTracker::GetDetectionInterval()
+{
+    return m_detectionInterval;
+}
+
+void FaceTracker::SetTrackingConfidence(float confidence)
+{
+    m_trackingConfidence = confidence;
+}
+
+float FaceTracker::GetTrackingConfidence()
+{
+    return m_trackingConfidence;
+}
+
+void FaceTracker::SetMotionGating(bool enable)
+{
+    m_motionGating = enable;
+    m_framesSkipped = 0;
+    m_motionReference.release();
+}
+
+bool FaceTracker::IsMotionGatingEnabled()
+{
+    return m_motionGating;
+}
+
+float FaceTracker::GetMotionThreshold()
+{
+    return m_motionThreshold;
+}
+
+void FaceTracker::SetMotionThreshold(float threshold)
+{
+    m_motionThreshold = threshold;
+}
+
+int FaceTracker::GetMaxSkippedFrames()
+{
+    return m_motionMaxSkipped;
+}
+
+void FaceTracker::SetMaxSkippedFrames(int frames)
+{
+    m_motionMaxSkipped = frames;
+}
+
+bool FaceTracker::WasLastFrameSkipped()
+{
+    return m_lastFrameSkipped;
+}
+
+void FaceTracker::SetAdaptiveScheduling(bool enable)
+{
+    m_adaptiveScheduling = enable;
+    m_scheduler.Reset();
+    ApplyDetectionLevel(enable ? m_scheduler.GetLevel() : m_manualLevel);
+}
+
+bool FaceTracker::IsAdaptiveSchedulingEnabled()
+{
+    return m_adaptiveScheduling;
+}
+
+float FaceTracker::GetTargetFrameTime()
+{
+    return m_scheduler.GetTargetFrameTime();
+}
+
+void FaceTracker::SetTargetFrameTime(float milliseconds)
+{
+    m_scheduler.SetTargetFrameTime(milliseconds);
+}
+
+int FaceTracker::GetDetectionLevel()
+{
+    return m_adaptiveScheduling ? m_scheduler.GetLevelIndex() : -1;
+}
+
 void FaceTracker::SetProcessingImageDimensions(int width, int height)
 {
+    m_processingLimit = cv::Size(width, height);
     m_imageWidth = width;
     m_imageHeight = height;
+    if(m_adaptiveScheduling)
+        ApplyDetectionLevel(m_scheduler.GetLevel());
+
+    //Afterwards only processed frames change it, so the tracking state can follow
+    if(m_detectionSize.area() == 0)
+        m_detectionSize = m_processingLimit;
+}
 
-    m_vc.set(CV_CAP_PROP_FRAME_WIDTH, m_imageWidth);
-    m_vc.set(CV_CAP_PROP_FRAME_HEIGHT, m_imageHeight);
+void FaceTracker::SetCaptureDimensions(int width, int height)
+{
+    m_frameSize = cv::Size(width, height);
+    m_grabber.SetFrameDimensions(width, height);
+}
+
+void FaceTracker::SetSharedMemoryName(const std::string &name)
+{
+    m_grabber.SetSharedMemoryName(name);
 }
 
 unsigned int FaceTracker::GetAdditionalFlags()
@@ -198,81 +430,358 @@ void FaceTracker::SetAdditionalFlags(unsigned int flags)
     m_additionalFlags = flags;
 }
 
+void FaceTracker::SetMirroredOutput(bool mirror)
+{
+    m_mirroredOutput = mirror;
+}
+
+bool FaceTracker::IsMirroredOutputEnabled()
+{
+    return m_mirroredOutput;
+}
+
+VideoFrame FaceTracker::GetLastFrame()
+{
+    if(m_cameraFrame.empty())
+        return VideoFrame();
+
+    //Convert once per processed frame, the camera frame itself is never modified
+    if(m_exportedImage.empty())
+    {
+        //Every buffer is still queued for display, drop this frame
+        m_exportedImage = m_framePool.Acquire(m_cameraFrame.size(), CV_8UC3);
+        if(m_exportedImage.empty())
+            return VideoFrame();
+
+        if(m_cameraFrame.type() == CV_8UC2)
+        {
+            //Flipping packed YUYV would swap the chroma samples of each pixel pair
+            cv::cvtColor(m_cameraFrame, m_exportedImage, CV_YUV2RGB_YUYV);
+            if(m_mirroredOutput)
+                cv::flip(m_exportedImage, m_exportedImage, 1);
+        }
+        else if(m_mirroredOutput)
+        {
+            cv::flip(m_cameraFrame, m_exportedImage, 1);
+            cv::cvtColor(m_exportedImage, m_exportedImage, CV_BGR2RGB);
+        }
+        else
+            cv::cvtColor(m_cameraFrame, m_exportedImage, CV_BGR2RGB);
+    }
+
+    return VideoFrame(m_exportedImage, GetLastPosition());
+}
+
 QImage *FaceTracker::GetLastImage()
 {
-    //! \todo This will corrupt image if function called multiple times, or FaceTracker::GetFaceImage gets called
-    cv::cvtColor(m_cameraFrame, m_cameraFrame, CV_BGR2RGB);
+    VideoFrame frame = GetLastFrame();
+    if(frame.IsNull())
+        return NULL;
 
-    return new QImage(m_cameraFrame.data, m_cameraFrame.cols,
-                      m_cameraFrame.rows, QImage::Format_RGB888);
+    return new QImage(frame.GetImage().copy());
 }
 
 QImage *FaceTracker::GetFaceImage()
 {
-    //! \todo This is very expensive and inefficient way of performing this action
-    QImage *image = GetLastImage();
-    QImage *result = new QImage(image->copy(m_lastPosition));
-    delete image;
-    return result;
+    VideoFrame face = GetLastFrame().GetFaceFrame();
+    if(face.IsNull())
+        return NULL;
+
+    return new QImage(face.GetImage().copy());
 }
 
 QRect FaceTracker::GetLastPosition(bool normalized)
 {
-    if(normalized)
-    {
-        return QRect(100*m_lastPosition.x()/m_imageWidth,
-                     100*m_lastPosition.y()/m_imageHeight,
-                     100*m_lastPosition.width()/m_imageWidth,
-                     100*m_lastPosition.height()/m_imageHeight);
-    }
-
-    return m_lastPosition;
+    return ToOutputRect(m_lastPosition, normalized);
 }
 
 
-void FaceTracker::Init(int deviceID)
+void FaceTracker::Init()
 {
     m_minFeatureSize = cv::Size(DEFAULT_MIN_FEATURE_SIZE,DEFAULT_MIN_FEATURE_SIZE);
     m_searchScaleFactor = DEFAULT_SEARCH_SCALE_FACTOR;
     m_minNeighbors = DEFAULT_MIN_NEIGHBORS_CUTOFF;
     m_additionalFlags = DEFAULT_ADDITIONAL_FLAGS;
     m_classifierXmlFilename = DEFAULT_CLASSIFIER_XML_FILENAME;
+    m_classifierFile = NULL;
+    m_mirroredOutput = DEFAULT_MIRRORED_OUTPUT;
+    m_detectionThreads = DEFAULT_DETECTION_THREADS;
+    m_roiTracking = DEFAULT_ROI_TRACKING;
+    m_roiPadding = DEFAULT_ROI_PADDING;
+    m_roiSizeVariation = DEFAULT_ROI_SIZE_VARIATION;
+    m_fullScanInterval = DEFAULT_FULL_SCAN_INTERVAL;
+    m_framesSinceFullScan = 0;
+    m_detectionInterval = DEFAULT_DETECTION_INTERVAL;
+    m_trackingConfidence = DEFAULT_TRACKING_CONFIDENCE;
+    m_trackingSearchMargin = DEFAULT_TRACKING_SEARCH_MARGIN;
+    m_framesSinceDetection = 0;
+    m_motionGating = DEFAULT_MOTION_GATING;
+    m_motionThreshold = DEFAULT_MOTION_THRESHOLD;
+    m_motionMaxSkipped = DEFAULT_MOTION_MAX_SKIPPED;
+    m_framesSkipped = 0;
+    m_lastFrameSkipped = false;
+    m_adaptiveScheduling = DEFAULT_ADAPTIVE_SCHEDULING;
+    m_manualLevel.resolution = 1.0f;
+    m_manualLevel.scaleFactor = m_searchScaleFactor;
+    m_manualLevel.roiPadding = m_roiPadding;
+    m_manualLevel.fullScanInterval = m_fullScanInterval;
+    m_preprocessTime = 0;
+    m_targetTrackId = -1;
+    m_frameTimestamp = 0;
 
-    m_vc.open(deviceID);
-    if(!m_vc.isOpened())
+    SetProcessingImageDimensions(DEFAULT_IMAGE_WIDTH, DEFAULT_IMAGE_HEIGHT);
+    SetClassifierXmlFilename(m_classifierXmlFilename);
+}
+
+void FaceTracker::OpenDevice(int deviceID)
+{
+    if(!m_grabber.Open(deviceID))
     {
         std::ostringstream error;
         error << "Device at id: " << deviceID << " is not present.";
         throw std::invalid_argument(error.str());
     }
 
-    SetProcessingImageDimensions(DEFAULT_IMAGE_WIDTH, DEFAULT_IMAGE_HEIGHT);
+    SetCaptureDimensions(DEFAULT_CAPTURE_WIDTH, DEFAULT_CAPTURE_HEIGHT);
+
+    m_grabber.start();
+}
+
+void FaceTracker::SetClassifierXmlFilename(const std::string &filename)
+{
+    m_classifierXmlFilename = filename;
+    delete m_classifierFile;
+    m_classifierFile = NULL;
 
-    QResource resource(QString(m_classifierXmlFilename.c_str()));
-    if(resource.isValid())
+    m_classifierPath = CascadeCache::Resolve(m_classifierXmlFilename);
+    if(m_classifierPath.empty())
     {
+        //No writable cache, kept until destruction, additional detection threads load their classifiers from it
         QFile resFile(QString(m_classifierXmlFilename.c_str()));
-        QTemporaryFile *tempFile = QTemporaryFile::createLocalFile(resFile);
+        m_classifierFile = QTemporaryFile::createLocalFile(resFile);
+        m_classifierFile->close();
+        m_classifierPath = m_classifierFile->fileName().toStdString();
+    }
 
-        LoadCascadeClassifier(tempFile->fileName().toStdString());
+    LoadCascadeClassifier(m_classifierPath);
 
-        tempFile->close();
-        delete tempFile;
-    }
-    else
-        LoadCascadeClassifier(m_classifierXmlFilename);
+    //Reload the per thread classifiers as well
+    if(m_detectionThreads > 1)
+        SetDetectionThreadCount(m_detectionThreads);
+}
+
+std::string FaceTracker::GetClassifierXmlFilename()
+{
+    return m_classifierXmlFilename;
+}
+
+bool FaceTracker::IsEndOfStream()
+{
+    return m_cameraFrame.empty() && m_grabber.IsEndOfStream();
 }
 
 void FaceTracker::LoadCascadeClassifier(const std::string filename)
 {
-    try
+    std::vector<cv::CascadeClassifier*> classifiers(1, &m_faceDetector);
+    if(!CascadeCache::Load(filename, classifiers))
+        throw std::runtime_error("Unable to load classifier xml file.");
+}
+
+void FaceTracker::RunCascade(const cv::Mat &image, std::vector<cv::Rect> &faceRects,
+                             cv::Size minSize, cv::Size maxSize)
+{
+    if(m_detectionThreads > 1 && m_parallelDetector.IsLoaded())
+        m_parallelDetector.DetectMultiScale(image, faceRects, m_searchScaleFactor,
+                                            m_minNeighbors, minSize, maxSize);
+    else
+        m_faceDetector.detectMultiScale(image, faceRects,
+                                        m_searchScaleFactor, m_minNeighbors,
+                                        cv::CASCADE_SCALE_IMAGE | m_additionalFlags,
+                                        minSize, maxSize);
+}
+
+bool FaceTracker::DetectAroundLastPosition(const cv::Mat &frame, std::vector<cv::Rect> &faceRects,
+                                           cv::Rect &searchArea)
+{
+    if(!m_roiTracking || !m_lastPosition.isValid()
+            || m_framesSinceFullScan >= m_fullScanInterval)
+        return false;
+
+    m_framesSinceFullScan++;
+
+    int padX = cvRound(m_lastPosition.width()*m_roiPadding);
+    int padY = cvRound(m_lastPosition.height()*m_roiPadding);
+    cv::Rect roi(m_lastPosition.x() - padX, m_lastPosition.y() - padY,
+                 m_lastPosition.width() + 2*padX, m_lastPosition.height() + 2*padY);
+    roi &= cv::Rect(0, 0, frame.cols, frame.rows);
+    if(roi.area() == 0)
+        return false;
+
+    //Only look for faces of roughly the same size as last time
+    int faceSize = std::max(m_lastPosition.width(), m_lastPosition.height());
+    int minSize = std::max(cvRound(faceSize*(1.0f - m_roiSizeVariation)), m_minFeatureSize.width);
+    int maxSize = cvRound(faceSize*(1.0f + m_roiSizeVariation));
+
+    RunCascade(frame(roi), faceRects, cv::Size(minSize, minSize), cv::Size(maxSize, maxSize));
+
+    for(std::vector<cv::Rect>::iterator itr = faceRects.begin();
+        itr != faceRects.end(); ++itr)
+    {
+        itr->x += roi.x;
+        itr->y += roi.y;
+    }
+
+    searchArea = roi;
+    return !faceRects.empty();
+}
+
+bool FaceTracker::TrackBetweenDetections(const cv::Mat &frame)
+{
+    if(m_detectionInterval <= 1 || m_faceTemplate.empty() || !m_lastPosition.isValid()
+            || m_framesSinceDetection >= m_detectionInterval - 1)
+        return false;
+
+    int marginX = cvRound(m_faceTemplate.cols*m_trackingSearchMargin) + 1;
+    int marginY = cvRound(m_faceTemplate.rows*m_trackingSearchMargin) + 1;
+    cv::Rect searchArea(m_lastPosition.x() - marginX, m_lastPosition.y() - marginY,
+                        m_faceTemplate.cols + 2*marginX, m_faceTemplate.rows + 2*marginY);
+    searchArea &= cv::Rect(0, 0, frame.cols, frame.rows);
+    if(searchArea.width < m_faceTemplate.cols || searchArea.height < m_faceTemplate.rows)
+        return false;
+
+    cv::Mat response;
+    cv::matchTemplate(frame(searchArea), m_faceTemplate, response, CV_TM_CCOEFF_NORMED);
+
+    double bestScore;
+    cv::Point bestLocation;
+    cv::minMaxLoc(response, NULL, &bestScore, NULL, &bestLocation);
+    if(bestScore < m_trackingConfidence)
+        return false;
+
+    m_lastPosition.moveTo(searchArea.x + bestLocation.x, searchArea.y + bestLocation.y);
+    m_framesSinceDetection++;
+    return true;
+}
+
+bool FaceTracker::SkipUnchangedFrame(const cv::Mat &frame)
+{
+    if(!m_motionGating)
+        return false;
+
+    cv::Size thumbnailSize(std::max(1, frame.cols/DEFAULT_MOTION_THUMBNAIL_SCALE),
+                           std::max(1, frame.rows/DEFAULT_MOTION_THUMBNAIL_SCALE));
+    cv::resize(frame, m_motionThumbnail, thumbnailSize, 0, 0, cv::INTER_AREA);
+
+    bool skip = false;
+    if(m_framesSkipped < m_motionMaxSkipped && m_motionReference.size() == m_motionThumbnail.size())
+    {
+        //Only the face matters while one is tracked, the skip limit catches everything else
+        cv::Rect area(0, 0, thumbnailSize.width, thumbnailSize.height);
+        if(m_lastPosition.isValid())
+        {
+            int padX = cvRound(m_lastPosition.width()*DEFAULT_MOTION_PADDING);
+            int padY = cvRound(m_lastPosition.height()*DEFAULT_MOTION_PADDING);
+            cv::Rect face((m_lastPosition.x() - padX)/DEFAULT_MOTION_THUMBNAIL_SCALE,
+                          (m_lastPosition.y() - padY)/DEFAULT_MOTION_THUMBNAIL_SCALE,
+                          (m_lastPosition.width() + 2*padX)/DEFAULT_MOTION_THUMBNAIL_SCALE + 1,
+                          (m_lastPosition.height() + 2*padY)/DEFAULT_MOTION_THUMBNAIL_SCALE + 1);
+            face &= area;
+            if(face.area() > 0)
+                area = face;
+        }
+
+        double difference = cv::norm(m_motionThumbnail(area), m_motionReference(area), cv::NORM_L1);
+        skip = difference < m_motionThreshold*area.area();
+    }
+
+    if(skip)
     {
-        m_faceDetector.load(filename);
+        m_framesSkipped++;
+        return true;
     }
-    catch (...) { }
 
-    if(m_faceDetector.empty())
-        throw std::runtime_error("Unable to load classifier xml file.");
+    //Compare against the frame actually searched so slow drift still adds up
+    cv::swap(m_motionThumbnail, m_motionReference);
+    m_framesSkipped = 0;
+    return false;
+}
+
+void FaceTracker::FinishFrame(const QElapsedTimer &timer)
+{
+    Metrics::RecordElapsed(Metrics::DetectTime, timer);
+
+    if(m_adaptiveScheduling && m_scheduler.AddSample(m_preprocessTime + timer.nsecsElapsed()/1000))
+        ApplyDetectionLevel(m_scheduler.GetLevel());
+}
+
+void FaceTracker::ApplyDetectionLevel(const DetectionLevel &level)
+{
+    m_searchScaleFactor = level.scaleFactor;
+    m_roiPadding = level.roiPadding;
+    m_fullScanInterval = level.fullScanInterval;
+
+    //Takes effect with the next frame, see FaceTracker::RescaleTrackingState
+    m_imageWidth = std::max(1, cvRound(m_processingLimit.width*level.resolution));
+    m_imageHeight = std::max(1, cvRound(m_processingLimit.height*level.resolution));
+}
+
+void FaceTracker::RescaleTrackingState(const cv::Size &from, const cv::Size &to)
+{
+    if(from.area() == 0 || to.area() == 0)
+        return;
+
+    double scaleX = (double)to.width/from.width;
+    double scaleY = (double)to.height/from.height;
+    if(m_lastPosition.isValid())
+        m_lastPosition.setRect(cvRound(m_lastPosition.x()*scaleX), cvRound(m_lastPosition.y()*scaleY),
+                               cvRound(m_lastPosition.width()*scaleX), cvRound(m_lastPosition.height()*scaleY));
+    m_tracks.Scale(scaleX, scaleY);
+
+    //Images of the old resolution can not be compared with the new one
+    m_faceTemplate.release();
+    m_motionReference.release();
+    m_predictor.Reset();
+}
+
+void FaceTracker::UpdateFaceTemplate(const cv::Mat &frame)
+{
+    m_framesSinceDetection = 0;
+
+    cv::Rect face(m_lastPosition.x(), m_lastPosition.y(),
+                  m_lastPosition.width(), m_lastPosition.height());
+    face &= cv::Rect(0, 0, frame.cols, frame.rows);
+    if(face.area() == 0)
+    {
+        m_faceTemplate.release();
+        return;
+    }
+
+    //Template and tracked rectangle must have the same size
+    m_lastPosition.setRect(face.x, face.y, face.width, face.height);
+    m_faceTemplate = frame(face).clone();
+}
+
+QRect FaceTracker::ToOutputRect(const QRect &rect, bool normalized)
+{
+    if(!rect.isValid())
+        return rect;
+
+    double scaleX = (double)m_frameSize.width/m_detectionSize.width;
+    double scaleY = (double)m_frameSize.height/m_detectionSize.height;
+    QRect output(cvRound(rect.x()*scaleX), cvRound(rect.y()*scaleY),
+                 cvRound(rect.width()*scaleX), cvRound(rect.height()*scaleY));
+    if(m_mirroredOutput)
+        output.moveLeft(m_frameSize.width - output.x() - output.width());
+
+    if(normalized)
+    {
+        return QRect(100*output.x()/m_frameSize.width,
+                     100*output.y()/m_frameSize.height,
+                     100*output.width()/m_frameSize.width,
+                     100*output.height()/m_frameSize.height);
+    }
+
+    return output;
 }
 
 QRect FaceTracker::findClosest(const std::vector<cv::Rect> &rects, QPoint point)
@@ -299,36 +808,39 @@ QRect FaceTracker::findClosest(const std::vector<cv::Rect> &rects, QPoint point)
 
 void FaceTracker::GetProcessReadyWebcamImage(cv::Mat &cameraFrame)
 {
-#ifdef DEBUG_CAPTURE_TIMING
-    QElapsedTimer timer;
-    timer.start();
-#endif
-
-    m_vc >> m_cameraFrame;
-
-#ifdef DEBUG_CAPTURE_TIMING
-    qint64 s1 = timer.elapsed();
-    timer.restart();
-#endif
+    if(!m_grabber.GetLatestFrame(m_cameraFrame, DEFAULT_FRAME_WAIT_TIMEOUT, &m_frameTimestamp))
+        m_cameraFrame.release();
+    //Exported frames keep their own reference, the pool recycles the buffer
+    m_exportedImage.release();
 
     if(m_cameraFrame.empty())
     {
         cameraFrame = m_cameraFrame;
         return;
     }
-    cv::flip(m_cameraFrame, m_cameraFrame, 1);
 
+    QElapsedTimer timer;
+    timer.start();
 
-    //To Grayscale
-    if(m_cameraFrame.channels() == 3)
-        cv::cvtColor(m_cameraFrame, cameraFrame, CV_BGR2GRAY);
-    else if(m_cameraFrame.channels() == 4)
-        cv::cvtColor(m_cameraFrame, cameraFrame, CV_BGRA2GRAY);
+    //Detection runs on the unmirrored image, only output coordinates get mirrored
+    m_frameSize = m_cameraFrame.size();
+    if((int)m_imageWidth >= m_cameraFrame.cols || (int)m_imageHeight >= m_cameraFrame.rows)
+    {
+        FrameProcessing::PrepareDetectionImage(m_cameraFrame, m_processedFrame, false);
+    }
+    else
+    {
+        //Equalizing after downscaling is cheaper and sees the same image the cascade does
+        FrameProcessing::ConvertToGray(m_cameraFrame, m_grayFrame, false);
+        cv::resize(m_grayFrame, m_processedFrame, cv::Size(m_imageWidth, m_imageHeight),
+                   0, 0, cv::INTER_AREA);
+        cv::equalizeHist(m_processedFrame, m_processedFrame);
+    }
+    if(m_processedFrame.size() != m_detectionSize)
+        RescaleTrackingState(m_detectionSize, m_processedFrame.size());
+    m_detectionSize = m_processedFrame.size();
+    cameraFrame = m_processedFrame;
 
-    //Histogram Equalization
-    cv::equalizeHist(cameraFrame, cameraFrame);
-#ifdef DEBUG_CAPTURE_TIMING
-    qint64 s2 = timer.elapsed();
-    qDebug() << "Frame Capture Time: " << s1 << "\t Process Time: " << s2;
-#endif
+    m_preprocessTime = timer.nsecsElapsed()/1000;
+    Metrics::RecordElapsed(Metrics::PreprocessTime, timer);
 }
@@ -14,10 +14,19 @@
 
 
 #include <opencv2/opencv.hpp>
+#include "framegrabber.h"
+#include "parallelcascadedetector.h"
+#include "videoframe.h"
+#include "facetracktable.h"
+#include "facepredictor.h"
+#include "detectionscheduler.h"
 #include <QRect>
 #include <QList>
 #include <QImage>
 
+class QTemporaryFile;
+class QElapsedTimer;
+
 //Default values for cv::CascadeClassifier::detectMultiScale()
 //! \brief Default value for minimum feature size
 #define DEFAULT_MIN_FEATURE_SIZE        40
@@ -28,18 +37,72 @@
 //! \brief Default value for minimum neighbor cutoff value
 #define DEFAULT_MIN_NEIGHBORS_CUTOFF    3
 
+//! \brief Default number of threads evaluating the cascade (1 uses cv::CascadeClassifier directly)
+#define DEFAULT_DETECTION_THREADS       1
+
 //! \brief Default additional flags
 #define DEFAULT_ADDITIONAL_FLAGS        0
 
 //! \brief Default classifier xml filename
 #define DEFAULT_CLASSIFIER_XML_FILENAME ":/classifiers/lbpcascade_frontalface.xml"
 
+//! \brief Positions and images are mirrored horizontally by default
+#define DEFAULT_MIRRORED_OUTPUT         true
+
 //! \brief Default Image Width
 #define DEFAULT_IMAGE_WIDTH             640
 
 //! \brief Default Image Height
 #define DEFAULT_IMAGE_HEIGHT            480
 
+//! \brief Default camera capture width
+#define DEFAULT_CAPTURE_WIDTH           640
+
+//! \brief Default camera capture height
+#define DEFAULT_CAPTURE_HEIGHT          480
+
+//Default values for region of interest tracking
+//! \brief Region of interest tracking is disabled by default
+#define DEFAULT_ROI_TRACKING            false
+
+//! \brief Default padding around the last face, as a fraction of the face size
+#define DEFAULT_ROI_PADDING             0.5f
+
+//! \brief Default allowed change in face size between frames, as a fraction of the face size
+#define DEFAULT_ROI_SIZE_VARIATION      0.3f
+
+//! \brief Default number of region of interest searches between full frame scans
+#define DEFAULT_FULL_SCAN_INTERVAL      10
+
+//Default values for tracking between cascade detections
+//! \brief Default number of frames per cascade detection (1 disables inter-frame tracking)
+#define DEFAULT_DETECTION_INTERVAL      1
+
+//! \brief Default minimum template match score for a tracked position to be accepted
+#define DEFAULT_TRACKING_CONFIDENCE     0.6f
+
+//! \brief Default template search margin around the last face, as a fraction of the face size
+#define DEFAULT_TRACKING_SEARCH_MARGIN  0.25f
+
+//Default values for skipping frames in which nothing moved
+//! \brief Motion gating is disabled by default
+#define DEFAULT_MOTION_GATING           false
+
+//! \brief Default mean absolute difference (gray levels) of the thumbnails below which a frame is skipped
+#define DEFAULT_MOTION_THRESHOLD        3.0f
+
+//! \brief Default maximum number of consecutive skipped frames
+#define DEFAULT_MOTION_MAX_SKIPPED      15
+
+//! \brief Default factor by which frames are downscaled before being compared
+#define DEFAULT_MOTION_THUMBNAIL_SCALE  8
+
+//! \brief Default padding around the last face of the compared area, as a fraction of the face size
+#define DEFAULT_MOTION_PADDING          0.5f
+
+//! \brief Adaptive scheduling is disabled by default
+#define DEFAULT_ADAPTIVE_SCHEDULING     false
+
 /*! \brief Tracks a face as it moves around.
 
   This class is a wrapper around OpenCV and provides an eassy to use interface
@@ -49,10 +112,24 @@
   device ID of the webcam to use can be specified in the constructor of the
   class otherwise the first webcam (device ID: 0) is used.
 
+  Frames are captured on a separate thread by FrameGrabber, face detection is
+  always performed on the newest captured frame and frames which could not be
+  processed in time are dropped.
+  \sa FrameGrabber
+
+  Frames are captured at the capture resolution (FaceTracker::SetCaptureDimensions)
+  but face detection runs on a copy downscaled to the processing resolution
+  (FaceTracker::SetProcessingImageDimensions). Returned positions and images
+  are always in capture resolution, so a small processing resolution speeds up
+  detection without degrading the preview or the face images.
+
   In the presence of multiple faces, FaceTracker will attempt to track the
-  same face as it moves around the scree. If multiple faces are present a
-  face is selected to be tracked as per the FaceTracker::SelectFace2Track.
-  \sa FaceTracker::SelectFace2Track
+  same face as it moves around the scree. Every detected face gets an identity
+  in a FaceTrackTable, FaceTracker::GetFacePosition follows one of them until
+  it has been out of sight for several frames and only then picks the face
+  closest to the center of the screen. Faces briefly missed by the detector
+  therefore do not make the tracker jump between faces.
+  \sa FaceTracker::GetTracks
 
   The class also exposes some parameters for tuning the face detection:
   \sa FaceTracker::m_minFeatureSize
@@ -60,6 +137,53 @@
   \sa FaceTracker::m_minNeighbors
   \sa FaceTracker::m_additionalFlags
 
+  <b> Region of Interest Tracking </b>
+
+  When enabled with FaceTracker::SetRegionOfInterestTracking, FaceTracker::GetFacePosition
+  first searches only a padded window around the previously tracked face, looking
+  only for faces of similar size. The whole frame is scanned when nothing is found
+  in that window, or every FaceTracker::GetFullScanInterval frames so that new
+  faces are still noticed.
+  \sa FaceTracker::m_roiPadding
+  \sa FaceTracker::m_fullScanInterval
+
+  <b> Tracking Between Detections </b>
+
+  The cascade classifier is expensive, so FaceTracker::GetFacePosition can run it
+  only once every FaceTracker::GetDetectionInterval frames. On the frames in
+  between the face is followed by normalized cross-correlation of the face as it
+  looked at the last detection against a small window around its last position.
+  The cascade is re-run early whenever the match score drops below
+  FaceTracker::GetTrackingConfidence, so position updates arrive at camera frame
+  rate while the tracker can not drift for long.
+  \sa FaceTracker::m_detectionInterval
+  \sa FaceTracker::m_trackingConfidence
+
+  <b> Motion Gating </b>
+
+  A user sitting still produces a stream of nearly identical frames. When
+  enabled with FaceTracker::SetMotionGating, every frame is shrunk to a small
+  thumbnail and compared to the thumbnail of the last frame that was actually
+  searched, over a padded area around the tracked face (the whole frame if
+  there is none). If the mean absolute difference stays below
+  FaceTracker::GetMotionThreshold, the previous result is returned without
+  running the tracker or the cascade. At most FaceTracker::GetMaxSkippedFrames
+  frames are skipped in a row, so faces appearing elsewhere are still found.
+  \sa FaceTracker::m_motionThreshold
+  \sa FaceTracker::m_motionMaxSkipped
+
+  <b> Adaptive Scheduling </b>
+
+  Instead of tuning the detection by hand for every machine, a
+  DetectionScheduler can be enabled with FaceTracker::SetAdaptiveScheduling.
+  It measures the preprocessing and detection time of every searched frame
+  and at runtime adjusts the search scale factor, the processing resolution,
+  the region of interest padding and the full scan interval to stay within
+  FaceTracker::GetTargetFrameTime. The processing dimensions set with
+  FaceTracker::SetProcessingImageDimensions become the highest resolution
+  used. Tracked faces keep their identity when the resolution changes.
+  \sa FaceTracker::m_scheduler
+
   <b> Typical Use Case </b>
 
   Typically this class will be used in a tight loop with repeated calls to
@@ -71,9 +195,10 @@
   while(1)
   {
         QRect rect = faceTracker.GetFacePosition();
-        QImage *image = faceTracker.GetLastImage();
+        VideoFrame frame = faceTracker.GetLastFrame();
+        QPixmap pixmap = QPixmap::fromImage(frame.GetImage());
         QPainter p;
-        p.begin(image);
+        p.begin(&pixmap);
         p.setPen(QPen(Qt::red));
         p.drawRect(rect);
         p.end();
@@ -93,6 +218,21 @@ public:
     */
     FaceTracker(int deviceID);
 
+    /*! \brief Constructor reads frames from the source described by \a uri
+      Frames of non-live sources such as video files are processed one by one,
+      none are dropped. Used for offline benchmarking, see bench/facetrackerbench.cpp.
+      \param uri See FrameSource::Create, e.g. "face.avi", "frames/%04d.png" or "synthetic:640x480"
+    */
+    FaceTracker(const std::string &uri);
+
+    /*! \brief Constructor reads frames from \a source
+      \param source Source to capture from, the tracker takes ownership
+    */
+    FaceTracker(FrameSource *source);
+
+    //! \brief Stops the capture thread and releases the camera
+    ~FaceTracker();
+
     /*! \brief Stops tracking of the current face.
 
       This Tracker will attempt to follow the same face around as it
@@ -134,6 +274,36 @@ public:
     */
     QRect GetBestFacePosition(bool normalized = false);
 
+    /*! \brief Returns every face currently tracked
+      Faces are updated by FaceTracker::GetFacePosition and
+      FaceTracker::GetAllFacesPositions. Faces detected only once so far are
+      left out as they are often false detections.
+      \param normalized See \ref normRect, applies to the rectangles and velocities
+      \returns Tracks with output coordinates
+    */
+    QList<FaceTrack> GetTracks(bool normalized = false);
+
+    /*! \brief Returns where the tracked face is expected to be at \a timestamp
+
+      Positions measured by FaceTracker::GetFacePosition are filtered by a
+      FacePredictor. Predicting for the current time (FrameGrabber::Timestamp)
+      hides the capture and detection latency, adding the time the consumer
+      takes to act on the position hides that as well. Between detections the
+      prediction also moves smoothly where the measured position would jump.
+      \param timestamp Time (ms) on the clock of FrameGrabber::Timestamp
+      \param normalized See \ref normRect
+      \returns An invalid rectangle if no face has been measured recently
+    */
+    QRect GetPredictedPosition(qint64 timestamp, bool normalized = false);
+
+    //! \brief Returns the capture time of the last processed frame, see FrameGrabber::Timestamp
+    qint64 GetLastFrameTimestamp();
+
+    /*! \brief Returns the ID of the track FaceTracker::GetFacePosition follows
+      \returns -1 if no face is being followed
+    */
+    int GetTargetTrackId();
+
     /*! \brief Selects which face to track from a list
       Given a list of bounding rectangles, this function select which face will
       be tracked from here on out.
@@ -155,17 +325,126 @@ public:
     //! \brief Setter for search scale factor used for cv::CascadeClassifier::detectMultiScale()
     void SetSearchScaleFactor(float searchScaleFactor);
 
+    /*! \brief Loads a different cascade classifier
+      Resources are loaded from their parsed form kept in the user cache
+      directory, see CascadeCache::Resolve.
+      \param filename Path of the classifier xml file, may be a Qt resource path
+      \throws std::runtime_error if the classifier could not be loaded
+    */
+    void SetClassifierXmlFilename(const std::string &filename);
+    //! \brief Returns the filename of the loaded classifier
+    std::string GetClassifierXmlFilename();
+
+    //! \brief Getter for the number of threads evaluating the cascade
+    int GetDetectionThreadCount();
+    /*! \brief Setter for the number of threads evaluating the cascade
+      With more than one thread the scale pyramid is evaluated by a
+      ParallelCascadeDetector, which loads one classifier per thread.
+      Additional flags are not used by the parallel detector.
+      \param threads Number of threads, typically QThread::idealThreadCount()
+    */
+    void SetDetectionThreadCount(int threads);
+
     //! \brief Getter for minimum neighbors cutoff used for cv::CascadeClassifier::detectMultiScale()
     int GetMinNeighbors();
     //! \brief Setter for minimum neighbors cutoff used for cv::CascadeClassifier::detectMultiScale()
     void SetMinNeighbors(int minNeighbors);
 
+    /*! \brief Enables searching around the last tracked face before scanning the whole frame
+      \sa FaceTracker::SetROIPadding, FaceTracker::SetFullScanInterval
+    */
+    void SetRegionOfInterestTracking(bool enable = true);
+    //! \brief Returns true if region of interest tracking is enabled
+    bool IsRegionOfInterestTrackingEnabled();
+
+    //! \brief Getter for the padding added around the last face (fraction of face size)
+    float GetROIPadding();
+    //! \brief Setter for the padding added around the last face (fraction of face size)
+    void SetROIPadding(float padding);
+
+    //! \brief Getter for the number of region of interest searches between full frame scans
+    int GetFullScanInterval();
+    //! \brief Setter for the number of region of interest searches between full frame scans
+    void SetFullScanInterval(int frames);
+
+    /*! \brief Setter for the number of frames per cascade detection
+      The frames in between are tracked by template matching. A value of 1 runs
+      the cascade on every frame.
+      \sa FaceTracker::SetTrackingConfidence
+    */
+    void SetDetectionInterval(int frames);
+    //! \brief Getter for the number of frames per cascade detection
+    int GetDetectionInterval();
+
+    /*! \brief Setter for the minimum template match score (0.0 .. 1.0)
+      Tracked positions scoring below this value are discarded and the cascade
+      is run on the same frame instead.
+    */
+    void SetTrackingConfidence(float confidence);
+    //! \brief Getter for the minimum template match score
+    float GetTrackingConfidence();
+
+    /*! \brief Reuses the last result for frames in which nothing moved
+      \sa FaceTracker::SetMotionThreshold, FaceTracker::SetMaxSkippedFrames
+    */
+    void SetMotionGating(bool enable = true);
+    //! \brief Returns true if motion gating is enabled
+    bool IsMotionGatingEnabled();
+
+    //! \brief Getter for the mean absolute difference (gray levels) below which a frame is skipped
+    float GetMotionThreshold();
+    //! \brief Setter for the mean absolute difference (gray levels) below which a frame is skipped
+    void SetMotionThreshold(float threshold);
+
+    //! \brief Getter for the maximum number of consecutive skipped frames
+    int GetMaxSkippedFrames();
+    //! \brief Setter for the maximum number of consecutive skipped frames
+    void SetMaxSkippedFrames(int frames);
+
+    /*! \brief Returns true if the last call to FaceTracker::GetFacePosition
+               reused the previous result because nothing moved
+    */
+    bool WasLastFrameSkipped();
+
+    /*! \brief Adjusts the detection parameters at runtime to stay within the target frame time
+      While enabled, the values set with FaceTracker::SetSearchScaleFactor,
+      FaceTracker::SetROIPadding and FaceTracker::SetFullScanInterval are
+      overridden. They are restored when it is disabled again.
+      \sa FaceTracker::SetTargetFrameTime
+    */
+    void SetAdaptiveScheduling(bool enable = true);
+    //! \brief Returns true if adaptive scheduling is enabled
+    bool IsAdaptiveSchedulingEnabled();
+
+    //! \brief Getter for the target time (ms) to preprocess and search one frame
+    float GetTargetFrameTime();
+    //! \brief Setter for the target time (ms) to preprocess and search one frame
+    void SetTargetFrameTime(float milliseconds);
+
+    /*! \brief Returns the detection level chosen by the scheduler
+      \returns 0 for the most accurate level, -1 if adaptive scheduling is disabled
+    */
+    int GetDetectionLevel();
+
     /*! \brief Sets the dimensions for the image to be processed by OpenCV
-      This option may effect performance and reliability of the face detection
-      algorithms of OpenCV.
+      Captured frames are downscaled to these dimensions before face detection,
+      frames smaller than this are processed at their own size. This option may
+      effect performance and reliability of the face detection algorithms of OpenCV.
+      \note Feature sizes (FaceTracker::SetMinFeatureSize) are in processing resolution.
     */
     void SetProcessingImageDimensions(int width, int height);
 
+    /*! \brief Sets the dimensions of the frames captured from the camera
+      Returned positions and images are in this resolution.
+      \note The camera may choose the closest resolution it supports.
+    */
+    void SetCaptureDimensions(int width, int height);
+
+    /*! \brief Publishes the captured frames to other processes, see FrameGrabber::SetSharedMemoryName
+      \param name POSIX shared memory name, e.g. "/lockheed-camera", empty to stop publishing
+    */
+    void SetSharedMemoryName(const std::string &name);
+
     /*! \brief Getter for flags used for cv::CascadeClassifier::detectMultiScale()
      These flags are appended to the flags already used for the function call.
      For example, FaceTracker::GetBestFacePosition will use
@@ -194,19 +473,42 @@ public:
     */
     void SetAdditionalFlags(unsigned int flags);
 
+    /*! \brief Mirrors returned positions and images horizontally
+      Mirrored output makes the camera image behave like a mirror for the user.
+      Face detection itself always runs on the unmirrored frame, only the
+      returned coordinates and exported images are mirrored.
+    */
+    void SetMirroredOutput(bool mirror = true);
+    //! \brief Returns true if positions and images are mirrored horizontally
+    bool IsMirroredOutputEnabled();
+
     /*! \brief Returns the last processed frame
       The tracker internally saves the last processed frame and this function
       can be used to retrieve it. Along with the face positions, this can help
       display real time face tracking information.
-      \returns Last Processed frame
+
+      The frame is converted to RGB (and mirrored, see FaceTracker::SetMirroredOutput)
+      at most once per processed frame, into a buffer recycled from
+      FaceTracker::m_framePool. Calling this function repeatedly returns handles
+      to the same pixels. The face rectangle of the frame is set to
+      FaceTracker::GetLastPosition, use VideoFrame::GetFaceFrame for the face image.
+      \returns Last processed frame, null if no frame has been captured or if
+               every pooled buffer is still referenced (the frame is dropped)
+    */
+    VideoFrame GetLastFrame();
+
+    /*! \brief Returns a copy of the last processed frame
+      \returns Last Processed frame, the caller takes ownership
+      \sa FaceTracker::GetLastFrame
     */
     QImage *GetLastImage();
 
     /*! \brief Returns the cropped image of the tracked face
       If there is currently a face being tracked, the face is cropped out of the
       last processed frame.
-      \returns Cropped image of the tracked face. NULL is returned if no face
-               was detected in the last processed frame.
+      \returns Cropped image of the tracked face, the caller takes ownership.
+               NULL is returned if no face was detected in the last processed frame.
+      \sa FaceTracker::GetLastFrame
     */
     QImage *GetFaceImage();
 
@@ -217,21 +519,100 @@ public:
     */
     QRect GetLastPosition(bool normalized = false);
 
+    /*! \brief Returns true once a video file has been processed completely
+      The last position query got no frame and no more frames will come.
+      Always false for cameras.
+    */
+    bool IsEndOfStream();
+
 
 private:
     /*! \brief Initialization function
 
       Performs the initialization of the class, should only be called
-      from constructors
+      from constructors. The frame source is opened by the constructors.
+    */
+    void Init();
+
+    /*! \brief Opens the camera and starts capturing
       \param deviceID Device to be used for VideoCapture and image acquisition
     */
-    void Init(int deviceID);
+    void OpenDevice(int deviceID);
 
     /*! \brief CascadeClassifier is loaded with the file
       \param filename Full or relative path of the file
     */
     void LoadCascadeClassifier(const std::string filename);
 
+    /*! \brief Runs the cascade on the image
+      Uses FaceTracker::m_parallelDetector if more than one detection thread
+      is configured, FaceTracker::m_faceDetector otherwise.
+      \param image Processed image to search
+      \param faceRects [out] Detected faces
+      \param minSize Minimum face size
+      \param maxSize Maximum face size, cv::Size() for no limit
+    */
+    void RunCascade(const cv::Mat &image, std::vector<cv::Rect> &faceRects,
+                    cv::Size minSize, cv::Size maxSize = cv::Size());
+
+    /*! \brief Searches for faces in a window around FaceTracker::m_lastPosition
+
+      Only faces within FaceTracker::m_roiSizeVariation of the last face size
+      are considered. Found rectangles are in full frame coordinates.
+      \param frame Processed frame as returned by FaceTracker::GetProcessReadyWebcamImage
+      \param faceRects [out] Detected faces
+      \param searchArea [out] Window that was searched
+      \returns false if the search was not performed or found no faces, in which
+               case the whole frame should be scanned
+    */
+    bool DetectAroundLastPosition(const cv::Mat &frame, std::vector<cv::Rect> &faceRects,
+                                  cv::Rect &searchArea);
+
+    /*! \brief Follows the tracked face using FaceTracker::m_faceTemplate
+
+      Tracking is only attempted while fewer than FaceTracker::m_detectionInterval - 1
+      frames have been tracked since the last cascade detection.
+      \param frame Processed frame as returned by FaceTracker::GetProcessReadyWebcamImage
+      \returns true if FaceTracker::m_lastPosition was updated, false if the
+               cascade should be run instead
+    */
+    bool TrackBetweenDetections(const cv::Mat &frame);
+
+    /*! \brief Compares the frame to the last searched frame around FaceTracker::m_lastPosition
+
+      The frame is downscaled by DEFAULT_MOTION_THUMBNAIL_SCALE first. Frames
+      that are not skipped become the new reference.
+      \param frame Processed frame as returned by FaceTracker::GetProcessReadyWebcamImage
+      \returns true if the frame is too similar to be worth searching
+    */
+    bool SkipUnchangedFrame(const cv::Mat &frame);
+
+    /*! \brief Records the time spent on the frame and lets the scheduler adjust the detection
+      \param timer Started when the processed frame became available
+    */
+    void FinishFrame(const QElapsedTimer &timer);
+
+    //! \brief Sets the detection parameters and processing resolution of \a level
+    void ApplyDetectionLevel(const DetectionLevel &level);
+
+    /*! \brief Converts the tracking state to a new processing resolution
+      Positions and tracks are scaled, the template and the filter start over.
+    */
+    void RescaleTrackingState(const cv::Size &from, const cv::Size &to);
+
+    /*! \brief Saves the area of FaceTracker::m_lastPosition as the template to track
+      \param frame Processed frame the last position was detected in
+    */
+    void UpdateFaceTemplate(const cv::Mat &frame);
+
+    /*! \brief Converts a rectangle from processed frame coordinates to output coordinates
+      Scales the rectangle to capture resolution and applies mirroring
+      (see FaceTracker::SetMirroredOutput) and normalization.
+      \param rect Rectangle in processed frame coordinates
+      \param normalized See \ref normRect
+    */
+    QRect ToOutputRect(const QRect &rect, bool normalized);
+
     /*! \brief Finds rectangle with center closest to point
       \param rects List of rectangles
       \param point Target point
@@ -239,21 +620,38 @@ private:
     QRect findClosest(const std::vector<cv::Rect> &rects, QPoint point);
 
     /*! \brief Obtains a properly sized and processed image for CascadeClassifer
-      The obtained image is sized down, converted to gray, and undergone
-      histogram equalization. These alterations are aimed at improving performance
-      and detection accuracy.
-      \param cameraFrame [out] The captured image is stored
-      \note This function alters the last saved camera frame.
+      The newest frame captured by FaceTracker::m_grabber is used, if no new
+      frame arrives within DEFAULT_FRAME_WAIT_TIMEOUT an empty image is returned.
+      The obtained image is converted to gray, downscaled to the processing
+      resolution with area interpolation and undergone histogram equalization.
+      These alterations are aimed at improving performance and detection accuracy.
+      \param cameraFrame [out] The processed image, shares data with FaceTracker::m_processedFrame
     */
     void GetProcessReadyWebcamImage(cv::Mat &cameraFrame);
 
-    cv::VideoCapture m_vc;   //!< Used for acquiring images from camera
+    FrameGrabber m_grabber;  //!< Captures images from the camera on its own thread
     cv::CascadeClassifier m_faceDetector; //!< Used for face detection
     std::string m_classifierXmlFilename;//!< The filename of the XML containing the classifier data
+    std::string m_classifierPath;       //!< Path on disk the classifier was loaded from
+    QTemporaryFile *m_classifierFile;   //!< Classifier extracted from resources when the cache is not writable, NULL otherwise
+    ParallelCascadeDetector m_parallelDetector; //!< Used for face detection with multiple threads
+    int m_detectionThreads;             //!< Number of threads evaluating the cascade
 
     //Face tracking data saved between runs
-    QRect m_lastPosition;   //!< Stores the last bounding rectangle of the tracked face
+    QRect m_lastPosition;   //!< Stores the last bounding rectangle of the tracked face (unmirrored, processing resolution)
+    FaceTrackTable m_tracks;    //!< Identities of all faces in view
+    int m_targetTrackId;        //!< ID of the track followed by FaceTracker::GetFacePosition, -1 if none
+    FacePredictor m_predictor;  //!< Filters the position of the followed face
+    qint64 m_frameTimestamp;    //!< Capture time of FaceTracker::m_cameraFrame
     cv::Mat m_cameraFrame; //!< Stores the last processed frame (needed for face extraction)
+    cv::Mat m_exportedImage;    //!< RGB image returned by FaceTracker::GetLastFrame, empty until requested
+    VideoFramePool m_framePool; //!< Recycles the buffers of FaceTracker::m_exportedImage
+    cv::Mat m_grayFrame;        //!< Full resolution grayscale image of the last frame, reused between frames
+    cv::Mat m_processedFrame;   //!< Grayscale equalized image of the last frame, reused between frames
+    cv::Size m_frameSize;       //!< Dimensions of the last captured frame
+    cv::Size m_detectionSize;   //!< Dimensions of the last processed frame
+    cv::Size m_processingLimit; //!< Processing dimensions set by FaceTracker::SetProcessingImageDimensions
+    bool m_mirroredOutput;      //!< Mirror returned positions and images horizontally
 
     //Parameters for tuning face detection
     cv::Size m_minFeatureSize;  //!< Minimum feature size used for cv::CascadeClassifier::detectMultiScale()
@@ -263,6 +661,35 @@ private:
     unsigned int m_imageWidth;      //!< Specifies the width of the image on which face detection is performed
     unsigned int m_imageHeight;     //!< Specifies the height of the image on which face detection is performed
 
+    //Parameters for region of interest tracking
+    bool m_roiTracking;         //!< Search around the last face before scanning the whole frame
+    float m_roiPadding;         //!< Padding added on each side of the last face (fraction of face size)
+    float m_roiSizeVariation;   //!< Allowed change in face size between frames (fraction of face size)
+    int m_fullScanInterval;     //!< Maximum number of consecutive region of interest searches
+    int m_framesSinceFullScan;  //!< Region of interest searches performed since the last full scan
+
+    //Parameters for tracking between cascade detections
+    int m_detectionInterval;        //!< Number of frames per cascade detection
+    float m_trackingConfidence;     //!< Minimum template match score to accept a tracked position
+    float m_trackingSearchMargin;   //!< Template search margin around the last face (fraction of face size)
+    int m_framesSinceDetection;     //!< Frames tracked by template matching since the last cascade detection
+    cv::Mat m_faceTemplate;         //!< Processed image of the face at the last cascade detection
+
+    //Parameters for motion gating
+    bool m_motionGating;            //!< Skip frames in which nothing moved
+    float m_motionThreshold;        //!< Mean absolute thumbnail difference below which a frame is skipped
+    int m_motionMaxSkipped;         //!< Maximum number of consecutive skipped frames
+    int m_framesSkipped;            //!< Consecutive frames skipped so far
+    bool m_lastFrameSkipped;        //!< The last position query reused the previous result
+    cv::Mat m_motionThumbnail;      //!< Thumbnail of the current frame, reused between frames
+    cv::Mat m_motionReference;      //!< Thumbnail of the last frame that was searched
+
+    //Adaptive scheduling
+    bool m_adaptiveScheduling;      //!< Let FaceTracker::m_scheduler choose the detection parameters
+    DetectionScheduler m_scheduler; //!< Picks the detection level from measured frame times
+    DetectionLevel m_manualLevel;   //!< Parameters set by hand, restored when scheduling is disabled
+    qint64 m_preprocessTime;        //!< Time (us) spent preprocessing the last frame
+
 
     static const QRect InvalidQRect;    //!< Easy way to create an InvalidRect
 };
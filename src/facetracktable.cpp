@@ -0,0 +1,226 @@
+#include "facetracktable.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+//! A possible pairing of a track and a detection
+struct Candidate
+{
+    float cost;
+    int track;
+    int detection;
+
+    bool operator<(const Candidate &other) const { return cost < other.cost; }
+};
+
+QRect Predict(const FaceTrack &track)
+{
+    return track.rect.translated(qRound(track.velocity.x()), qRound(track.velocity.y()));
+}
+}
+
+FaceTrack::FaceTrack() :
+    id(-1), age(0), hits(0), missed(0)
+{
+}
+
+FaceTrackTable::FaceTrackTable() :
+    m_nextId(1), m_maxMissed(DEFAULT_TRACK_MAX_MISSED), m_minHits(DEFAULT_TRACK_MIN_HITS),
+    m_matchThreshold(DEFAULT_TRACK_MATCH_THRESHOLD)
+{
+}
+
+void FaceTrackTable::Update(const std::vector<cv::Rect> &detections, const cv::Rect &searchArea)
+{
+    std::vector<QRect> predictions;
+    predictions.reserve(m_tracks.size());
+    for(int i = 0; i < m_tracks.size(); i++)
+        predictions.push_back(Predict(m_tracks[i]));
+
+    std::vector<Candidate> candidates;
+    for(int t = 0; t < m_tracks.size(); t++)
+    {
+        for(size_t d = 0; d < detections.size(); d++)
+        {
+            Candidate candidate;
+            candidate.cost = MatchCost(predictions[t], detections[d]);
+            candidate.track = t;
+            candidate.detection = (int)d;
+            if(candidate.cost < m_matchThreshold)
+                candidates.push_back(candidate);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<bool> trackMatched(m_tracks.size(), false);
+    std::vector<bool> detectionMatched(detections.size(), false);
+    for(size_t i = 0; i < candidates.size(); i++)
+    {
+        const Candidate &candidate = candidates[i];
+        if(trackMatched[candidate.track] || detectionMatched[candidate.detection])
+            continue;
+
+        const cv::Rect &detection = detections[candidate.detection];
+        Correct(m_tracks[candidate.track], QRect(detection.x, detection.y, detection.width, detection.height));
+        trackMatched[candidate.track] = true;
+        detectionMatched[candidate.detection] = true;
+    }
+
+    QRect searched(searchArea.x, searchArea.y, searchArea.width, searchArea.height);
+    QList<FaceTrack> tracks;
+    for(int t = 0; t < m_tracks.size(); t++)
+    {
+        FaceTrack &track = m_tracks[t];
+        track.age++;
+        if(!trackMatched[t] && searched.intersects(predictions[t]))
+        {
+            //Coast along the predicted path, slowing down while unseen
+            track.missed++;
+            track.rect = predictions[t];
+            track.velocity *= 0.5;
+        }
+
+        if(track.missed <= m_maxMissed)
+            tracks.append(track);
+    }
+
+    for(size_t d = 0; d < detections.size(); d++)
+    {
+        if(detectionMatched[d])
+            continue;
+
+        FaceTrack track;
+        track.id = m_nextId++;
+        track.rect.setRect(detections[d].x, detections[d].y, detections[d].width, detections[d].height);
+        track.hits = 1;
+        tracks.append(track);
+    }
+
+    m_tracks = tracks;
+}
+
+bool FaceTrackTable::Correct(int id, const QRect &rect)
+{
+    for(int i = 0; i < m_tracks.size(); i++)
+    {
+        if(m_tracks[i].id == id)
+        {
+            Correct(m_tracks[i], rect);
+            return true;
+        }
+    }
+    return false;
+}
+
+void FaceTrackTable::Clear()
+{
+    m_tracks.clear();
+}
+
+void FaceTrackTable::Scale(double scaleX, double scaleY)
+{
+    for(int i = 0; i < m_tracks.size(); i++)
+    {
+        FaceTrack &track = m_tracks[i];
+        track.rect.setRect(qRound(track.rect.x()*scaleX), qRound(track.rect.y()*scaleY),
+                           qRound(track.rect.width()*scaleX), qRound(track.rect.height()*scaleY));
+        track.velocity.setX(track.velocity.x()*scaleX);
+        track.velocity.setY(track.velocity.y()*scaleY);
+    }
+}
+
+const QList<FaceTrack> &FaceTrackTable::GetTracks() const
+{
+    return m_tracks;
+}
+
+const FaceTrack *FaceTrackTable::Find(int id) const
+{
+    for(int i = 0; i < m_tracks.size(); i++)
+    {
+        if(m_tracks[i].id == id)
+            return &m_tracks[i];
+    }
+    return NULL;
+}
+
+int FaceTrackTable::FindClosest(const QPoint &point) const
+{
+    int bestId = -1;
+    int bestDistanceSquared = 0;
+    for(int i = 0; i < m_tracks.size(); i++)
+    {
+        const FaceTrack &track = m_tracks[i];
+        if(track.missed > 0 || !IsConfirmed(track))
+            continue;
+
+        QPoint delta = track.rect.center() - point;
+        int distanceSquared = delta.x()*delta.x() + delta.y()*delta.y();
+        if(bestId < 0 || distanceSquared < bestDistanceSquared)
+        {
+            bestId = track.id;
+            bestDistanceSquared = distanceSquared;
+        }
+    }
+    return bestId;
+}
+
+bool FaceTrackTable::IsConfirmed(const FaceTrack &track) const
+{
+    return track.hits >= m_minHits;
+}
+
+int FaceTrackTable::GetMaxMissed() const
+{
+    return m_maxMissed;
+}
+
+void FaceTrackTable::SetMaxMissed(int maxMissed)
+{
+    m_maxMissed = (maxMissed < 0) ? 0 : maxMissed;
+}
+
+int FaceTrackTable::GetMinHits() const
+{
+    return m_minHits;
+}
+
+void FaceTrackTable::SetMinHits(int minHits)
+{
+    m_minHits = (minHits < 1) ? 1 : minHits;
+}
+
+float FaceTrackTable::GetMatchThreshold() const
+{
+    return m_matchThreshold;
+}
+
+void FaceTrackTable::SetMatchThreshold(float threshold)
+{
+    m_matchThreshold = threshold;
+}
+
+float FaceTrackTable::MatchCost(const QRect &prediction, const cv::Rect &detection)
+{
+    cv::Rect predicted(prediction.x(), prediction.y(), prediction.width(), prediction.height());
+    int intersection = (predicted & detection).area();
+    int unionArea = predicted.area() + detection.area() - intersection;
+    float iou = unionArea > 0 ? (float)intersection/unionArea : 0.0f;
+
+    float dX = (predicted.x + predicted.width*0.5f) - (detection.x + detection.width*0.5f);
+    float dY = (predicted.y + predicted.height*0.5f) - (detection.y + detection.height*0.5f);
+    float size = (float)std::max(1, std::max(predicted.width, predicted.height));
+
+    return (1.0f - iou) + std::sqrt(dX*dX + dY*dY)/size;
+}
+
+void FaceTrackTable::Correct(FaceTrack &track, const QRect &rect)
+{
+    //Spread the movement over the updates the face went unseen
+    QPointF movement = QPointF(rect.center() - track.rect.center())/(track.missed + 1);
+    track.velocity = track.velocity*0.5 + movement*0.5;
+    track.rect = rect;
+    track.hits++;
+    track.missed = 0;
+}
@@ -0,0 +1,118 @@
+/*! \file facetracktable.h
+    \brief Defines the table of faces followed from frame to frame
+
+    \sa FaceTrackTable, FaceTracker
+*/
+
+#ifndef FACETRACKTABLE_H
+#define FACETRACKTABLE_H
+
+#include <opencv2/opencv.hpp>
+#include <QList>
+#include <QRect>
+#include <QPointF>
+#include <vector>
+
+//! \brief Default number of consecutive updates a face may go undetected before its track is dropped
+#define DEFAULT_TRACK_MAX_MISSED        10
+//! \brief Default number of detections before a track is reported
+#define DEFAULT_TRACK_MIN_HITS          2
+//! \brief Default highest cost at which a detection is matched to a track, see FaceTrackTable::MatchCost
+#define DEFAULT_TRACK_MATCH_THRESHOLD   1.5f
+
+//! \brief One face followed by FaceTrackTable
+struct FaceTrack
+{
+    FaceTrack();
+
+    int id;             //!< Unique for the lifetime of the table, never reused
+    QRect rect;         //!< Bounding rectangle at the last update
+    QPointF velocity;   //!< Smoothed movement of the center per update
+    int age;            //!< Updates since the track was created
+    int hits;           //!< Updates the face was found in
+    int missed;         //!< Consecutive updates the face was not detected in, 0 if detected in the last one
+};
+
+/*! \brief Gives detected faces identities that persist from frame to frame.
+
+  Every update, each track is moved by its velocity and the detections are
+  matched against these predictions. The cost of a pair (see
+  FaceTrackTable::MatchCost) combines their overlap and the distance of their
+  centers; pairs are assigned greedily from the cheapest. That is not an optimal
+  assignment, but with the handful of faces in view it rarely differs from
+  one and is much simpler. Unmatched detections start new tracks, tracks
+  that go unmatched for more than FaceTrackTable::GetMaxMissed updates are
+  dropped.
+
+  Tracks outside the area a detection pass searched are left untouched, so
+  region of interest searches do not age out the faces they could not see.
+*/
+class FaceTrackTable
+{
+public:
+    FaceTrackTable();
+
+    /*! \brief Matches the detections of one frame against the tracks
+      \param detections Faces detected in the frame
+      \param searchArea Area of the frame that was searched
+    */
+    void Update(const std::vector<cv::Rect> &detections, const cv::Rect &searchArea);
+
+    /*! \brief Moves the track \a id to \a rect without a detection pass
+      Used for positions found by other means, e.g. template matching.
+      \returns false if there is no such track
+    */
+    bool Correct(int id, const QRect &rect);
+
+    //! \brief Removes all tracks
+    void Clear();
+
+    //! \brief Scales the rectangles and velocities of all tracks, used when the image resolution changes
+    void Scale(double scaleX, double scaleY);
+
+    //! \brief Returns all tracks, including ones that were detected fewer than FaceTrackTable::GetMinHits times
+    const QList<FaceTrack> &GetTracks() const;
+
+    //! \brief Returns the track \a id, NULL if there is no such track
+    const FaceTrack *Find(int id) const;
+
+    /*! \brief Returns the ID of the reported track detected in the last update whose center is closest to \a point
+      \returns -1 if there is no such track
+    */
+    int FindClosest(const QPoint &point) const;
+
+    //! \brief Returns true if \a track has been detected often enough to be reported
+    bool IsConfirmed(const FaceTrack &track) const;
+
+    //! \brief Getter for the number of updates a face may go undetected
+    int GetMaxMissed() const;
+    //! \brief Setter for the number of updates a face may go undetected
+    void SetMaxMissed(int maxMissed);
+    //! \brief Getter for the number of detections before a track is reported
+    int GetMinHits() const;
+    //! \brief Setter for the number of detections before a track is reported
+    void SetMinHits(int minHits);
+    //! \brief Getter for the highest cost at which a detection is matched to a track
+    float GetMatchThreshold() const;
+    //! \brief Setter for the highest cost at which a detection is matched to a track
+    void SetMatchThreshold(float threshold);
+
+    /*! \brief Cost of explaining \a detection by a track predicted at \a prediction
+      (1 - intersection over union) plus the distance of the centers in units
+      of the predicted face size. The same face in consecutive frames costs
+      well below 1, neighbouring faces cost 2 and more.
+    */
+    static float MatchCost(const QRect &prediction, const cv::Rect &detection);
+
+private:
+    //! \brief Moves \a track to \a rect and updates its velocity
+    static void Correct(FaceTrack &track, const QRect &rect);
+
+    QList<FaceTrack> m_tracks;
+    int m_nextId;           //!< ID of the next new track
+    int m_maxMissed;
+    int m_minHits;
+    float m_matchThreshold;
+};
+
+#endif // FACETRACKTABLE_H
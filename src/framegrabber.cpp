@@ -0,0 +1,232 @@
+#include "framegrabber.h"
+#include "metrics.h"
+#include <QElapsedTimer>
+#if defined(DEBUG_QTHREADS)
+#include <QDebug>
+#endif
+
+FrameGrabber::FrameGrabber(QObject *parent) :
+    QThread(parent), m_source(NULL), m_backIndex(0), m_frontIndex(1), m_middleState(2),
+    m_requestedDimensions(0), m_stopRequested(0), m_endOfStream(0),
+    m_dropFrames(true), m_sharedMemoryNameChanged(false)
+{
+    for(int i = 0; i < 3; i++)
+        m_timestamps[i] = 0;
+}
+
+FrameGrabber::~FrameGrabber()
+{
+    Stop();
+    delete m_source;
+}
+
+bool FrameGrabber::Open(int deviceID)
+{
+    return Open(new CameraFrameSource(deviceID));
+}
+
+bool FrameGrabber::Open(const std::string &uri)
+{
+    FrameSource *source = FrameSource::Create(uri);
+    if(!source)
+        return false;
+    return Open(source);
+}
+
+bool FrameGrabber::Open(FrameSource *source)
+{
+    delete m_source;
+    m_source = source;
+    m_dropFrames = source->IsLive();
+    m_endOfStream.fetchAndStoreOrdered(0);
+    return source->IsOpened();
+}
+
+bool FrameGrabber::IsOpened() const
+{
+    return m_source && m_source->IsOpened();
+}
+
+void FrameGrabber::SetFrameDropping(bool enable)
+{
+    m_dropFrames = enable;
+}
+
+bool FrameGrabber::IsEndOfStream() const
+{
+    return m_endOfStream != 0;
+}
+
+void FrameGrabber::SetFrameDimensions(int width, int height)
+{
+    m_requestedDimensions.fetchAndStoreOrdered(((width & 0xFFFF) << 16) | (height & 0xFFFF));
+
+    //Nobody else is touching the device yet, apply right away
+    if(!isRunning())
+        ApplyRequestedDimensions();
+}
+
+void FrameGrabber::SetSharedMemoryName(const std::string &name)
+{
+    QMutexLocker locker(&m_publishMutex);
+    m_requestedSharedMemoryName = name;
+    m_sharedMemoryNameChanged = true;
+}
+
+bool FrameGrabber::GetLatestFrame(cv::Mat &frame, unsigned long timeoutMs, qint64 *timestamp)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    forever
+    {
+        int state = m_middleState;
+        if(state & FreshFrameFlag)
+        {
+            //Hand our front buffer back and take the fresh one
+            if(m_middleState.testAndSetOrdered(state, m_frontIndex))
+            {
+                m_frontIndex = state & IndexMask;
+                frame = m_buffers[m_frontIndex];
+                if(timestamp)
+                    *timestamp = m_timestamps[m_frontIndex];
+
+                if(!m_dropFrames)
+                {
+                    m_frameMutex.lock();
+                    m_frameRetrieved.wakeAll();
+                    m_frameMutex.unlock();
+                }
+                return true;
+            }
+            continue;
+        }
+
+        qint64 remaining = (qint64)timeoutMs - timer.elapsed();
+        if(remaining <= 0 || !isRunning() || m_endOfStream)
+            return false;
+
+        m_frameMutex.lock();
+        if(!(((int)m_middleState) & FreshFrameFlag))
+            m_frameAvailable.wait(&m_frameMutex, (unsigned long)remaining);
+        m_frameMutex.unlock();
+    }
+}
+
+qint64 FrameGrabber::Timestamp()
+{
+    //QElapsedTimer reads the monotonic clock, its reference point is the same for every timer
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+void FrameGrabber::Stop()
+{
+    m_stopRequested.fetchAndStoreOrdered(1);
+    if(isRunning())
+        wait();
+    m_stopRequested.fetchAndStoreOrdered(0);
+}
+
+void FrameGrabber::run()
+{
+#ifdef DEBUG_QTHREADS
+    qDebug() << "FrameGrabber::run(): capture loop started";
+#endif
+    QElapsedTimer timer;
+    while(!m_stopRequested && m_source)
+    {
+        ApplyRequestedDimensions();
+
+        cv::Mat &target = m_buffers[m_backIndex];
+        //Someone still holds on to this buffer, let the capture allocate a new one
+        if(target.refcount && *target.refcount > 1)
+            target.release();
+
+        timer.start();
+        if(!m_source->Read(target) || target.empty())
+        {
+            if(m_source->IsEndOfStream())
+            {
+                m_endOfStream.fetchAndStoreOrdered(1);
+                break;
+            }
+
+            //Source timed out, give it a moment before retrying
+            msleep(5);
+            continue;
+        }
+        Metrics::RecordElapsed(Metrics::CaptureTime, timer);
+        m_timestamps[m_backIndex] = Timestamp();
+
+        PublishToSharedMemory(target);
+        PublishBackBuffer();
+        if(!m_dropFrames)
+            WaitUntilRetrieved();
+    }
+
+    //Readers of the ring see the end of the stream
+    m_publisher.Close();
+
+    //Do not leave a consumer waiting for a frame that will never come
+    m_frameMutex.lock();
+    m_frameAvailable.wakeAll();
+    m_frameMutex.unlock();
+#ifdef DEBUG_QTHREADS
+    qDebug() << "FrameGrabber::run(): capture loop complete";
+#endif
+}
+
+void FrameGrabber::ApplyRequestedDimensions()
+{
+    int dimensions = m_requestedDimensions.fetchAndStoreOrdered(0);
+    int width = (dimensions >> 16) & 0xFFFF;
+    int height = dimensions & 0xFFFF;
+    if(width <= 0 || height <= 0 || !m_source)
+        return;
+
+    m_source->SetFrameDimensions(width, height);
+}
+
+void FrameGrabber::PublishBackBuffer()
+{
+    int previous = m_middleState.fetchAndStoreOrdered(m_backIndex | FreshFrameFlag);
+    m_backIndex = previous & IndexMask;
+
+    m_frameMutex.lock();
+    m_frameAvailable.wakeAll();
+    m_frameMutex.unlock();
+}
+
+void FrameGrabber::PublishToSharedMemory(const cv::Mat &frame)
+{
+    m_publishMutex.lock();
+    if(m_sharedMemoryNameChanged)
+    {
+        m_publisher.Close();
+        m_sharedMemoryName = m_requestedSharedMemoryName;
+        m_sharedMemoryNameChanged = false;
+    }
+    m_publishMutex.unlock();
+
+    if(m_sharedMemoryName.empty())
+        return;
+
+    //The ring only takes frames of the size it was created for
+    if(m_publisher.Publish(frame))
+        return;
+    if(m_publisher.Create(m_sharedMemoryName, frame.cols, frame.rows, frame.type()))
+        m_publisher.Publish(frame);
+    else
+        m_sharedMemoryName.clear();     //Do not retry the same failure every frame
+}
+
+void FrameGrabber::WaitUntilRetrieved()
+{
+    m_frameMutex.lock();
+    //The timeout only bounds how long a stop request can go unnoticed
+    while(!m_stopRequested && (((int)m_middleState) & FreshFrameFlag))
+        m_frameRetrieved.wait(&m_frameMutex, 100);
+    m_frameMutex.unlock();
+}
@@ -0,0 +1,181 @@
+/*! \file framegrabber.h
+    \brief Defines the background capture stage used by FaceTracker
+
+    Capturing a frame from a V4L device blocks for the better part of a frame
+    period. FrameGrabber moves that wait onto its own thread so face detection
+    never has to sit behind the driver.
+    \sa FrameGrabber, FaceTracker
+*/
+
+#ifndef FRAMEGRABBER_H
+#define FRAMEGRABBER_H
+
+#include "framesource.h"
+#include "sharedmemoryframesource.h"
+#include <QThread>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+
+//! \brief Default time (ms) FrameGrabber::GetLatestFrame waits for a new frame
+#define DEFAULT_FRAME_WAIT_TIMEOUT      1000
+
+/*! \brief Continuously captures frames on a dedicated thread.
+
+  FrameGrabber owns a FrameSource and keeps pulling frames from it as fast as
+  the source delivers them. Captured frames are handed over through a
+  lock-free triple buffer: the capture thread always writes into a private back
+  buffer and publishes it by atomically swapping it with the shared middle slot.
+  The consumer swaps the middle slot with its own front buffer when it wants a
+  frame. The newest frame always wins; frames the consumer did not get to in
+  time are overwritten instead of queued.
+
+  Only one consumer thread may call FrameGrabber::GetLatestFrame.
+
+  Frames are only dropped for live sources (see FrameSource::IsLive). For
+  other sources the capture thread waits for every frame to be retrieved
+  before reading the next one, and stops at the end of the stream.
+
+  Captured frames can also be published to other processes through a
+  SharedMemoryFramePublisher, see FrameGrabber::SetSharedMemoryName.
+
+  <b> Typical Use Case </b>
+  \code
+  FrameGrabber grabber;
+  if(grabber.Open(0))
+  {
+        grabber.start();
+        cv::Mat frame;
+        while(grabber.GetLatestFrame(frame))
+        {
+            // Process frame...
+        }
+  }
+  \endcode
+*/
+class FrameGrabber : public QThread
+{
+    Q_OBJECT
+public:
+    //! \brief Default constructor
+    explicit FrameGrabber(QObject *parent = 0);
+
+    //! \brief Stops the capture thread and releases the device
+    ~FrameGrabber();
+
+    /*! \brief Opens the capture device
+      \param deviceID Device to be used for VideoCapture
+      \returns true if the device was opened
+    */
+    bool Open(int deviceID);
+
+    /*! \brief Opens a frame source by URI
+      \param uri See FrameSource::Create, e.g. "face.avi" or "synthetic:640x480"
+      \returns true if the source was opened
+    */
+    bool Open(const std::string &uri);
+
+    /*! \brief Captures from \a source
+      Must not be called while the capture thread is running. Frame dropping is
+      enabled for live sources and disabled otherwise.
+      \param source Source to capture from, the grabber takes ownership
+      \returns true if the source is open
+    */
+    bool Open(FrameSource *source);
+
+    //! \brief Returns true if the frame source is open
+    bool IsOpened() const;
+
+    /*! \brief Enables or disables dropping of frames the consumer did not retrieve in time
+      FrameGrabber::Open picks the right mode for the source, this overrides it.
+    */
+    void SetFrameDropping(bool enable = true);
+
+    /*! \brief Returns true once the source has been read completely
+      Live sources usually never reach the end of the stream.
+    */
+    bool IsEndOfStream() const;
+
+    /*! \brief Requests a new capture resolution
+      Safe to call while the capture thread is running, the new dimensions are
+      applied before the next frame is captured.
+    */
+    void SetFrameDimensions(int width, int height);
+
+    /*! \brief Publishes every captured frame to the shared memory ring \a name
+      Other processes read the frames with SharedMemoryFrameSource ("shm:" URIs)
+      instead of opening the camera themselves. The ring is created on the next
+      captured frame and recreated when the frame size changes. Safe to call
+      while the capture thread is running.
+      \param name POSIX shared memory name, e.g. "/lockheed-camera", empty to stop publishing
+    */
+    void SetSharedMemoryName(const std::string &name);
+
+    /*! \brief Retrieves the newest frame that has not been retrieved yet
+
+      If no new frame has been published since the last call, the function
+      waits for one for at most \a timeoutMs milliseconds.
+      \param frame [out] The newest frame, left untouched on timeout
+      \param timeoutMs Maximum time to wait for a new frame
+      \param timestamp [out] If not NULL, receives the time the frame was
+             captured, see FrameGrabber::Timestamp
+      \returns true if a new frame was retrieved
+      \note The frame data is owned by the grabber and remains valid until the
+            next call to this function.
+    */
+    bool GetLatestFrame(cv::Mat &frame, unsigned long timeoutMs = DEFAULT_FRAME_WAIT_TIMEOUT,
+                        qint64 *timestamp = NULL);
+
+    /*! \brief Returns the current time (ms) on the monotonic clock frames are stamped with
+      Only differences between timestamps are meaningful.
+    */
+    static qint64 Timestamp();
+
+    //! \brief Stops the capture thread and waits for it to finish
+    void Stop();
+
+protected:
+    //! \brief Capture loop
+    void run();
+
+private:
+    //! \brief Applies dimensions requested through FrameGrabber::SetFrameDimensions
+    void ApplyRequestedDimensions();
+
+    //! \brief Publishes the back buffer as the newest frame
+    void PublishBackBuffer();
+
+    //! \brief Copies \a frame into the shared memory ring, if one was requested
+    void PublishToSharedMemory(const cv::Mat &frame);
+
+    //! \brief Blocks the capture thread until the published frame was retrieved
+    void WaitUntilRetrieved();
+
+    FrameSource *m_source;      //!< Source frames are acquired from
+
+    cv::Mat m_buffers[3];       //!< Triple buffer storage
+    qint64 m_timestamps[3];     //!< Capture time of the frame in each buffer, travels with it
+    int m_backIndex;            //!< Buffer owned by the capture thread
+    int m_frontIndex;           //!< Buffer owned by the consumer
+    QAtomicInt m_middleState;   //!< Index of the shared buffer, ORed with FreshFrameFlag when unread
+
+    QAtomicInt m_requestedDimensions;   //!< Pending capture size packed as (width << 16 | height), 0 if none
+    QAtomicInt m_stopRequested;         //!< Non-zero when the capture loop should exit
+    QAtomicInt m_endOfStream;           //!< Non-zero once the source ran out of frames
+    bool m_dropFrames;                  //!< Overwrite frames the consumer did not retrieve in time
+
+    QMutex m_frameMutex;                //!< Only guards m_frameAvailable, never the frame data
+    QWaitCondition m_frameAvailable;    //!< Signalled every time a frame is published
+    QWaitCondition m_frameRetrieved;    //!< Signalled every time a frame is retrieved, without frame dropping only
+
+    SharedMemoryFramePublisher m_publisher; //!< Only used by the capture thread
+    std::string m_sharedMemoryName;     //!< Name m_publisher is created with, empty if not publishing
+    std::string m_requestedSharedMemoryName;    //!< Set by FrameGrabber::SetSharedMemoryName
+    bool m_sharedMemoryNameChanged;     //!< m_requestedSharedMemoryName has not been applied yet
+    QMutex m_publishMutex;              //!< Guards the requested name
+
+    static const int FreshFrameFlag = 0x4;  //!< Marks the middle slot as unread
+    static const int IndexMask = 0x3;       //!< Extracts the buffer index from m_middleState
+};
+
+#endif // FRAMEGRABBER_H
@@ -0,0 +1,262 @@
+#include "frameprocessing.h"
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FRAMEPROCESSING_NEON 1
+#endif
+
+//Fixed point (8 bit) luma coefficients, they add up to 256
+#define GRAY_COEFF_B    29
+#define GRAY_COEFF_G    150
+#define GRAY_COEFF_R    77
+
+namespace
+{
+
+inline uchar GrayPixel(const uchar *bgr)
+{
+    return (uchar)((GRAY_COEFF_B*bgr[0] + GRAY_COEFF_G*bgr[1] + GRAY_COEFF_R*bgr[2] + 128) >> 8);
+}
+
+//! Converts \a count pixels starting at \a x, the tail not covered by the vector loops
+void ConvertPixels(const uchar *src, uchar *dst, int x, int count, int width,
+                   int channels, bool mirror, int *histogram)
+{
+    for(int end = x + count; x < end; x++)
+    {
+        uchar value = GrayPixel(src + x*channels);
+        dst[mirror ? width - 1 - x : x] = value;
+        histogram[value]++;
+    }
+}
+
+#if defined(__SSSE3__)
+//! Converts 16 BGR pixels, the gray values are returned in source order
+inline __m128i ConvertBlockBgr(const uchar *src)
+{
+    const __m128i a = _mm_loadu_si128((const __m128i*)(src));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+
+    //Deinterleave the three 16 byte loads into planar B, G and R
+    const __m128i blue = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    const __m128i green = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    const __m128i red = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coeffB = _mm_set1_epi16(GRAY_COEFF_B);
+    const __m128i coeffG = _mm_set1_epi16(GRAY_COEFF_G);
+    const __m128i coeffR = _mm_set1_epi16(GRAY_COEFF_R);
+    const __m128i rounding = _mm_set1_epi16(128);
+
+    //Largest possible sum is 255*256 + 128, which still fits in 16 unsigned bits
+    __m128i low = _mm_add_epi16(rounding, _mm_mullo_epi16(_mm_unpacklo_epi8(blue, zero), coeffB));
+    low = _mm_add_epi16(low, _mm_mullo_epi16(_mm_unpacklo_epi8(green, zero), coeffG));
+    low = _mm_add_epi16(low, _mm_mullo_epi16(_mm_unpacklo_epi8(red, zero), coeffR));
+    __m128i high = _mm_add_epi16(rounding, _mm_mullo_epi16(_mm_unpackhi_epi8(blue, zero), coeffB));
+    high = _mm_add_epi16(high, _mm_mullo_epi16(_mm_unpackhi_epi8(green, zero), coeffG));
+    high = _mm_add_epi16(high, _mm_mullo_epi16(_mm_unpackhi_epi8(red, zero), coeffR));
+
+    return _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8));
+}
+#endif
+
+//! Converts one row of a BGR frame
+void ConvertRowBgr(const uchar *src, uchar *dst, int width, bool mirror, int *histogram)
+{
+    int x = 0;
+#if defined(__SSSE3__)
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    uchar block[16];
+    for(; x + 16 <= width; x += 16)
+    {
+        __m128i gray = ConvertBlockBgr(src + 3*x);
+        if(mirror)
+        {
+            gray = _mm_shuffle_epi8(gray, reverse);
+            _mm_storeu_si128((__m128i*)(dst + width - x - 16), gray);
+        }
+        else
+            _mm_storeu_si128((__m128i*)(dst + x), gray);
+
+        _mm_storeu_si128((__m128i*)block, gray);
+        for(int i = 0; i < 16; i++)
+            histogram[block[i]]++;
+    }
+#elif defined(FRAMEPROCESSING_NEON)
+    const uint8x8_t coeffB = vdup_n_u8(GRAY_COEFF_B);
+    const uint8x8_t coeffG = vdup_n_u8(GRAY_COEFF_G);
+    const uint8x8_t coeffR = vdup_n_u8(GRAY_COEFF_R);
+    uchar block[16];
+    for(; x + 16 <= width; x += 16)
+    {
+        uint8x16x3_t bgr = vld3q_u8(src + 3*x);
+
+        uint16x8_t low = vmull_u8(vget_low_u8(bgr.val[0]), coeffB);
+        low = vmlal_u8(low, vget_low_u8(bgr.val[1]), coeffG);
+        low = vmlal_u8(low, vget_low_u8(bgr.val[2]), coeffR);
+        uint16x8_t high = vmull_u8(vget_high_u8(bgr.val[0]), coeffB);
+        high = vmlal_u8(high, vget_high_u8(bgr.val[1]), coeffG);
+        high = vmlal_u8(high, vget_high_u8(bgr.val[2]), coeffR);
+
+        //Rounding narrow adds the 128 before shifting
+        uint8x16_t gray = vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8));
+        if(mirror)
+        {
+            gray = vrev64q_u8(gray);
+            gray = vcombine_u8(vget_high_u8(gray), vget_low_u8(gray));
+            vst1q_u8(dst + width - x - 16, gray);
+        }
+        else
+            vst1q_u8(dst + x, gray);
+
+        vst1q_u8(block, gray);
+        for(int i = 0; i < 16; i++)
+            histogram[block[i]]++;
+    }
+#endif
+    ConvertPixels(src, dst, x, width - x, width, 3, mirror, histogram);
+}
+
+//! Copies the Y plane of one row of a packed YUYV frame, no color math involved
+void ConvertRowYuyv(const uchar *src, uchar *dst, int width, bool mirror, int *histogram)
+{
+    int x = 0;
+#if defined(__SSSE3__)
+    const __m128i evenBytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    uchar block[16];
+    for(; x + 16 <= width; x += 16)
+    {
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*x)), evenBytes);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 2*x + 16)), evenBytes);
+        __m128i luma = _mm_unpacklo_epi64(a, b);
+        if(mirror)
+        {
+            luma = _mm_shuffle_epi8(luma, reverse);
+            _mm_storeu_si128((__m128i*)(dst + width - x - 16), luma);
+        }
+        else
+            _mm_storeu_si128((__m128i*)(dst + x), luma);
+
+        _mm_storeu_si128((__m128i*)block, luma);
+        for(int i = 0; i < 16; i++)
+            histogram[block[i]]++;
+    }
+#elif defined(FRAMEPROCESSING_NEON)
+    uchar block[16];
+    for(; x + 16 <= width; x += 16)
+    {
+        uint8x16_t luma = vld2q_u8(src + 2*x).val[0];
+        if(mirror)
+        {
+            luma = vrev64q_u8(luma);
+            luma = vcombine_u8(vget_high_u8(luma), vget_low_u8(luma));
+            vst1q_u8(dst + width - x - 16, luma);
+        }
+        else
+            vst1q_u8(dst + x, luma);
+
+        vst1q_u8(block, luma);
+        for(int i = 0; i < 16; i++)
+            histogram[block[i]]++;
+    }
+#endif
+    for(; x < width; x++)
+    {
+        dst[mirror ? width - 1 - x : x] = src[2*x];
+        histogram[src[2*x]]++;
+    }
+}
+
+}
+
+void FrameProcessing::ConvertToGray(const cv::Mat &frame, cv::Mat &gray, bool mirror, int *histogram)
+{
+    CV_Assert(frame.depth() == CV_8U);
+
+    int localHistogram[256];
+    if(histogram == NULL)
+        histogram = localHistogram;
+    memset(histogram, 0, 256*sizeof(int));
+
+    gray.create(frame.rows, frame.cols, CV_8UC1);
+    const int channels = frame.channels();
+
+    for(int y = 0; y < frame.rows; y++)
+    {
+        const uchar *src = frame.ptr<uchar>(y);
+        uchar *dst = gray.ptr<uchar>(y);
+
+        if(channels == 3)
+            ConvertRowBgr(src, dst, frame.cols, mirror, histogram);
+        else if(channels == 2)
+            ConvertRowYuyv(src, dst, frame.cols, mirror, histogram);
+        else if(channels == 4)
+            ConvertPixels(src, dst, 0, frame.cols, frame.cols, 4, mirror, histogram);
+        else
+        {
+            for(int x = 0; x < frame.cols; x++)
+            {
+                dst[mirror ? frame.cols - 1 - x : x] = src[x*channels];
+                histogram[src[x*channels]]++;
+            }
+        }
+    }
+}
+
+void FrameProcessing::EqualizeHistogram(cv::Mat &gray, const int *histogram)
+{
+    CV_Assert(gray.type() == CV_8UC1);
+
+    const int total = gray.rows*gray.cols;
+    if(total == 0)
+        return;
+
+    //Same lookup table as cv::equalizeHist()
+    int first = 0;
+    while(histogram[first] == 0)
+        first++;
+
+    if(histogram[first] == total)
+    {
+        gray.setTo(cv::Scalar(first));
+        return;
+    }
+
+    uchar lut[256];
+    float scale = 255.f/(total - histogram[first]);
+    int sum = 0;
+    memset(lut, 0, sizeof(lut));
+    for(int i = first + 1; i < 256; i++)
+    {
+        sum += histogram[i];
+        lut[i] = cv::saturate_cast<uchar>(sum*scale);
+    }
+
+    for(int y = 0; y < gray.rows; y++)
+    {
+        uchar *row = gray.ptr<uchar>(y);
+        for(int x = 0; x < gray.cols; x++)
+            row[x] = lut[row[x]];
+    }
+}
+
+void FrameProcessing::PrepareDetectionImage(const cv::Mat &frame, cv::Mat &gray, bool mirror)
+{
+    int histogram[256];
+    ConvertToGray(frame, gray, mirror, histogram);
+    EqualizeHistogram(gray, histogram);
+}
@@ -0,0 +1,54 @@
+/*! \file frameprocessing.h
+    \brief Defines the image preprocessing kernels used before face detection
+
+    The kernels read a captured frame once and produce the grayscale,
+    histogram equalized image the cascade classifier works on. Vectorized
+    paths are used when the compiler targets SSSE3 (x86) or NEON (ARM), a
+    scalar path is used otherwise. All paths produce identical results.
+    \sa FaceTracker::GetProcessReadyWebcamImage
+*/
+
+#ifndef FRAMEPROCESSING_H
+#define FRAMEPROCESSING_H
+
+#include <opencv2/opencv.hpp>
+
+namespace FrameProcessing
+{
+
+/*! \brief Converts a frame to grayscale and builds its histogram in a single pass
+
+  Gray levels are computed as (29*B + 150*G + 77*R + 128) >> 8, which is
+  within one level of cv::cvtColor(CV_BGR2GRAY). Two channel frames are
+  packed YUYV (see V4L2FrameSource), their Y plane is copied as is.
+  \param frame 8 bit BGR, BGRA, YUYV or grayscale frame
+  \param gray [out] Grayscale image, reallocated only if its size changes
+  \param mirror Mirror the image horizontally while converting
+  \param histogram [out] If not NULL, receives the 256 bin histogram of \a gray
+*/
+void ConvertToGray(const cv::Mat &frame, cv::Mat &gray, bool mirror, int *histogram = NULL);
+
+/*! \brief Equalizes the histogram of a grayscale image in place
+
+  Produces the same result as cv::equalizeHist() but takes the histogram
+  collected by FrameProcessing::ConvertToGray instead of a second pass over
+  the image to compute it.
+  \param gray 8 bit grayscale image
+  \param histogram 256 bin histogram of \a gray
+*/
+void EqualizeHistogram(cv::Mat &gray, const int *histogram);
+
+/*! \brief Fused flip, grayscale conversion and histogram equalization
+
+  Equivalent to cv::flip(), cv::cvtColor() and cv::equalizeHist() but the
+  frame is read only once and never written to.
+  \param frame 8 bit BGR, BGRA, YUYV or grayscale frame
+  \param gray [out] Equalized grayscale image
+  \param mirror Mirror the image horizontally. Consumers that only need
+         mirrored coordinates should pass false and mirror the coordinates.
+*/
+void PrepareDetectionImage(const cv::Mat &frame, cv::Mat &gray, bool mirror);
+
+}
+
+#endif // FRAMEPROCESSING_H
@@ -0,0 +1,364 @@
+#include "framesource.h"
+#include "sharedmemoryframesource.h"
+#include "v4l2framesource.h"
+#include <QDir>
+#include <QFileInfo>
+#include <cmath>
+#include <unistd.h>
+
+namespace
+{
+//! Parses "WxH", returns false if \a text is not a valid size
+bool ParseSize(const QString &text, int &width, int &height)
+{
+    QStringList parts = text.split('x');
+    if(parts.size() != 2)
+        return false;
+
+    bool widthOk, heightOk;
+    width = parts[0].toInt(&widthOk);
+    height = parts[1].toInt(&heightOk);
+    return widthOk && heightOk && width > 0 && height > 0;
+}
+
+FrameSource *CreateSynthetic(const QString &description)
+{
+    int width = DEFAULT_SYNTHETIC_WIDTH;
+    int height = DEFAULT_SYNTHETIC_HEIGHT;
+    double fps = 0;
+    int frames = 0;
+    QString face;
+
+    QString size = description.section('?', 0, 0);
+    if(!size.isEmpty() && !ParseSize(size, width, height))
+        return NULL;
+
+    QStringList options = description.section('?', 1).split('&', QString::SkipEmptyParts);
+    foreach(const QString &option, options)
+    {
+        QString key = option.section('=', 0, 0);
+        QString value = option.section('=', 1);
+        bool ok = true;
+        if(key == "fps")
+            fps = value.toDouble(&ok);
+        else if(key == "frames")
+            frames = value.toInt(&ok);
+        else if(key == "face")
+            face = value;
+        else
+            ok = false;
+
+        if(!ok)
+            return NULL;
+    }
+
+    return new SyntheticFrameSource(width, height, fps, frames, face.toStdString());
+}
+
+FrameSource *CreateV4L2(const QString &description)
+{
+    int buffers = DEFAULT_V4L2_BUFFER_COUNT;
+    int timeout = DEFAULT_V4L2_TIMEOUT;
+    V4L2FrameSource::PixelFormat format = V4L2FrameSource::AnyFormat;
+
+    QString device = description.section('?', 0, 0);
+    if(device.isEmpty())
+        device = "/dev/video0";
+
+    QStringList options = description.section('?', 1).split('&', QString::SkipEmptyParts);
+    foreach(const QString &option, options)
+    {
+        QString key = option.section('=', 0, 0);
+        QString value = option.section('=', 1);
+        bool ok = true;
+        if(key == "buffers")
+            buffers = value.toInt(&ok);
+        else if(key == "timeout")
+            timeout = value.toInt(&ok);
+        else if(key == "format" && value == "yuyv")
+            format = V4L2FrameSource::YuyvFormat;
+        else if(key == "format" && value == "mjpeg")
+            format = V4L2FrameSource::MjpegFormat;
+        else
+            ok = false;
+
+        if(!ok)
+            return NULL;
+    }
+
+    return new V4L2FrameSource(device.toStdString(), buffers, timeout, format);
+}
+}
+
+FrameSource::~FrameSource()
+{
+}
+
+bool FrameSource::IsEndOfStream() const
+{
+    return false;
+}
+
+void FrameSource::SetFrameDimensions(int width, int height)
+{
+    Q_UNUSED(width);
+    Q_UNUSED(height);
+}
+
+FrameSource *FrameSource::Create(const std::string &uri)
+{
+    QString text(uri.c_str());
+    QString scheme = text.section(':', 0, 0);
+    QString location = text.section(':', 1);
+
+    if(!text.contains(':'))
+    {
+        //No scheme, guess from what the text refers to
+        bool isNumber;
+        int deviceID = text.toInt(&isNumber);
+        if(isNumber)
+            return new CameraFrameSource(deviceID);
+        if(QFileInfo(text).isDir())
+            return new ImageDirectoryFrameSource(uri);
+        return new VideoFileFrameSource(uri);
+    }
+
+    if(scheme == "camera")
+    {
+        bool isNumber;
+        int deviceID = location.toInt(&isNumber);
+        return isNumber ? new CameraFrameSource(deviceID) : NULL;
+    }
+    if(scheme == "file")
+        return new VideoFileFrameSource(location.toStdString());
+    if(scheme == "dir")
+        return new ImageDirectoryFrameSource(location.toStdString());
+    if(scheme == "synthetic")
+        return CreateSynthetic(location);
+    if(scheme == "v4l2")
+        return CreateV4L2(location);
+    if(scheme == "shm")
+        return new SharedMemoryFrameSource(location.toStdString());
+
+    //Anything else, e.g. an RTSP stream, is left to cv::VideoCapture
+    return new VideoFileFrameSource(uri);
+}
+
+CameraFrameSource::CameraFrameSource(int deviceID)
+{
+    m_vc.open(deviceID);
+}
+
+CameraFrameSource::~CameraFrameSource()
+{
+    m_vc.release();
+}
+
+bool CameraFrameSource::IsOpened() const
+{
+    return m_vc.isOpened();
+}
+
+bool CameraFrameSource::IsLive() const
+{
+    return true;
+}
+
+bool CameraFrameSource::Read(cv::Mat &frame)
+{
+    m_vc >> frame;
+    return !frame.empty();
+}
+
+void CameraFrameSource::SetFrameDimensions(int width, int height)
+{
+    m_vc.set(CV_CAP_PROP_FRAME_WIDTH, width);
+    m_vc.set(CV_CAP_PROP_FRAME_HEIGHT, height);
+}
+
+VideoFileFrameSource::VideoFileFrameSource(const std::string &filename) :
+    m_endOfStream(false)
+{
+    m_vc.open(filename);
+}
+
+VideoFileFrameSource::~VideoFileFrameSource()
+{
+    m_vc.release();
+}
+
+bool VideoFileFrameSource::IsOpened() const
+{
+    return m_vc.isOpened();
+}
+
+bool VideoFileFrameSource::IsLive() const
+{
+    return false;
+}
+
+bool VideoFileFrameSource::Read(cv::Mat &frame)
+{
+    m_vc >> frame;
+    m_endOfStream = frame.empty();
+    return !m_endOfStream;
+}
+
+bool VideoFileFrameSource::IsEndOfStream() const
+{
+    return m_endOfStream;
+}
+
+ImageDirectoryFrameSource::ImageDirectoryFrameSource(const std::string &directory) :
+    m_next(0)
+{
+    QDir dir(QString(directory.c_str()));
+    QStringList filters;
+    filters << "*.png" << "*.jpg" << "*.jpeg" << "*.bmp" << "*.pgm" << "*.ppm" << "*.tif" << "*.tiff";
+
+    QStringList names = dir.entryList(filters, QDir::Files, QDir::Name);
+    foreach(const QString &name, names)
+        m_files.append(dir.absoluteFilePath(name));
+}
+
+bool ImageDirectoryFrameSource::IsOpened() const
+{
+    return !m_files.isEmpty();
+}
+
+bool ImageDirectoryFrameSource::IsLive() const
+{
+    return false;
+}
+
+bool ImageDirectoryFrameSource::Read(cv::Mat &frame)
+{
+    //Unreadable files are skipped rather than ending the sequence early
+    while(m_next < m_files.size())
+    {
+        frame = cv::imread(m_files[m_next++].toStdString(), 1);
+        if(!frame.empty())
+            return true;
+    }
+    return false;
+}
+
+bool ImageDirectoryFrameSource::IsEndOfStream() const
+{
+    return m_next >= m_files.size();
+}
+
+SyntheticFrameSource::SyntheticFrameSource(int width, int height, double fps,
+                                           int frameCount, const std::string &faceFilename) :
+    m_size(width, height), m_fps(fps), m_frameCount(frameCount), m_generated(0)
+{
+    if(!faceFilename.empty())
+        m_face = cv::imread(faceFilename, 1);
+    if(m_face.empty())
+    {
+        m_face.create(256, 256, CV_8UC3);
+        DrawFace(m_face);
+    }
+
+    CreateBackground();
+    m_clock.start();
+}
+
+bool SyntheticFrameSource::IsOpened() const
+{
+    return !m_background.empty();
+}
+
+bool SyntheticFrameSource::IsLive() const
+{
+    return m_fps > 0;
+}
+
+bool SyntheticFrameSource::Read(cv::Mat &frame)
+{
+    if(IsEndOfStream())
+        return false;
+
+    if(m_fps > 0)
+    {
+        qint64 due = (qint64)(m_generated*1000/m_fps);
+        qint64 wait = due - m_clock.elapsed();
+        if(wait > 0)
+            usleep(wait*1000);
+    }
+
+    //Slow, incommensurate periods so the path does not repeat quickly
+    double t = m_generated/30.0;
+    int maxFace = std::min(m_size.width, m_size.height)/2;
+    int faceSize = cvRound(maxFace*(0.75 + 0.25*std::sin(2*CV_PI*t/11)));
+    int centerX = cvRound(m_size.width/2 + 0.8*(m_size.width - maxFace)/2*std::sin(2*CV_PI*t/7));
+    int centerY = cvRound(m_size.height/2 + 0.6*(m_size.height - maxFace)/2*std::sin(2*CV_PI*t/5));
+
+    cv::Rect face(centerX - faceSize/2, centerY - faceSize/2, faceSize,
+                  faceSize*m_face.rows/m_face.cols);
+    face &= cv::Rect(0, 0, m_size.width, m_size.height);
+
+    m_background.copyTo(frame);
+    if(face.area() > 0)
+    {
+        cv::resize(m_face, m_scaledFace, face.size(), 0, 0, cv::INTER_AREA);
+        m_scaledFace.copyTo(frame(face));
+    }
+
+    m_faceRect.setRect(face.x, face.y, face.width, face.height);
+    m_generated++;
+    return true;
+}
+
+bool SyntheticFrameSource::IsEndOfStream() const
+{
+    return m_frameCount > 0 && m_generated >= m_frameCount;
+}
+
+void SyntheticFrameSource::SetFrameDimensions(int width, int height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    m_size = cv::Size(width, height);
+    CreateBackground();
+}
+
+QRect SyntheticFrameSource::GetFaceRect() const
+{
+    return m_faceRect;
+}
+
+void SyntheticFrameSource::CreateBackground()
+{
+    m_background.create(m_size, CV_8UC3);
+    for(int y = 0; y < m_size.height; y++)
+    {
+        uchar level = (uchar)(80 + 100*y/m_size.height);
+        m_background.row(y).setTo(cv::Scalar(level, level - 20, level - 40));
+    }
+
+    //Fixed seed, every run generates the same frames
+    cv::Mat noise(m_size, CV_8UC3);
+    cv::RNG rng(0x4C494E41);
+    rng.fill(noise, cv::RNG::UNIFORM, 0, 24);
+    m_background += noise;
+}
+
+void SyntheticFrameSource::DrawFace(cv::Mat &face)
+{
+    const int size = face.cols;
+    const cv::Scalar skin(150, 175, 215);
+    const cv::Scalar dark(40, 40, 50);
+
+    face.setTo(cv::Scalar(120, 120, 120));
+    cv::ellipse(face, cv::Point(size/2, size/2), cv::Size(size*3/8, size/2 - 4), 0, 0, 360, skin, -1);
+
+    //Eyebrows, eyes, nose and mouth at roughly human proportions
+    cv::line(face, cv::Point(size*5/16, size*3/8), cv::Point(size*7/16, size*11/32), dark, size/32);
+    cv::line(face, cv::Point(size*9/16, size*11/32), cv::Point(size*11/16, size*3/8), dark, size/32);
+    cv::ellipse(face, cv::Point(size*3/8, size*7/16), cv::Size(size/14, size/28), 0, 0, 360, dark, -1);
+    cv::ellipse(face, cv::Point(size*5/8, size*7/16), cv::Size(size/14, size/28), 0, 0, 360, dark, -1);
+    cv::line(face, cv::Point(size/2, size*15/32), cv::Point(size/2, size*5/8), cv::Scalar(110, 130, 170), size/40);
+    cv::ellipse(face, cv::Point(size/2, size*23/32), cv::Size(size/8, size/24), 0, 0, 180, dark, size/40);
+}
@@ -0,0 +1,173 @@
+/*! \file framesource.h
+    \brief Defines the interface FrameGrabber captures frames through
+
+    \sa FrameSource, FrameGrabber
+*/
+
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <opencv2/opencv.hpp>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QRect>
+#include <string>
+
+//! \brief Default frame size of SyntheticFrameSource
+#define DEFAULT_SYNTHETIC_WIDTH         640
+//! \brief Default frame size of SyntheticFrameSource
+#define DEFAULT_SYNTHETIC_HEIGHT        480
+
+/*! \brief Source of BGR frames consumed by FrameGrabber.
+
+  Live sources (cameras, shared memory) produce frames at their own pace,
+  frames the consumer does not keep up with are dropped. Other sources (files,
+  generated frames) are read frame by frame and can end.
+
+  Sources are usually created from a URI with FrameSource::Create:
+  <table>
+  <tr><td>\c camera:0 or \c 0</td><td>CameraFrameSource</td></tr>
+  <tr><td>\c v4l2:/dev/video0?buffers=4&timeout=2000&format=yuyv</td><td>V4L2FrameSource</td></tr>
+  <tr><td>\c file:recording.avi or \c recording.avi</td><td>VideoFileFrameSource</td></tr>
+  <tr><td>\c dir:frames/ or an existing directory</td><td>ImageDirectoryFrameSource</td></tr>
+  <tr><td>\c synthetic:640x480?fps=30&frames=300&face=me.png</td><td>SyntheticFrameSource</td></tr>
+  <tr><td>\c shm:/lockheed-camera</td><td>SharedMemoryFrameSource</td></tr>
+  </table>
+
+  All methods are called from the capture thread only, except for the
+  constructor and destructor.
+*/
+class FrameSource
+{
+public:
+    virtual ~FrameSource();
+
+    //! \brief Returns true if the source is ready to deliver frames
+    virtual bool IsOpened() const = 0;
+
+    /*! \brief Returns true if the source delivers frames at its own pace
+      FrameGrabber drops frames of live sources the consumer did not retrieve
+      in time, other sources are processed frame by frame.
+    */
+    virtual bool IsLive() const = 0;
+
+    /*! \brief Waits for the next frame
+      \param frame [out] Next frame, reused between calls when possible
+      \returns false on timeout, error or at the end of the stream
+    */
+    virtual bool Read(cv::Mat &frame) = 0;
+
+    //! \brief Returns true once the source can not deliver any more frames
+    virtual bool IsEndOfStream() const;
+
+    /*! \brief Requests a new frame size
+      Sources which can not change their frame size ignore the request.
+    */
+    virtual void SetFrameDimensions(int width, int height);
+
+    /*! \brief Creates a source from a URI, see the table above
+      \returns NULL if the URI is malformed, otherwise a source which may still
+               have failed to open (see FrameSource::IsOpened)
+    */
+    static FrameSource *Create(const std::string &uri);
+};
+
+//! \brief Camera opened through cv::VideoCapture by device ID
+class CameraFrameSource : public FrameSource
+{
+public:
+    //! \param deviceID Device to be used for VideoCapture
+    explicit CameraFrameSource(int deviceID);
+    ~CameraFrameSource();
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    void SetFrameDimensions(int width, int height);
+
+private:
+    cv::VideoCapture m_vc;  //!< Used for acquiring images from camera
+};
+
+//! \brief Video file or printf style image sequence ("frames/%04d.png") read through cv::VideoCapture
+class VideoFileFrameSource : public FrameSource
+{
+public:
+    explicit VideoFileFrameSource(const std::string &filename);
+    ~VideoFileFrameSource();
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    bool IsEndOfStream() const;
+
+private:
+    cv::VideoCapture m_vc;
+    bool m_endOfStream;
+};
+
+//! \brief Every image file of a directory, in file name order
+class ImageDirectoryFrameSource : public FrameSource
+{
+public:
+    explicit ImageDirectoryFrameSource(const std::string &directory);
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    bool IsEndOfStream() const;
+
+private:
+    QStringList m_files;    //!< Absolute paths of the images
+    int m_next;             //!< Index of the next image to read
+};
+
+/*! \brief Generates frames of a face moving over a textured background.
+
+  The face follows a Lissajous path and slowly changes size, so both the
+  detection and the tracking paths of FaceTracker get exercised. Without a
+  face image a simple drawn face is used, whether it is detected depends on
+  the classifier; pass a photo of a face for realistic detection rates.
+  The true face rectangle of the last frame is available through
+  SyntheticFrameSource::GetFaceRect.
+*/
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    /*! \brief Constructor
+      \param width Frame width
+      \param height Frame height
+      \param fps Frame rate to pace the frames at, 0 to generate them as fast as they are read
+      \param frameCount Number of frames to generate, 0 for no limit
+      \param faceFilename Image of a face to move around, empty to draw one
+    */
+    SyntheticFrameSource(int width = DEFAULT_SYNTHETIC_WIDTH, int height = DEFAULT_SYNTHETIC_HEIGHT,
+                         double fps = 0, int frameCount = 0, const std::string &faceFilename = std::string());
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    bool IsEndOfStream() const;
+    void SetFrameDimensions(int width, int height);
+
+    //! \brief Returns the true rectangle of the face in the last frame
+    QRect GetFaceRect() const;
+
+private:
+    //! \brief Renders the background texture for the current frame size
+    void CreateBackground();
+    //! \brief Draws a simple face into \a face
+    static void DrawFace(cv::Mat &face);
+
+    cv::Size m_size;
+    double m_fps;
+    int m_frameCount;
+    int m_generated;        //!< Number of frames generated so far
+    cv::Mat m_background;   //!< Static textured background
+    cv::Mat m_face;         //!< Face image at its largest size
+    cv::Mat m_scaledFace;   //!< Face image scaled for the current frame
+    QRect m_faceRect;       //!< Face rectangle of the last frame
+    QElapsedTimer m_clock;  //!< Paces live generation
+};
+
+#endif // FRAMESOURCE_H
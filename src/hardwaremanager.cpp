@@ -1,9 +1,10 @@
 #include "hardwaremanager.h"
 #include <QThread>
 #include <QTimer>
-#if defined(DEBUG_UNHANDLED_MESSAGES) || defined(DEBUG_QTHREADS)
+#include <QDir>
+#include <QStringList>
+#include "metrics.h"
 #include <QDebug>
-#endif
 
 HardwareManager::HardwareManager(QObject *parent) :
     QObject(parent), m_comm(new HardwareComm(this))
@@ -13,6 +14,7 @@ HardwareManager::HardwareManager(QObject *parent) :
     connect(m_comm, SIGNAL(verticalPositionChanged(qreal)), this, SLOT(m_updateVPosition(qreal)));
     connect(m_comm, SIGNAL(finalHorizontalPositionReached(qreal)), this, SLOT(positionHReached(qreal)));
     connect(m_comm, SIGNAL(finalVerticalPositionReached(qreal)), this, SLOT(positionVReached(qreal)));
+    connect(m_comm, SIGNAL(LinkStateChanged(LinkManager::State)), this, SIGNAL(LinkStateChanged(LinkManager::State)));
 
     m_monitorH_ROM = HardwareManager::DefaultHorizontalROM;
     m_monitorV_ROM = HardwareManager::DefaultVerticalROM;
@@ -32,11 +34,20 @@ void HardwareManager::UpdateFacePosition(QRect normalized_face_pos)
     if(!m_comm->isReady())
         return;
 
-    quint8 hpos = m_comm->retrievePositionH();
-    quint8 vpos = m_comm->retrievePositionV();
+    //Nothing to move relative to before the first answer
+    if(m_comm->positionH() < 0 || m_comm->positionV() < 0)
+    {
+        m_comm->requestPosition();
+        return;
+    }
+
+    quint8 hpos = m_comm->positionH();
+    quint8 vpos = m_comm->positionV();
     emit PositionHUpdate(hpos);
     emit PositionVUpdate(vpos);
 
+    int newHPosition = -1;
+    int newVPosition = -1;
     QPointF center = normalized_face_pos.center();
     if(center.x() < 5 && center.y() < 5)
         return;
@@ -54,8 +65,7 @@ void HardwareManager::UpdateFacePosition(QRect normalized_face_pos)
         else if(newPosition < 0)
             newPosition = 0;
 
-        m_hMotion = m_comm->setHorizontalPosition(newPosition);
-        emit RequestingHPosition((quint8)newPosition);
+        newHPosition = newPosition;
     }
     if(qAbs(center.y() - 0.5)*m_cameraV_FOV > m_toleranceV)// && !m_hMotion)
     {
@@ -69,8 +79,26 @@ void HardwareManager::UpdateFacePosition(QRect normalized_face_pos)
         else if(newPosition < 0)
             newPosition = 0;
 
-        m_vMotion = m_comm->setVerticalPosition(newPosition);
-        emit RequestingVPosition((quint8)newPosition);
+        newVPosition = newPosition;
+    }
+
+    //One round trip per frame, it also brings the position used by the next frame
+    if(newHPosition < 0 && newVPosition < 0)
+    {
+        m_comm->requestPosition();
+        return;
+    }
+
+    bool sent = m_comm->adjustPosition(newHPosition, newVPosition);
+    if(newHPosition >= 0)
+    {
+        m_hMotion = sent;
+        emit RequestingHPosition((quint8)newHPosition);
+    }
+    if(newVPosition >= 0)
+    {
+        m_vMotion = sent;
+        emit RequestingVPosition((quint8)newVPosition);
     }
 }
 
@@ -109,6 +137,11 @@ void HardwareManager::SetSerialPort(std::string &port)
     m_comm->setSerialTTY(port);
 }
 
+void HardwareManager::SetBaudRate(int baud)
+{
+    m_comm->setBaudRate(baud);
+}
+
 void HardwareManager::positionHReached(qreal pos)
 {
     m_hMotion = false;
@@ -132,7 +165,7 @@ void HardwareManager::m_updateVPosition(qreal pos)
 }
 
 HardwareComm::HardwareComm(QObject *parent) :
-    QObject(parent), m_serialComm(new ThreadSafeAsyncSerial)
+    QObject(parent), m_position(-1), m_positionStreaming(false), m_serialComm(new ThreadSafeAsyncSerial)
 {
     m_serialCommThread = new QThread;
 
@@ -142,12 +175,22 @@ HardwareComm::HardwareComm(QObject *parent) :
     connect(m_serialCommThread, SIGNAL(finished()), m_serialComm, SLOT(deleteLater()));
     connect(m_serialCommThread, SIGNAL(finished()), m_serialCommThread, SLOT(deleteLater()));
 
+    connect(m_serialComm, SIGNAL(AsyncMessage(HardwareComm::Message)),
+            this, SLOT(cachePosition(HardwareComm::Message)), Qt::DirectConnection);
     connect(m_serialComm, SIGNAL(AsyncMessage(HardwareComm::Message)),
             this, SLOT(processAsyncEvent(HardwareComm::Message)));
+    //The response is the second argument, a one argument slot would get the request
+    connect(m_serialComm, SIGNAL(ResponseReceived(HardwareComm::Message,HardwareComm::Message)),
+            this, SLOT(cacheResponse(HardwareComm::Message,HardwareComm::Message)), Qt::DirectConnection);
+    connect(m_serialComm, SIGNAL(ResponseReceived(HardwareComm::Message,HardwareComm::Message)),
+            this, SLOT(processResponse(HardwareComm::Message,HardwareComm::Message)));
+    connect(m_serialComm, SIGNAL(RequestFailed(HardwareComm::Message)),
+            this, SLOT(processFailedRequest(HardwareComm::Message)));
     m_serialCommThread->start();
 
-    m_timer = new QTimer(this);
-    connect(m_timer, SIGNAL(timeout()), this, SLOT(setCommReady()));
+    m_link = new LinkManager(m_serialComm, this);
+    connect(m_serialComm, SIGNAL(Disconnected()), m_link, SLOT(processPortLost()));
+    connect(m_link, SIGNAL(StateChanged(LinkManager::State)), this, SLOT(processLinkState(LinkManager::State)));
     this->setSerialTTY(Serial::DefaultTTYDevice);
 
     qRegisterMetaType<HardwareComm::Message>("HardwareComm::Message");
@@ -162,39 +205,76 @@ HardwareComm::~HardwareComm()
 
 qreal HardwareComm::positionH() const
 {
-    return m_hPosition;
+    int position = m_position;
+    return position < 0 ? -1.0 : (position >> 8) & 0xFF;
 }
 
 qreal HardwareComm::positionV() const
 {
-    return m_vPosition;
+    int position = m_position;
+    return position < 0 ? -1.0 : position & 0xFF;
+}
+
+bool HardwareComm::requestPosition()
+{
+    //Streamed positions are at most one interval old, polling adds nothing
+    if(m_positionStreaming)
+        return true;
+
+    //Answers to a pile of position requests would only be stale
+    if(m_positionRequest && !m_positionRequest->isFinished())
+        return false;
+
+    m_positionRequest = m_serialComm->sendRequest(Message(MESSAGE_POSITION_REQUEST));
+    return m_positionRequest->state() != SerialRequest::Failed;
 }
 
-qreal HardwareComm::retrievePositionH()
+bool HardwareComm::subscribePosition(int intervalMs, int deadband)
 {
     if(!m_serialComm->isReady())
-        return -1.0;
+        return false;
 
-    Message msg(MESSAGE_POSITION_H_REQUEST);
-    Message response;
-    if(!m_serialComm->sendMessage(msg, response))
-        return -1.0;
+    Message msg(MESSAGE_POSITION_UNSUBSCRIBE);
+    if(intervalMs > 0)
+        msg = Message(MESSAGE_POSITION_SUBSCRIBE, qBound(1, intervalMs/10, 255), qBound(0, deadband, 255));
+    else
+        m_positionStreaming = false;
 
-    m_hPosition = response.params.one;
+    return m_serialComm->sendRequest(msg)->state() != SerialRequest::Failed;
+}
 
-    return m_hPosition;
+void HardwareComm::setBaudRate(int baud)
+{
+    m_link->setBaudRate(baud);
 }
 
-qreal HardwareComm::retrievePositionV()
+bool HardwareComm::isPositionStreaming() const
 {
-    Message msg(MESSAGE_POSITION_V_REQUEST);
-    Message response;
-    if(!m_serialComm->sendMessage(msg, response))
-        return -1.0;
+    return m_positionStreaming;
+}
+
+bool HardwareComm::adjustPosition(int hPosition, int vPosition)
+{
+    if(hPosition < 0 && vPosition < 0)
+        return requestPosition();
 
-    m_vPosition = response.params.one;
+    if(!m_serialComm->isReady())
+        return false;
+
+    Message msg(MESSAGE_ADJUST_POSITION_REPORT, qMax(hPosition, 0), qMax(vPosition, 0));
+    if(hPosition < 0)
+        msg.msg = MESSAGE_ADJUST_V_POSITION_REPORT;
+    else if(vPosition < 0)
+        msg.msg = MESSAGE_ADJUST_H_POSITION_REPORT;
 
-    return m_vPosition;
+    if(m_serialComm->sendRequest(msg)->state() == SerialRequest::Failed)
+        return false;
+
+    if(hPosition >= 0)
+        m_hMoveTimer.start();
+    if(vPosition >= 0)
+        m_vMoveTimer.start();
+    return true;
 }
 
 bool HardwareComm::isReady() const
@@ -204,12 +284,21 @@ bool HardwareComm::isReady() const
 
 bool HardwareComm::setVerticalPosition(quint8 position)
 {
-    return m_setPositionHelper(MESSAGE_ADJUST_V_POSITION, position);
+    if(!m_setPositionHelper(MESSAGE_ADJUST_V_POSITION, position))
+        return false;
+
+    //A new target restarts the measurement, only the final target is timed
+    m_vMoveTimer.start();
+    return true;
 }
 
 bool HardwareComm::setHorizontalPosition(quint8 position)
 {
-    return m_setPositionHelper(MESSAGE_ADJUST_H_POSITION, position);
+    if(!m_setPositionHelper(MESSAGE_ADJUST_H_POSITION, position))
+        return false;
+
+    m_hMoveTimer.start();
+    return true;
 }
 
 bool HardwareComm::enableManualControls(bool enable)
@@ -236,12 +325,16 @@ void HardwareComm::processAsyncEvent(HardwareComm::Message msg)
         emit verticalPositionChanged(msg.params.two/((qreal)255));
         break;
     case MESSAGE_POSITION_H_REACHED:
+        m_recordTimeToTarget(m_hMoveTimer);
         emit finalHorizontalPositionReached(msg.params.one/((qreal)255));
         break;
     case MESSAGE_POSITION_V_REACHED:
+        m_recordTimeToTarget(m_vMoveTimer);
         emit finalVerticalPositionReached(msg.params.one/((qreal)255));
         break;
     case MESSAGE_POSITION_REACHED:
+        m_recordTimeToTarget(m_hMoveTimer);
+        m_recordTimeToTarget(m_vMoveTimer);
         emit finalHorizontalPositionReached(msg.params.one/((qreal)255));
         emit finalVerticalPositionReached(msg.params.two/((qreal)255));
         break;
@@ -254,20 +347,97 @@ void HardwareComm::processAsyncEvent(HardwareComm::Message msg)
     }
 }
 
+void HardwareComm::processResponse(HardwareComm::Message request, HardwareComm::Message response)
+{
+    switch(response.msg)
+    {
+    case MESSAGE_ACK:
+        if(request.msg == MESSAGE_POSITION_SUBSCRIBE)
+            m_positionStreaming = true;
+        break;
+    case MESSAGE_NACK:
+        processFailedRequest(request);
+        break;
+    }
+}
+
+void HardwareComm::cachePosition(HardwareComm::Message msg)
+{
+    //Only the reader thread writes, a plain read-modify-write is enough
+    int position = m_position;
+    int h = position < 0 ? -1 : (position >> 8) & 0xFF;
+    int v = position < 0 ? -1 : position & 0xFF;
+
+    switch(msg.msg)
+    {
+    case MESSAGE_POSITION_RESPONSE:
+    case MESSAGE_POSITION_UPDATE:
+    case MESSAGE_POSITION_REACHED:
+        h = msg.params.one;
+        v = msg.params.two;
+        break;
+    case MESSAGE_POSITION_H_RESPONSE:
+    case MESSAGE_POSITION_H_REACHED:
+        h = msg.params.one;
+        break;
+    case MESSAGE_POSITION_V_RESPONSE:
+    case MESSAGE_POSITION_V_REACHED:
+        v = msg.params.one;
+        break;
+    default:
+        return;
+    }
+
+    //Half known positions stay unknown, the pair is always consistent
+    if(h >= 0 && v >= 0)
+        m_position.fetchAndStoreRelease((h << 8) | v);
+}
+
+void HardwareComm::cacheResponse(HardwareComm::Message request, HardwareComm::Message response)
+{
+    Q_UNUSED(request);
+    cachePosition(response);
+}
+
+void HardwareComm::processFailedRequest(HardwareComm::Message request)
+{
+    //The move may never have started, do not time it
+    if(!(request.msg & MESSAGE_ADJUST_POSITION))
+        return;
+    if(request.msg & MESSAGE_DIRECTION_H)
+        m_hMoveTimer.invalidate();
+    if(request.msg & MESSAGE_DIRECTION_V)
+        m_vMoveTimer.invalidate();
+}
+
 void HardwareComm::setSerialTTY(const std::string &tty)
 {
-    m_serialComm->openSerialTTY(tty);
-    m_timer->setSingleShot(true);
-    m_timer->start(4000);
+    m_link->open(tty);
 }
 
-void HardwareComm::setCommReady()
+void HardwareComm::processLinkState(LinkManager::State state)
 {
-    if(!m_serialComm->isReady())
+    if(state == LinkManager::Connected)
     {
-        m_serialComm->setReady();
+        subscribePosition();
         emit CommReady();
     }
+    else
+    {
+        //The device restarts, it has to be asked for its position and subscribed again
+        m_positionStreaming = false;
+        m_position.fetchAndStoreRelease(-1);
+    }
+    emit LinkStateChanged(state);
+}
+
+void HardwareComm::m_recordTimeToTarget(QElapsedTimer &moveTimer)
+{
+    if(!moveTimer.isValid())
+        return;
+
+    Metrics::RecordElapsed(Metrics::ActuatorTimeToTarget, moveTimer);
+    moveTimer.invalidate();
 }
 
 bool HardwareComm::m_setPositionHelper(quint16 msg, quint8 position)
@@ -279,8 +449,8 @@ bool HardwareComm::m_setPositionHelper(quint16 msg, quint8 position)
     sendMsg.msg = msg;
     sendMsg.params.one = position ;
 
-    Message response;
-    return m_serialComm->sendMessage(sendMsg, response);
+    //The acknowledgement is not waited for, a refused move is handled by processFailedRequest()
+    return m_serialComm->sendRequest(sendMsg)->state() != SerialRequest::Failed;
 }
 
 HardwareComm::Message::Message(quint16 msg, quint8 param1, quint8 param2)
@@ -312,6 +482,8 @@ QString printMsg(HardwareComm::Message msg)
     {
     case MESSAGE_ECHO_REQUEST:
         return QString("MESSAGE_ECHO_REQUEST");
+    case MESSAGE_SET_BAUD_RATE:
+        return QString("MESSAGE_SET_BAUD_RATE (%1)").arg(baudRateFromCode(msg.params.one));
     case MESSAGE_ECHO_RESPONSE:
         return QString("MESSAGE_ECHO_RESPONSE");
     case MESSAGE_ACK:
@@ -348,30 +520,79 @@ QString printMsg(HardwareComm::Message msg)
         return QString("MESSAGE_POSITION_V_REACHED (%1)").arg(msg.params.one);
     case MESSAGE_MODE_SWITCH:
         return QString("MESSAGE_MODE_SWITCH");
+    case MESSAGE_ADJUST_POSITION_REPORT:
+        return QString("MESSAGE_ADJUST_POSITION_REPORT (%1,%2)").arg(msg.params.one).arg(msg.params.two);
+    case MESSAGE_ADJUST_H_POSITION_REPORT:
+        return QString("MESSAGE_ADJUST_H_POSITION_REPORT (%1)").arg(msg.params.one);
+    case MESSAGE_ADJUST_V_POSITION_REPORT:
+        return QString("MESSAGE_ADJUST_V_POSITION_REPORT (%1)").arg(msg.params.two);
+    case MESSAGE_POSITION_SUBSCRIBE:
+        return QString("MESSAGE_POSITION_SUBSCRIBE (%1,%2)").arg(msg.params.one).arg(msg.params.two);
+    case MESSAGE_POSITION_UNSUBSCRIBE:
+        return QString("MESSAGE_POSITION_UNSUBSCRIBE");
     }
     return QString("unrecognized message! %1").arg(msg.msg);
 }
 
-Serial& operator<<(Serial &serial, const HardwareComm::Message &msg)
+FrameCodec::FrameCodec() :
+    m_discarded(0)
 {
-    serial << msg.msg;
-    if(msg.paramCount() == 1)
-        serial << msg.params.one;
-    else if(msg.paramCount() == 2)
-        serial << msg.params.one << msg.params.two;
+}
 
-    return serial;
+int FrameCodec::encode(quint8 sequence, const HardwareComm::Message &msg, char *frame)
+{
+    int length = FRAME_LENGTH(msg.msg);
+    frame[0] = (char)FRAME_START;
+    frame[1] = (char)length;
+    frame[2] = (char)sequence;
+    frame[3] = (char)(msg.msg & 0xFF);
+    frame[4] = (char)(msg.msg >> 8);
+    frame[5] = (char)msg.params.one;
+    frame[6] = (char)msg.params.two;
+    frame[FRAME_HEADER_SIZE + length] = (char)frameCrc8((const unsigned char*)frame + 1, length + 1);
+
+    return FRAME_HEADER_SIZE + length + 1;
 }
 
-Serial& operator>>(Serial &serial, HardwareComm::Message &msg)
+bool FrameCodec::decode(const Serial &serial, quint8 &sequence, HardwareComm::Message &msg)
 {
-    serial >> msg.msg;
-    if(msg.paramCount() == 1)
-        serial >> msg.params.one;
-    else if(msg.paramCount() == 2)
-        serial >> msg.params.one >> msg.params.two;
+    unsigned char frame[FRAME_MAX_SIZE];
+    int size;
+    while((size = serial.peekBytes((char*)frame, sizeof(frame))) > 0)
+    {
+        int length = size >= FRAME_HEADER_SIZE ? frame[1] : FRAME_MIN_LENGTH;
+        if(frame[0] != FRAME_START || length < FRAME_MIN_LENGTH || length > FRAME_MAX_LENGTH)
+        {
+            serial.skipBytes(1);
+            m_discarded++;
+            continue;
+        }
+        if(size < FRAME_HEADER_SIZE + length + 1)
+            return false;
+
+        quint16 code = frame[3] | (frame[4] << 8);
+        if(frameCrc8(frame + 1, length + 1) != frame[FRAME_HEADER_SIZE + length]
+                || (int)FRAME_LENGTH(code) != length)
+        {
+#ifdef DEBUG_SERIAL_COMM
+            qDebug() << "FrameCodec::decode(): dropping corrupted frame";
+#endif
+            serial.skipBytes(1);
+            m_discarded++;
+            continue;
+        }
 
-    return serial;
+        sequence = frame[2];
+        msg = HardwareComm::Message(code, length > 3 ? frame[5] : 0, length > 4 ? frame[6] : 0);
+        serial.skipBytes(FRAME_HEADER_SIZE + length + 1);
+        return true;
+    }
+    return false;
+}
+
+quint32 FrameCodec::discardedBytes() const
+{
+    return m_discarded;
 }
 
 HardwareComm::Message &HardwareComm::Message::operator =(const HardwareComm::Message &source)
@@ -383,31 +604,138 @@ HardwareComm::Message &HardwareComm::Message::operator =(const HardwareComm::Mes
 }
 
 
+SerialRequest::SerialRequest(quint32 sequence, const HardwareComm::Message &request, int timeoutMs) :
+    m_sequence(sequence), m_request(request), m_timeout(timeoutMs), m_state(Pending)
+{
+    m_timer.start();
+}
+
+quint32 SerialRequest::sequence() const
+{
+    return m_sequence;
+}
+
+quint8 SerialRequest::frameSequence() const
+{
+    //FRAME_ASYNC_SEQUENCE is never used by a request
+    return m_sequence % 255 + 1;
+}
+
+HardwareComm::Message SerialRequest::request() const
+{
+    return m_request;
+}
+
+SerialRequest::State SerialRequest::state() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_state;
+}
+
+bool SerialRequest::isFinished() const
+{
+    return state() != Pending;
+}
+
+HardwareComm::Message SerialRequest::response() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_response;
+}
+
+bool SerialRequest::waitForFinished(unsigned long timeoutMs)
+{
+    QMutexLocker locker(&m_mutex);
+    if(m_state != Pending)
+        return true;
+    return m_finished.wait(&m_mutex, timeoutMs);
+}
+
+bool SerialRequest::finish(State state, const HardwareComm::Message &response)
+{
+    QMutexLocker locker(&m_mutex);
+    if(m_state != Pending)
+        return false;
+
+    m_state = state;
+    m_response = response;
+    m_finished.wakeAll();
+    return true;
+}
+
+qint64 SerialRequest::elapsed() const
+{
+    return m_timer.elapsed();
+}
+
+int SerialRequest::timeout() const
+{
+    return m_timeout;
+}
+
+
 ThreadSafeAsyncSerial::ThreadSafeAsyncSerial(QObject *parent):
-    QObject(parent), m_ceaseRequested(false), m_serial(new Serial), m_isReady(false)
+    QObject(parent), m_ceaseRequested(false), m_serial(new Serial), m_nextSequence(0), m_isReady(false),
+    m_running(false), m_portOpen(false), m_reopenRequested(false), m_reopenResult(false)
 {
-    m_readyMutex.tryLock();
 }
 
-bool ThreadSafeAsyncSerial::sendMessage(const HardwareComm::Message &msg, HardwareComm::Message &response)
+ThreadSafeAsyncSerial::~ThreadSafeAsyncSerial()
+{
+    delete m_serial;
+}
+
+SerialRequestPtr ThreadSafeAsyncSerial::sendRequest(const HardwareComm::Message &msg, int timeoutMs)
+{
+    return queueRequest(msg, timeoutMs, true);
+}
+
+SerialRequestPtr ThreadSafeAsyncSerial::ping(int timeoutMs)
+{
+    return queueRequest(HardwareComm::Message(MESSAGE_ECHO_REQUEST), timeoutMs, false);
+}
+
+SerialRequestPtr ThreadSafeAsyncSerial::queueRequest(const HardwareComm::Message &msg, int timeoutMs, bool requireReady)
 {
     QMutexLocker locker(&m_queueMutex);
-    if(!m_isReady)
-        return false;
+    SerialRequestPtr request(new SerialRequest(m_nextSequence++, msg, timeoutMs));
+
+    //Refuse rather than block the caller, the device is not keeping up anyway
+    if((requireReady && !m_isReady) || m_pending.size() >= DEFAULT_SERIAL_MAX_OUTSTANDING)
+    {
+        request->finish(SerialRequest::Failed);
+        return request;
+    }
 #ifdef DEBUG_SERIAL_COMM
-    qDebug() << "ThreadSafeAsyncSerial::sendMessage(): Sending: " << printMsg(msg);
+    qDebug() << "ThreadSafeAsyncSerial::sendRequest(): Sending #" << request->sequence() << ": " << printMsg(msg);
 #endif
-    Sender sender;
 
-    m_senderQueue.enqueue(&sender);
-    *m_serial << msg;
-    sender.cond.wait(&m_queueMutex);
+    m_pending.append(request);
+    char frame[FRAME_MAX_SIZE];
+    int size = FrameCodec::encode(request->frameSequence(), msg, frame);
+    if(m_serial->writeBytes(frame, size) != size)
+    {
+        m_pending.removeLast();
+        request->finish(SerialRequest::Failed);
+    }
+    return request;
+}
+
+bool ThreadSafeAsyncSerial::sendMessage(const HardwareComm::Message &msg, HardwareComm::Message &response)
+{
+    SerialRequestPtr request = sendRequest(msg);
+    //The reader finishes requests shortly after their timeout, unless it is busy reopening the port
+    if(!request->waitForFinished(request->timeout() + 4*DEFAULT_SERIAL_POLL_INTERVAL)
+            && request->finish(SerialRequest::TimedOut))
+        emit RequestFailed(request->request());
+    if(request->state() != SerialRequest::Completed)
+        return false;
 
 #ifdef DEBUG_SERIAL_COMM
-    qDebug() << "ThreadSafeAsyncSerial::sendMessage(): response: " << printMsg(sender.response);
+    qDebug() << "ThreadSafeAsyncSerial::sendMessage(): response: " << printMsg(request->response());
 #endif
 
-    response = sender.response;
+    response = request->response();
     return true;
 }
 
@@ -416,55 +744,127 @@ bool ThreadSafeAsyncSerial::isReady() const
     return m_isReady;
 }
 
+SerialRequestPtr ThreadSafeAsyncSerial::requestBaudRate(int baud)
+{
+    int code = 0;
+    while(code < BAUD_RATE_CODE_COUNT && baudRateFromCode(code) != (unsigned long)baud)
+        code++;
+    if(code == BAUD_RATE_CODE_COUNT || !Serial::isSupportedBaudRate(baud))
+    {
+        SerialRequestPtr request(new SerialRequest(0, HardwareComm::Message(MESSAGE_SET_BAUD_RATE), 0));
+        request->finish(SerialRequest::Failed);
+        return request;
+    }
+
+    return queueRequest(HardwareComm::Message(MESSAGE_SET_BAUD_RATE, code), DEFAULT_SERIAL_TIMEOUT, false);
+}
+
+bool ThreadSafeAsyncSerial::setPortBaudRate(int baud)
+{
+    //Never switch in the middle of a frame being written
+    QMutexLocker locker(&m_queueMutex);
+    return m_serial->setBaudRate(baud);
+}
+
+int ThreadSafeAsyncSerial::portBaudRate() const
+{
+    return m_serial->baudRate();
+}
+
+bool ThreadSafeAsyncSerial::negotiateBaudRate(int baud)
+{
+    SerialRequestPtr request = requestBaudRate(baud);
+    request->waitForFinished(request->timeout() + 4*DEFAULT_SERIAL_POLL_INTERVAL);
+    if(request->state() != SerialRequest::Completed || request->response().msg != MESSAGE_ACK)
+        return false;
+
+    //The device switched right after the ACK, an echo at the new rate confirms the link
+    HardwareComm::Message response;
+    if(setPortBaudRate(baud)
+            && sendMessage(HardwareComm::Message(MESSAGE_ECHO_REQUEST), response))
+        return true;
+
+    setPortBaudRate(BAUD_RATE_BOOT);
+    return false;
+}
+
+bool ThreadSafeAsyncSerial::isResponseTo(const HardwareComm::Message &request, const HardwareComm::Message &response)
+{
+    //Requests the device does not understand are refused
+    if(response.msg == MESSAGE_NACK)
+        return true;
+
+    switch(request.msg)
+    {
+    case MESSAGE_ECHO_REQUEST:
+        return response.msg == MESSAGE_ECHO_RESPONSE;
+    case MESSAGE_POSITION_REQUEST:
+    case MESSAGE_ADJUST_POSITION_REPORT:
+    case MESSAGE_ADJUST_H_POSITION_REPORT:
+    case MESSAGE_ADJUST_V_POSITION_REPORT:
+        return response.msg == MESSAGE_POSITION_RESPONSE;
+    case MESSAGE_POSITION_H_REQUEST:
+        return response.msg == MESSAGE_POSITION_H_RESPONSE;
+    case MESSAGE_POSITION_V_REQUEST:
+        return response.msg == MESSAGE_POSITION_V_RESPONSE;
+    default:
+        return response.msg == MESSAGE_ACK;
+    }
+}
+
 
 void ThreadSafeAsyncSerial::begin()
 {
 #ifdef DEBUG_QTHREADS
     qDebug() << "begin(): called";
 #endif
+    m_stateMutex.lock();
+    m_running = true;
+    m_stateMutex.unlock();
+
     HardwareComm::Message readMsg;
-    while(!m_ceaseRequested)
+    quint8 sequence;
+    while(waitForPort())
     {
-        if(!m_isReady)
+        //Wake up regularly so requests time out even if the device is silent
+        expireRequests();
+        Serial::WaitResult result = m_serial->waitForReadyRead(DEFAULT_SERIAL_POLL_INTERVAL);
+        if(result == Serial::Disconnected)
         {
-#ifdef DEBUG_QTHREADS
-            qDebug() << "begin(): not ready, blocking on mutex...";
-#endif
-            m_readyMutex.lock();
-            m_readyMutex.unlock();
-            if(m_ceaseRequested)
-                break;
+            closeLostPort();
+            continue;
         }
-        if(!((*m_serial) >> readMsg))
+        if(result != Serial::DataReady)
             continue;
 
-        if(readMsg.isAsync())
+        //Everything the device sent in one syscall, decoded out of the read buffer
+        int count = m_serial->fillReadBuffer();
+        if(count < 0 || (count == 0 && m_serial->bytesBuffered() < SERIAL_READ_BUFFER_SIZE))
         {
-#ifdef DEBUG_SERIAL_COMM
-            qDebug() << "Async: " << printMsg(readMsg);
-#endif
-            emit AsyncMessage(readMsg);
+            //Readable without data, the tty hung up
+            closeLostPort();
+            continue;
         }
-        else
+
+        while(m_codec.decode(*m_serial, sequence, readMsg))
         {
-            //Check queue and return to proper receiver
-            m_queueMutex.lock();
-            if(!m_senderQueue.empty())
-            {
-                Sender *sender = m_senderQueue.dequeue();
-                sender->response = readMsg;
-                m_queueMutex.unlock();
-                sender->cond.wakeOne();
-            }
-            else
+            if(sequence == FRAME_ASYNC_SEQUENCE || readMsg.isAsync())
             {
 #ifdef DEBUG_SERIAL_COMM
-                qDebug() << "Non-async and non-response msg: " << printMsg(readMsg);
+                qDebug() << "Async: " << printMsg(readMsg);
 #endif
-                m_queueMutex.unlock();
+                emit AsyncMessage(readMsg);
             }
+            else
+                completeRequest(sequence, readMsg);
         }
     }
+    failRequests();
+
+    m_stateMutex.lock();
+    m_running = false;
+    m_stateChanged.wakeAll();
+    m_stateMutex.unlock();
 #ifdef DEBUG_QTHREADS
     qDebug() << "ThreadSafeAsyncSerial::begin(): loop complete.";
 #endif
@@ -476,27 +876,348 @@ void ThreadSafeAsyncSerial::stop()
 #ifdef DEBUG_QTHREADS
     qDebug() << "ThreadSafeAsyncSerial::stop(): attempting to stop read loop";
 #endif
+    QMutexLocker locker(&m_stateMutex);
     m_ceaseRequested = true;
-    if(!m_isReady)
-        m_readyMutex.unlock();
-    *m_serial << HardwareComm::Message();
+    m_stateChanged.wakeAll();
+    m_serial->interrupt();
 }
 
 bool ThreadSafeAsyncSerial::openSerialTTY(const std::string &tty)
 {
-    this->m_readyMutex.tryLock();
+    QMutexLocker locker(&m_stateMutex);
     m_isReady = false;
-    m_serial->open(tty);
-    return m_serial->is_open();
+    if(!m_running)
+        return reopenPort(tty);
+
+    //The reader owns the port, hand the reopen over and wait for it
+    m_requestedTTY = tty;
+    m_reopenRequested = true;
+    m_stateChanged.wakeAll();
+    m_serial->interrupt();
+    while(m_reopenRequested && m_running)
+        m_stateChanged.wait(&m_stateMutex);
+    return m_reopenResult;
 }
 
 
-void ThreadSafeAsyncSerial::setReady()
+void ThreadSafeAsyncSerial::setReady(bool ready)
 {
 #ifdef DEBUG_QTHREADS
-    qDebug() << "ThreadSafeAsyncSerial::setReady(): ublocking read loop";
+    qDebug() << "ThreadSafeAsyncSerial::setReady(): " << ready;
 #endif
 
-    this->m_isReady = true;
-    this->m_readyMutex.unlock();
+    QMutexLocker locker(&m_stateMutex);
+    m_isReady = ready;
+}
+
+bool ThreadSafeAsyncSerial::waitForPort()
+{
+    QMutexLocker locker(&m_stateMutex);
+    while(!m_ceaseRequested)
+    {
+        if(m_reopenRequested)
+        {
+            m_reopenResult = reopenPort(m_requestedTTY);
+            m_reopenRequested = false;
+            m_stateChanged.wakeAll();
+        }
+        else if(m_portOpen)
+            return true;
+        else
+            m_stateChanged.wait(&m_stateMutex);
+    }
+    return false;
+}
+
+bool ThreadSafeAsyncSerial::reopenPort(const std::string &tty)
+{
+    m_isReady = false;
+    failRequests();
+
+    //Writers check the port under the queue lock
+    m_queueMutex.lock();
+    //Opening the port restarts the device at its boot rate
+    m_serial->setBaudRate(BAUD_RATE_BOOT);
+    m_portOpen = m_serial->open(tty);
+    m_queueMutex.unlock();
+
+    return m_portOpen;
+}
+
+void ThreadSafeAsyncSerial::closeLostPort()
+{
+    m_stateMutex.lock();
+    m_isReady = false;
+    m_portOpen = false;
+    m_queueMutex.lock();
+    m_serial->close();
+    m_queueMutex.unlock();
+    m_stateMutex.unlock();
+
+    failRequests();
+#ifdef DEBUG_SERIAL_COMM
+    qDebug() << "ThreadSafeAsyncSerial: port hung up";
+#endif
+    emit Disconnected();
+}
+
+void ThreadSafeAsyncSerial::completeRequest(quint8 sequence, const HardwareComm::Message &response)
+{
+    SerialRequestPtr answered;
+
+    m_queueMutex.lock();
+    for(int i = 0; i < m_pending.size(); i++)
+    {
+        //The type check catches a device echoing a stale or mangled sequence ID
+        if(m_pending[i]->frameSequence() != sequence || !isResponseTo(m_pending[i]->request(), response))
+            continue;
+
+        answered = m_pending.takeAt(i);
+        break;
+    }
+    m_queueMutex.unlock();
+
+    if(!answered)
+    {
+#ifdef DEBUG_SERIAL_COMM
+        qDebug() << "Response #" << sequence << " to no outstanding request: " << printMsg(response);
+#endif
+        return;
+    }
+
+    //A late response to a timed out request is dropped, the caller has moved on
+    if(answered->finish(SerialRequest::Completed, response))
+    {
+        Metrics::RecordElapsed(Metrics::SerialRoundTrip, answered->m_timer);
+        emit ResponseReceived(answered->request(), response);
+    }
+}
+
+void ThreadSafeAsyncSerial::expireRequests()
+{
+    QList<SerialRequestPtr> expired;
+
+    m_queueMutex.lock();
+    for(int i = 0; i < m_pending.size(); i++)
+    {
+        if(!m_pending[i]->isFinished() && m_pending[i]->elapsed() > m_pending[i]->timeout())
+            expired.append(m_pending[i]);
+    }
+    //Keep timed out requests around for late responses, but not forever
+    for(int i = m_pending.size() - 1; i >= 0; i--)
+    {
+        if(m_pending[i]->isFinished() && m_pending[i]->elapsed() > 4*m_pending[i]->timeout())
+            m_pending.removeAt(i);
+    }
+    m_queueMutex.unlock();
+
+    for(int i = 0; i < expired.size(); i++)
+    {
+        if(expired[i]->finish(SerialRequest::TimedOut))
+            emit RequestFailed(expired[i]->request());
+    }
+}
+
+void ThreadSafeAsyncSerial::failRequests()
+{
+    m_queueMutex.lock();
+    QList<SerialRequestPtr> pending = m_pending;
+    m_pending.clear();
+    m_queueMutex.unlock();
+
+    for(int i = 0; i < pending.size(); i++)
+    {
+        if(pending[i]->finish(SerialRequest::Failed))
+            emit RequestFailed(pending[i]->request());
+    }
+}
+
+
+LinkManager::LinkManager(ThreadSafeAsyncSerial *serial, QObject *parent) :
+    QObject(parent), m_serial(serial), m_state(Disconnected), m_handshakeStep(Probing),
+    m_baudRate(DEFAULT_SERIAL_BAUD_RATE), m_rateSwitchFailed(false), m_missedHeartbeats(0),
+    m_retryDelay(DEFAULT_LINK_RETRY_MIN)
+{
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(m_tick()));
+}
+
+void LinkManager::open(const std::string &tty)
+{
+    m_tty = tty;
+    m_retryDelay = DEFAULT_LINK_RETRY_MIN;
+    m_connectPort();
+}
+
+void LinkManager::setBaudRate(int baud)
+{
+    m_baudRate = baud;
+}
+
+LinkManager::State LinkManager::state() const
+{
+    return m_state;
+}
+
+std::string LinkManager::port() const
+{
+    return m_activePort;
+}
+
+void LinkManager::processPortLost()
+{
+    if(m_state != Disconnected)
+        m_retryLater();
+}
+
+void LinkManager::m_tick()
+{
+    switch(m_state)
+    {
+    case Disconnected:
+        m_connectPort();
+        break;
+
+    case Connecting:
+        m_handshake();
+        break;
+
+    case Connected:
+        if(m_probe && m_probe->isFinished())
+            m_missedHeartbeats = m_probe->state() == SerialRequest::Completed ? 0 : m_missedHeartbeats + 1;
+        if(m_missedHeartbeats >= DEFAULT_LINK_HEARTBEAT_MISSES)
+        {
+#ifdef DEBUG_SERIAL_COMM
+            qDebug() << "LinkManager: no heartbeat from the device, reconnecting";
+#endif
+            //Reopening the port usually restarts a device that stopped answering,
+            //one that keeps running is back at BAUD_RATE_BOOT before the handshake gives up
+            m_connectPort();
+        }
+        else if(!m_probe || m_probe->isFinished())
+            m_probe = m_serial->ping();
+        break;
+    }
+}
+
+void LinkManager::m_handshake()
+{
+    switch(m_handshakeStep)
+    {
+    case Probing:
+        if(m_probe && m_probe->state() == SerialRequest::Completed)
+        {
+            if(m_baudRate != m_serial->portBaudRate() && !m_rateSwitchFailed)
+            {
+                m_probe = m_serial->requestBaudRate(m_baudRate);
+                m_handshakeStep = SwitchingRate;
+                if(m_probe->isFinished())
+                    m_abortRateSwitch();
+                return;
+            }
+
+            m_serial->setReady();
+            m_probe.clear();
+            m_missedHeartbeats = 0;
+            m_retryDelay = DEFAULT_LINK_RETRY_MIN;
+            m_timer.start(DEFAULT_LINK_HEARTBEAT_INTERVAL);
+            m_setState(Connected);
+        }
+        else if(m_stateTimer.hasExpired(DEFAULT_LINK_HANDSHAKE_TIMEOUT))
+            m_retryLater();
+        else if(!m_probe || m_probe->isFinished())
+            m_probe = m_serial->ping(DEFAULT_LINK_PROBE_INTERVAL);
+        break;
+
+    case SwitchingRate:
+        if(!m_probe->isFinished())
+            break;
+        if(m_probe->state() != SerialRequest::Completed || m_probe->response().msg != MESSAGE_ACK
+                || !m_serial->setPortBaudRate(m_baudRate))
+        {
+            m_abortRateSwitch();
+            break;
+        }
+
+        //The device switched right after the ACK, an echo at the new rate confirms the link
+        m_probe = m_serial->ping();
+        m_handshakeStep = ConfirmingRate;
+        break;
+
+    case ConfirmingRate:
+        if(!m_probe->isFinished())
+            break;
+        if(m_probe->state() != SerialRequest::Completed)
+        {
+            m_abortRateSwitch();
+            break;
+        }
+
+        //Connected at the new rate on the next tick
+        m_handshakeStep = Probing;
+        break;
+    }
+}
+
+void LinkManager::m_abortRateSwitch()
+{
+    qWarning() << "LinkManager: could not switch the link to" << m_baudRate << "baud, staying at" << BAUD_RATE_BOOT;
+
+    //The device returns to its boot rate within BAUD_RATE_CONFIRM_TIMEOUT,
+    //probing resumes there and has the full handshake time to get an answer
+    m_serial->setPortBaudRate(BAUD_RATE_BOOT);
+    m_rateSwitchFailed = true;
+    m_probe.clear();
+    m_handshakeStep = Probing;
+    m_stateTimer.start();
+}
+
+bool LinkManager::m_connectPort()
+{
+    m_probe.clear();
+    m_handshakeStep = Probing;
+    m_rateSwitchFailed = false;
+
+    QStringList ports(QString::fromStdString(m_tty));
+    //After re-enumerating, a USB CDC device may come back under the next free ttyACM
+    if(m_tty.compare(0, 11, "/dev/ttyACM") == 0)
+    {
+        foreach(const QString &name, QDir("/dev").entryList(QStringList("ttyACM*"), QDir::System))
+        {
+            if(!ports.contains("/dev/" + name))
+                ports << "/dev/" + name;
+        }
+    }
+
+    foreach(const QString &port, ports)
+    {
+        if(!m_serial->openSerialTTY(port.toStdString()))
+            continue;
+
+        m_activePort = port.toStdString();
+        m_stateTimer.start();
+        m_timer.start(DEFAULT_LINK_PROBE_INTERVAL);
+        m_setState(Connecting);
+        return true;
+    }
+
+    m_retryLater();
+    return false;
+}
+
+void LinkManager::m_retryLater()
+{
+    m_probe.clear();
+    m_serial->setReady(false);
+    m_timer.start(m_retryDelay);
+    m_retryDelay = qMin(2*m_retryDelay, DEFAULT_LINK_RETRY_MAX);
+    m_setState(Disconnected);
+}
+
+void LinkManager::m_setState(LinkManager::State state)
+{
+    if(m_state == state)
+        return;
+
+    m_state = state;
+    emit StateChanged(state);
 }
@@ -10,9 +10,125 @@
 #include <QRectF>
 #include <QMetaType>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QList>
+#include <QAtomicInt>
+#include <climits>
+
+//! \brief Default time (ms) a request waits for its response
+#define DEFAULT_SERIAL_TIMEOUT          250
+//! \brief Default maximum number of requests waiting for a response
+#define DEFAULT_SERIAL_MAX_OUTSTANDING  8
+//! \brief Default interval (ms) at which the reader checks for expired requests
+#define DEFAULT_SERIAL_POLL_INTERVAL    20
+//! \brief Default interval (ms) between echo requests while waiting for the device to answer
+#define DEFAULT_LINK_PROBE_INTERVAL     100
+//! \brief Default time (ms) the device has to answer an echo after the port was opened
+#define DEFAULT_LINK_HANDSHAKE_TIMEOUT  5000
+//! \brief Default interval (ms) between echo requests checking a connected device
+#define DEFAULT_LINK_HEARTBEAT_INTERVAL 1000
+//! \brief Default number of heartbeats in a row the device may miss before the link is reset
+#define DEFAULT_LINK_HEARTBEAT_MISSES   3
+//! \brief Default delay (ms) before the first attempt to reconnect, doubled on every failure
+#define DEFAULT_LINK_RETRY_MIN          250
+//! \brief Default maximum delay (ms) between attempts to reconnect
+#define DEFAULT_LINK_RETRY_MAX          8000
+//! \brief Default rate (baud) the link is switched to once the device is ready
+#define DEFAULT_SERIAL_BAUD_RATE        115200
+//! \brief Default interval (ms) at which the device samples and streams its position
+#define DEFAULT_POSITION_STREAM_INTERVAL    50
+//! \brief Default change (0 .. 255) of either axis before the device streams a new position
+#define DEFAULT_POSITION_STREAM_DEADBAND    1
 
 
 class HardwareComm;
+class SerialRequest;
+//! \brief Handle of a request sent with ThreadSafeAsyncSerial::sendRequest
+typedef QSharedPointer<SerialRequest> SerialRequestPtr;
+class ThreadSafeAsyncSerial;
+
+/*! \brief Keeps the link to the device up.
+
+  Opens the port and confirms the device is running by echo requests
+  instead of waiting a fixed boot time, then checks it with a heartbeat.
+  When the port hangs up, the handshake times out or the device misses
+  DEFAULT_LINK_HEARTBEAT_MISSES heartbeats, the port is reopened, which
+  usually restarts the device. A device that keeps running goes back to
+  BAUD_RATE_BOOT by itself once it received no valid frame for
+  BAUD_RATE_IDLE_TIMEOUT, well within the handshake. Failed attempts are retried after a delay doubling
+  from DEFAULT_LINK_RETRY_MIN up to DEFAULT_LINK_RETRY_MAX. A device that
+  re-enumerated under another /dev/ttyACM* name is picked up as well.
+
+  Once the device answers at BAUD_RATE_BOOT the link is switched to the rate
+  set by LinkManager::setBaudRate as part of the handshake, step by step on
+  the timer so the calling thread never waits for the device. If the device
+  refuses the rate or does not answer at it, the handshake continues at
+  BAUD_RATE_BOOT.
+*/
+class LinkManager : public QObject
+{
+    Q_OBJECT
+public:
+    enum State
+    {
+        Disconnected,   //!< No usable port, waiting for the next attempt
+        Connecting,     //!< Port open, waiting for the device to answer an echo
+        Connected       //!< The device answers, requests are allowed
+    };
+
+    explicit LinkManager(ThreadSafeAsyncSerial *serial, QObject *parent = 0);
+
+    //! \brief Connects to the device on \a tty, dropping the current link
+    void open(const std::string &tty);
+    //! \brief Sets the rate (baud) the link is switched to on the next connect
+    void setBaudRate(int baud);
+    State state() const;
+    //! \brief Returns the port the device was last found on
+    std::string port() const;
+
+signals:
+    void StateChanged(LinkManager::State state);
+
+public slots:
+    //! \brief Drops the link after the port hung up, see ThreadSafeAsyncSerial::Disconnected
+    void processPortLost();
+
+private slots:
+    void m_tick();
+
+private:
+    //! \brief Steps of the handshake while LinkManager::Connecting
+    enum Handshake
+    {
+        Probing,        //!< Waiting for an echo at the current rate
+        SwitchingRate,  //!< Waiting for the device to acknowledge MESSAGE_SET_BAUD_RATE
+        ConfirmingRate  //!< Port switched, waiting for an echo at the new rate
+    };
+
+    //! \brief Opens the configured port, or another ttyACM, and starts the handshake
+    bool m_connectPort();
+    //! \brief Advances the handshake, called by LinkManager::m_tick while connecting
+    void m_handshake();
+    //! \brief Goes back to probing at BAUD_RATE_BOOT after the rate could not be switched
+    void m_abortRateSwitch();
+    //! \brief Gives up on the current attempt and schedules the next one
+    void m_retryLater();
+    void m_setState(State state);
+
+    ThreadSafeAsyncSerial *m_serial;
+    std::string m_tty;          //!< Configured port
+    std::string m_activePort;   //!< Port the device was last opened on
+    State m_state;
+    Handshake m_handshakeStep;
+    int m_baudRate;             //!< Rate the link is switched to once the device answers
+    bool m_rateSwitchFailed;    //!< Stay at BAUD_RATE_BOOT until the port is reopened
+    QTimer m_timer;             //!< Drives the handshake, heartbeat and retries
+    QElapsedTimer m_stateTimer; //!< Started when the handshake started
+    SerialRequestPtr m_probe;   //!< Last echo or MESSAGE_SET_BAUD_RATE request sent
+    int m_missedHeartbeats;
+    int m_retryDelay;           //!< Delay (ms) before the next retry
+};
 
 class HardwareManager : public QObject
 {
@@ -29,6 +145,8 @@ signals:
     void RequestingHPosition(int h);
     void RequestingVPosition(int v);
 
+    void LinkStateChanged(LinkManager::State state);
+
 public slots:
     bool SetManualMode(bool manual_mode = true);
 
@@ -52,6 +170,8 @@ public slots:
 
     /*! \brief Set serial port to use for Arduino communication */
     void SetSerialPort(std::string &port);
+    /*! \brief Set the rate (baud) to switch the Arduino link to, see HardwareComm::setBaudRate */
+    void SetBaudRate(int baud);
 
     void positionHReached(qreal pos);
     void positionVReached(qreal pos);
@@ -86,8 +206,6 @@ public:
     static const qreal DefaultVTolerance = 6.0;
 };
 
-class ThreadSafeAsyncSerial;
-
 class HardwareComm : public QObject
 {
     Q_OBJECT
@@ -114,14 +232,53 @@ public:
             };
         }params;
     };
+    /*! \brief Returns the last known horizontal position (0 .. 255), -1 if unknown
+      Never touches the serial port and may be called from any thread. The
+      position is kept current by the stream HardwareComm::subscribePosition
+      sets up, or by the answers to position requests.
+    */
     qreal positionH() const;
+    //! \brief Returns the last known vertical position (0 .. 255), -1 if unknown, see HardwareComm::positionH
     qreal positionV() const;
 
-    qreal retrievePositionH();
-    qreal retrievePositionV();
+    /*! \brief Asks the device for both positions without waiting for the answer
+      HardwareComm::positionH and HardwareComm::positionV are updated when it
+      arrives. Only one such request is outstanding at a time.
+      \returns false if the request could not be sent or one is still outstanding
+    */
+    bool requestPosition();
+
+    /*! \brief Makes the device stream its position
+      The device samples its position every \a intervalMs and sends it when
+      either axis moved by more than \a deadband since the last update. Done
+      automatically once the device is ready; devices that do not support
+      streaming keep being polled.
+      \param intervalMs Sample interval (10 .. 2550 ms), 0 stops streaming
+      \param deadband Change (0 .. 255) that triggers an update, 0 sends every sample
+      \returns false if the request could not be sent
+    */
+    bool subscribePosition(int intervalMs = DEFAULT_POSITION_STREAM_INTERVAL,
+                           int deadband = DEFAULT_POSITION_STREAM_DEADBAND);
+    //! \brief Returns true while the device streams its position
+    bool isPositionStreaming() const;
+
+    /*! \brief Sets the targets of both axes and asks for the position in a single round trip
+      The position is reported as with HardwareComm::requestPosition.
+      \param hPosition Horizontal target (0 .. 255), negative leaves the axis alone
+      \param vPosition Vertical target (0 .. 255), negative leaves the axis alone
+      \returns false if the request could not be sent
+    */
+    bool adjustPosition(int hPosition, int vPosition);
 
     bool isReady() const;
 
+    /*! \brief Sets the rate (baud) the link is switched to once the device is ready
+      The device always starts at BAUD_RATE_BOOT, the link stays there if the
+      rate cannot be negotiated. Takes effect on the next connect, see
+      LinkManager::setBaudRate.
+    */
+    void setBaudRate(int baud);
+
 public slots:
     bool setVerticalPosition(quint8 position);
     bool setHorizontalPosition(quint8 position);
@@ -129,8 +286,20 @@ public slots:
     bool enableManualControls(bool enable = true);
 
     void processAsyncEvent(HardwareComm::Message msg);
+    void processResponse(HardwareComm::Message request, HardwareComm::Message response);
+    /*! \brief Stores the positions carried by \a msg
+      Connected directly to the reader thread of the serial port, so cached
+      positions never wait for the event loop of this object.
+    */
+    void cachePosition(HardwareComm::Message msg);
+    /*! \brief Stores the positions carried by the answer \a response to \a request
+      Connected directly to ThreadSafeAsyncSerial::ResponseReceived, see HardwareComm::cachePosition.
+    */
+    void cacheResponse(HardwareComm::Message request, HardwareComm::Message response);
+    void processFailedRequest(HardwareComm::Message request);
     void setSerialTTY(const std::string &tty);
-    void setCommReady();
+    //! \brief Sets the device up once the link is connected, forgets its state when it drops
+    void processLinkState(LinkManager::State state);
 
 signals:
     void verticalPositionChanged(qreal position);
@@ -141,58 +310,245 @@ signals:
 
     void modeSwitchTriggered();
 
+    //! \brief Emitted once the device is connected and set up
     void CommReady();
+    void LinkStateChanged(LinkManager::State state);
 
 private:
     bool m_setPositionHelper(quint16 msg, quint8 position);
-    qreal m_hPosition;
-    qreal m_vPosition;
+    //! \brief Records the time since \a moveTimer was started as Metrics::ActuatorTimeToTarget
+    void m_recordTimeToTarget(QElapsedTimer &moveTimer);
+    QAtomicInt m_position;  //!< Last known position, horizontal << 8 | vertical, -1 if unknown
+    bool m_positionStreaming;   //!< The device acknowledged the position subscription
 
     ThreadSafeAsyncSerial *m_serialComm;
     QThread *m_serialCommThread;
-    QTimer *m_timer;
+    LinkManager *m_link;
+    QElapsedTimer m_hMoveTimer; //!< Started when a horizontal position is requested, invalid once reached
+    QElapsedTimer m_vMoveTimer; //!< Started when a vertical position is requested, invalid once reached
+    SerialRequestPtr m_positionRequest; //!< Last request sent by HardwareComm::requestPosition
 };
 
 Q_DECLARE_METATYPE(HardwareComm::Message)
 
-Serial& operator<<(Serial& serial, const HardwareComm::Message &msg);
-Serial& operator>>(Serial& serial, HardwareComm::Message &msg);
+/*! \brief Frames messages for the wire and decodes received frames.
+
+  Implements the v2 framing described in CommunicationProtocol.h. A frame
+  with a bad length or CRC costs only its start byte: decoding continues at
+  the next start byte, so a dropped or corrupted byte loses at most the
+  frames it touches instead of desynchronizing the link.
+*/
+class FrameCodec
+{
+public:
+    FrameCodec();
+
+    /*! \brief Writes the frame carrying \a msg with sequence ID \a sequence to \a frame
+      \param frame Buffer of at least FRAME_MAX_SIZE bytes
+      \returns The size of the frame
+    */
+    static int encode(quint8 sequence, const HardwareComm::Message &msg, char *frame);
+
+    /*! \brief Takes the next complete frame out of the read buffer of \a serial
+      Bytes that cannot start a valid frame are skipped, an incomplete frame
+      is left in the buffer until the rest arrived.
+      \returns false if no complete valid frame has been received yet
+    */
+    bool decode(const Serial &serial, quint8 &sequence, HardwareComm::Message &msg);
+
+    //! \brief Returns the number of bytes skipped while resynchronizing
+    quint32 discardedBytes() const;
+
+private:
+    quint32 m_discarded;
+};
+
+/*! \brief A request sent to the device and, once it arrived, its response.
+
+  Shared between the sender and the reader thread of ThreadSafeAsyncSerial,
+  all accessors are thread safe. The sender may poll the request, wait for it
+  or drop the handle and react to ThreadSafeAsyncSerial::ResponseReceived.
+*/
+class SerialRequest
+{
+public:
+    enum State
+    {
+        Pending,    //!< Waiting for the response
+        Completed,  //!< The response arrived, see SerialRequest::response
+        TimedOut,   //!< No response within the timeout
+        Failed      //!< Not sent, or the port was closed before the response arrived
+    };
+
+    SerialRequest(quint32 sequence, const HardwareComm::Message &request, int timeoutMs);
+
+    //! \brief Returns the number of the request, increasing in the order requests were sent
+    quint32 sequence() const;
+    //! \brief Returns the sequence ID (1 .. 255) the request and its response carry on the wire
+    quint8 frameSequence() const;
+    //! \brief Returns the message that was sent
+    HardwareComm::Message request() const;
+    State state() const;
+    //! \brief Returns true unless the request is still pending
+    bool isFinished() const;
+    //! \brief Returns the response, only meaningful once the request is completed
+    HardwareComm::Message response() const;
+
+    /*! \brief Blocks until the request is finished
+      Never waits much longer than the timeout of the request.
+      \returns false if \a timeoutMs passed first
+    */
+    bool waitForFinished(unsigned long timeoutMs = ULONG_MAX);
+
+private:
+    friend class ThreadSafeAsyncSerial;
+
+    /*! \brief Moves a pending request to \a state
+      \returns false if the request was already finished
+    */
+    bool finish(State state, const HardwareComm::Message &response = HardwareComm::Message());
+    //! \brief Returns the time (ms) since the request was sent
+    qint64 elapsed() const;
+    //! \brief Returns the timeout (ms) of the request
+    int timeout() const;
+
+    const quint32 m_sequence;
+    const HardwareComm::Message m_request;
+    const int m_timeout;
+    QElapsedTimer m_timer;          //!< Started when the request was created
+    State m_state;
+    HardwareComm::Message m_response;
+    mutable QMutex m_mutex;
+    QWaitCondition m_finished;
+};
 
+/*! \brief Exchanges messages with the device on a dedicated reader thread.
+
+  Requests are written by the calling thread and never wait for their
+  response. Several requests may be outstanding at once (pipelining). Every
+  frame carries the sequence ID of its request (see FrameCodec), so a
+  response completes exactly the request it answers, in whatever order
+  responses and async messages arrive; a lost response only times out its
+  own request.
+
+  Requests that get no answer within their timeout are finished as timed out
+  but stay queued for a while, so their sequence ID is not reused while a
+  late response may still arrive.
+
+  The reader thread reads whenever the port is open and owns the port once
+  it runs: ThreadSafeAsyncSerial::openSerialTTY and ThreadSafeAsyncSerial::stop
+  wake it up and it reopens or returns at once. When the port hangs up,
+  e.g. the device was unplugged, the reader closes it and emits
+  Disconnected; bringing it back is up to LinkManager.
+*/
 class ThreadSafeAsyncSerial : public QObject
 {
     Q_OBJECT
 public:
     explicit ThreadSafeAsyncSerial(QObject *parent = 0);
+    ~ThreadSafeAsyncSerial();
+
+    /*! \brief Sends \a msg without waiting for the response
+      \param timeoutMs Time the response may take
+      \returns The request, already failed if the device is not ready, too many
+                requests are outstanding or the message could not be written
+    */
+    SerialRequestPtr sendRequest(const HardwareComm::Message &msg, int timeoutMs = DEFAULT_SERIAL_TIMEOUT);
+    /*! \brief Sends MESSAGE_ECHO_REQUEST, even before the device is ready
+      Used to find out if the device is there, see ThreadSafeAsyncSerial::sendRequest.
+    */
+    SerialRequestPtr ping(int timeoutMs = DEFAULT_SERIAL_TIMEOUT);
+
+    /*! \brief Sends \a msg and blocks until the response arrives or the request times out
+      \returns false if no response was received
+    */
     bool sendMessage(const HardwareComm::Message &msg, HardwareComm::Message &response);
     bool isReady() const;
 
+    /*! \brief Asks the device to switch to \a baud, even before the device is ready
+      Once the request is acknowledged the port has to follow with
+      ThreadSafeAsyncSerial::setPortBaudRate and a valid frame has to reach
+      the device within BAUD_RATE_CONFIRM_TIMEOUT, or it returns to BAUD_RATE_BOOT.
+      \returns The request, already failed if neither side supports \a baud
+    */
+    SerialRequestPtr requestBaudRate(int baud);
+    //! \brief Switches the port, but not the device, to \a baud
+    bool setPortBaudRate(int baud);
+    //! \brief Returns the rate (baud) the port is currently set to
+    int portBaudRate() const;
+
+    /*! \brief Switches the device and the port to \a baud
+      Blocks until the device acknowledged the rate and answered an echo at
+      it, for tools without an event loop; the application switches through
+      LinkManager instead. On failure the port returns to BAUD_RATE_BOOT, the
+      device follows within BAUD_RATE_CONFIRM_TIMEOUT and misses what is sent
+      until then.
+      \returns false if the link did not end up at \a baud
+    */
+    bool negotiateBaudRate(int baud);
+
+    //! \brief Returns true if \a response can be the answer of the device to \a request
+    static bool isResponseTo(const HardwareComm::Message &request, const HardwareComm::Message &response);
+
 public slots:
     void begin();
     void stop();
 
+    /*! \brief Opens \a tty, closing the port in use
+      Blocks until the reader thread, if running, reopened the port. The
+      device is not ready again until ThreadSafeAsyncSerial::setReady.
+      \returns false if the port could not be opened
+    */
     bool openSerialTTY(const std::string &tty);
-    void setReady();
+    //! \brief Allows requests other than ThreadSafeAsyncSerial::ping, or refuses them again
+    void setReady(bool ready = true);
 
 signals:
     void AsyncMessage(HardwareComm::Message msg);
+    //! \brief Emitted by the reader thread when a request is completed
+    void ResponseReceived(HardwareComm::Message request, HardwareComm::Message response);
+    //! \brief Emitted by the reader thread when a sent request times out or fails
+    void RequestFailed(HardwareComm::Message request);
+    //! \brief Emitted by the reader thread when the port hung up or failed and was closed
+    void Disconnected();
     void finished();
 
 
 private:
+    //! \brief Completes the request with sequence ID \a sequence answered by \a response
+    void completeRequest(quint8 sequence, const HardwareComm::Message &response);
+    //! \brief Times out overdue requests and forgets the ones no late response is expected for
+    void expireRequests();
+    //! \brief Fails every outstanding request
+    void failRequests();
+    //! \brief Queues and writes \a msg, refused unless the device is ready if \a requireReady
+    SerialRequestPtr queueRequest(const HardwareComm::Message &msg, int timeoutMs, bool requireReady);
+    /*! \brief Blocks the reader while no port is open, handling reopen requests
+      \returns false once the reader is asked to stop
+    */
+    bool waitForPort();
+    //! \brief Opens \a tty in place of the current port, call with m_stateMutex locked
+    bool reopenPort(const std::string &tty);
+    //! \brief Closes the port after it hung up and fails the outstanding requests
+    void closeLostPort();
+
     bool m_ceaseRequested;
 
     Serial *m_serial;
+    FrameCodec m_codec;     //!< Decodes the bytes read by the reader thread
 
-    struct Sender
-    {
-        QWaitCondition cond;
-        HardwareComm::Message response;
-    };
-    QQueue<Sender*> m_senderQueue;
+    QList<SerialRequestPtr> m_pending;  //!< Requests sent and not yet answered, oldest first
+    quint32 m_nextSequence;
     QMutex m_queueMutex;
 
     bool m_isReady;
-    QMutex m_readyMutex;
+    bool m_running;             //!< The reader thread is in ThreadSafeAsyncSerial::begin
+    bool m_portOpen;
+    bool m_reopenRequested;     //!< ThreadSafeAsyncSerial::openSerialTTY waits for the reader to open m_requestedTTY
+    bool m_reopenResult;
+    std::string m_requestedTTY;
+    QMutex m_stateMutex;        //!< Guards the state above, always taken before m_queueMutex
+    QWaitCondition m_stateChanged;
 
 };
 
@@ -10,7 +10,7 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationDomain("lockheedmartin.com");
     QCoreApplication::setApplicationName("Inanimation");
 
-    qRegisterMetaType<QImageSharedPointer>("QImageSharedPointer");
+    qRegisterMetaType<VideoFrame>("VideoFrame");
     MainWindow w;
     w.show();
 
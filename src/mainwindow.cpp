@@ -2,32 +2,59 @@
 #include "ui_mainwindow.h"
 #include "facetracker.h"
 #include <QPainter>
-#include <QTime>
 #include <QState>
+#include <QSettings>
+#include <QElapsedTimer>
 #if defined(DEBUG_MODE_SWITCHING)
 #include <QDebug>
 #endif
 
+namespace
+{
+//! Opens the frame source named in the settings, the first camera by default
+FaceTracker *CreateFaceTracker()
+{
+    QSettings settings;
+    return new FaceTracker(settings.value("capture/source", "camera:0").toString().toStdString());
+}
+}
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow), ft(new FaceTracker(0)), pu(new PositionUpdater(ft)),
+    ui(new Ui::MainWindow), ft(CreateFaceTracker()), pu(new PositionUpdater(ft)),
     m_stateMachine(new QStateMachine(this)), m_hardwareManager(new HardwareManager(this)),
-    m_ad(NULL), m_isFullScreen(false)
+    m_ad(NULL), m_md(NULL), m_metricsLogger(new MetricsLogger(this)), m_isFullScreen(false)
 {
     ui->setupUi(this);
 
+    //Field units can change where and how often statistics get dumped without rebuilding
+    QSettings settings;
+    m_metricsLogger->Start(settings.value("metrics/dumpFile", MetricsLogger::DefaultFilename()).toString(),
+                           settings.value("metrics/dumpInterval", DEFAULT_METRICS_DUMP_INTERVAL).toInt());
+
     ft->SetMinFeatureSize(10);
-    ft->SetProcessingImageDimensions(320,240);
-    ft->SetSearchScaleFactor(1.2f);
+    ft->SetCaptureDimensions(640,480);
+    //Lets other processes use the camera while the application runs, off by default
+    ft->SetSharedMemoryName(settings.value("capture/publish").toString().toStdString());
+    //Upper bound, the scheduler lowers resolution and accuracy until detection keeps up
+    ft->SetProcessingImageDimensions(640,480);
+    ft->SetDetectionThreadCount(QThread::idealThreadCount());
+    ft->SetRegionOfInterestTracking(true);
+    ft->SetDetectionInterval(3);
+    ft->SetMotionGating(true);
+    ft->SetTargetFrameTime(settings.value("tracking/frameBudget", DEFAULT_TARGET_FRAME_TIME).toFloat());
+    ft->SetAdaptiveScheduling(true);
+    pu->SetPredictionLead(settings.value("tracking/predictionLead", DEFAULT_PREDICTION_LEAD).toInt());
+    m_hardwareManager->SetBaudRate(settings.value("serial/baudRate", DEFAULT_SERIAL_BAUD_RATE).toInt());
 
     connect(ui->gvFaceInvaders, SIGNAL(ceaseImageUpdates()), this, SLOT(disableFaceImageUpdates()));
     connect(ui->gvFaceInvaders, SIGNAL(faceImageUpdatesRequest()), this, SLOT(enableFaceImageUpdates()));
 
-    connect(pu, SIGNAL(UpdateFullImage(QImageSharedPointer)),
-            this, SLOT(UpdateImage(QImageSharedPointer)));
+    connect(pu, SIGNAL(UpdateFullImage(VideoFrame)),
+            this, SLOT(UpdateImage(VideoFrame)));
 
-    connect(pu, SIGNAL(UpdateFaceImage(QImageSharedPointer)),
-            this, SLOT(UpdateFace(QImageSharedPointer)));
+    connect(pu, SIGNAL(UpdateFaceImage(VideoFrame)),
+            this, SLOT(UpdateFace(VideoFrame)));
 
     m_puThread = new QThread(this);
     connect(m_puThread, SIGNAL(started()), pu, SLOT(run()), Qt::QueuedConnection);
@@ -43,6 +70,7 @@ MainWindow::MainWindow(QWidget *parent) :
 
     connect(ui->actionFullScreen, SIGNAL(triggered()), this, SLOT(fullScreenToggle()));
     connect(ui->actionAboutDialog, SIGNAL(triggered()), this, SLOT(displayAbout()));
+    connect(ui->actionPerformanceStatistics, SIGNAL(triggered()), this, SLOT(displayMetrics()));
 
     //debugging signal/slots
     connect(m_hardwareManager, SIGNAL(PositionHUpdate(int)), ui->lblHPos, SLOT(setNum(int)));
@@ -79,36 +107,46 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
-void MainWindow::UpdateImage(QImageSharedPointer image)
+void MainWindow::UpdateImage(VideoFrame image)
 {
-    if(image.data() == NULL)
+    if(image.IsNull())
         return;
 
-    ui->label->setPixmap(QPixmap::fromImage(*image));
+    QPixmap pixmap = QPixmap::fromImage(image.GetImage());
+    if(image.GetFaceRect().isValid())
+    {
+        QPainter p;
+        p.begin(&pixmap);
+        p.setPen(QPen(Qt::red));
+        p.drawRect(image.GetFaceRect());
+        p.end();
+    }
+
+    ui->label->setPixmap(pixmap);
 }
 
-void MainWindow::UpdateFace(QImageSharedPointer image)
+void MainWindow::UpdateFace(VideoFrame image)
 {
-    if(image.data() == NULL)
+    if(image.IsNull())
         return;
 
-    ui->label_3->setPixmap(QPixmap::fromImage(*image));
+    ui->label_3->setPixmap(QPixmap::fromImage(image.GetImage()));
 }
 
 void MainWindow::enableFaceImageUpdates()
 {
     pu->EnableFaceOnlyUpdates();
 
-    connect(pu, SIGNAL(UpdateFaceImage(QImageSharedPointer)),
-            ui->gvFaceInvaders, SLOT(updatePlayerImage(QImageSharedPointer)), Qt::UniqueConnection);
+    connect(pu, SIGNAL(UpdateFaceImage(VideoFrame)),
+            ui->gvFaceInvaders, SLOT(updatePlayerImage(VideoFrame)), Qt::UniqueConnection);
 }
 
 void MainWindow::disableFaceImageUpdates()
 {
     pu->EnableFaceOnlyUpdates(false);
 
-    disconnect(pu, SIGNAL(UpdateFaceImage(QImageSharedPointer)),
-               ui->gvFaceInvaders, SLOT(updatePlayerImage(QImageSharedPointer)));
+    disconnect(pu, SIGNAL(UpdateFaceImage(VideoFrame)),
+               ui->gvFaceInvaders, SLOT(updatePlayerImage(VideoFrame)));
 }
 
 void MainWindow::enterAutomaticMode()
@@ -198,6 +236,17 @@ void MainWindow::displayAbout()
         m_ad->show();
 }
 
+void MainWindow::displayMetrics()
+{
+    if(m_md == NULL)
+        m_md = new MetricsDialog(this);
+
+    if(m_md->isVisible())
+        m_md->hide();
+    else
+        m_md->show();
+}
+
 void MainWindow::fullScreenToggle()
 {
     if(m_isFullScreen)
@@ -216,9 +265,9 @@ void MainWindow::closeEvent(QCloseEvent *)
 }
 
 
-PositionUpdater::PositionUpdater() : QObject(), m_updateMask(0x01) { }
+PositionUpdater::PositionUpdater() : QObject(), m_updateMask(0x01), m_predictionLead(-1) { }
 PositionUpdater::PositionUpdater(FaceTracker *ft, QObject *parent):
-    QObject(parent), m_ft(ft), stopped(false), m_quitRequested(false) { }
+    QObject(parent), m_ft(ft), stopped(false), m_quitRequested(false), m_predictionLead(-1) { }
 
 void PositionUpdater::PauseThread()
 {
@@ -270,6 +319,11 @@ void PositionUpdater::EnableFaceHighlighting(bool enable)
         m_updateMask &= ~(static_cast<quint8>(1)<<3);
 }
 
+void PositionUpdater::SetPredictionLead(int leadMs)
+{
+    m_predictionLead = leadMs;
+}
+
 void PositionUpdater::Quit()
 {
     m_quitRequested = true;
@@ -279,16 +333,14 @@ void PositionUpdater::Quit()
 
 void PositionUpdater::run()
 {
-#ifdef DEBUG_REPORT_FPS
-    QTime time;
-    time.start();
-    int counter = 0;
-#endif
+    QElapsedTimer loopTimer;
     while(!m_quitRequested)
     {
         mutex.lock();
         if(stopped)
         {
+            //Time spent paused is not part of the loop period
+            loopTimer.invalidate();
 #ifdef DEBUG_QTHREADS
             qDebug() << "Sleeping pu...";
 #endif
@@ -301,48 +353,36 @@ void PositionUpdater::run()
         }
         mutex.unlock();
 
-#ifdef DEBUG_REPORT_FPS
-        counter++;
-        if(counter == 30)
-        {
-            qDebug() << "FPS: " << 1000*30.0f/time.elapsed();
-            counter = 0;
-            time.restart();
-        }
-#endif
+        if(loopTimer.isValid())
+            Metrics::RecordElapsed(Metrics::TrackerLoopPeriod, loopTimer);
+        loopTimer.start();
 
-        QImage *fullImage = NULL;
-        QImage *faceImage = NULL;
+        VideoFrame frame;
         QRect facePosition = m_ft->GetFacePosition(true);
+        //Where the face is by the time the position is acted on, not where it was when captured
+        if(facePosition.isValid() && m_predictionLead >= 0)
+            facePosition = m_ft->GetPredictedPosition(FrameGrabber::Timestamp() + m_predictionLead, true);
         if((m_updateMask & static_cast<quint8>(1U<<1))
                 || (m_updateMask & static_cast<quint8>(1U<<2)))
         {
-            fullImage = m_ft->GetLastImage();
-        }
-        if(m_updateMask & static_cast<quint8>(1U<<1))
-        {
-            faceImage = new QImage(fullImage->copy(m_ft->GetLastPosition()));
-        }
-        if((m_updateMask & static_cast<quint8>(1U<<3)) && fullImage != NULL)
-        {
-            QPainter p;
-            p.begin(fullImage);
-            p.setPen(QPen(Qt::red));
-            p.drawRect(m_ft->GetLastPosition());
-            p.end();
+            frame = m_ft->GetLastFrame();
         }
+        //A null frame means the GUI still holds every pooled buffer, skip the
+        //image updates instead of queuing more of them
+        bool imageAvailable = !frame.IsNull();
 
         if(m_updateMask & static_cast<quint8>(0x01U) && facePosition.isValid())
             emit UpdatePosition(facePosition);
-        if(m_updateMask & static_cast<quint8>(0x01U<<1))
+        if((m_updateMask & static_cast<quint8>(0x01U<<1)) && imageAvailable)
         {
-            QImageSharedPointer imagePtr(faceImage);
-            emit UpdateFaceImage(imagePtr);
+            emit UpdateFaceImage(frame.GetFaceFrame());
         }
-        if(m_updateMask & static_cast<quint8>(0x01U<<2))
+        if((m_updateMask & static_cast<quint8>(0x01U<<2)) && imageAvailable)
         {
-            QImageSharedPointer imagePtr(fullImage);
-            emit UpdateFullImage(imagePtr);
+            //The face is highlighted by the receiver, only if a rectangle is attached
+            if(!(m_updateMask & static_cast<quint8>(1U<<3)))
+                frame.SetFaceRect(QRect());
+            emit UpdateFullImage(frame);
         }
     }
 #ifdef DEBUG_QTHREADS
@@ -10,6 +10,10 @@
 #include <QMutex>
 #include <QStateMachine>
 #include "aboutdialog.h"
+#include "metricsdialog.h"
+
+//! \brief Default time (ms) past the current time face positions are predicted for, negative disables prediction
+#define DEFAULT_PREDICTION_LEAD         0
 
 namespace Ui {
 class MainWindow;
@@ -27,8 +31,8 @@ public:
 
 
 public slots:
-    void UpdateImage(QImageSharedPointer image);
-    void UpdateFace(QImageSharedPointer image);
+    void UpdateImage(VideoFrame image);
+    void UpdateFace(VideoFrame image);
 
     void enableFaceImageUpdates();
     void disableFaceImageUpdates();
@@ -42,6 +46,7 @@ public slots:
 
     void modeSwitched();
     void displayAbout();
+    void displayMetrics();
     void fullScreenToggle();
 
 signals:
@@ -59,6 +64,8 @@ private:
     QStateMachine *m_stateMachine;
     HardwareManager *m_hardwareManager;
     AboutDialog *m_ad;
+    MetricsDialog *m_md;
+    MetricsLogger *m_metricsLogger;
     bool m_isFullScreen;
 };
 
@@ -74,9 +81,14 @@ public:
     void EnablePositionUpdates(bool enable = true);
     void EnableFaceOnlyUpdates(bool enable = true);
     void EnableFaceHighlighting(bool enable = true);
+    /*! \brief Emits positions predicted \a leadMs past the current time instead of measured ones
+      \param leadMs Lead time, negative to emit the measured positions
+      \sa FaceTracker::GetPredictedPosition
+    */
+    void SetPredictionLead(int leadMs);
 signals:
-    void UpdateFullImage(QImageSharedPointer image);
-    void UpdateFaceImage(QImageSharedPointer image);
+    void UpdateFullImage(VideoFrame image);
+    void UpdateFaceImage(VideoFrame image);
     void UpdatePosition(QRect rect);
 
 public slots:
@@ -97,6 +109,7 @@ private:
     */
     quint8 m_updateMask;
     bool m_quitRequested;
+    int m_predictionLead;   //!< See PositionUpdater::SetPredictionLead
 };
 
 #endif // MAINWINDOW_H
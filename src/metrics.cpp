@@ -0,0 +1,232 @@
+#include "metrics.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+MetricHistogram Metrics::s_histograms[Metrics::MetricCount];
+
+namespace
+{
+//! Index of the bucket holding \a value, the number of significant bits
+int BucketIndex(quint32 value)
+{
+    int index = 0;
+    while(value != 0 && index < METRICS_BUCKET_COUNT - 1)
+    {
+        value >>= 1;
+        index++;
+    }
+    return index;
+}
+
+//! Smallest value held by the bucket at \a index
+double BucketLow(int index)
+{
+    return index == 0 ? 0.0 : (double)(1U << (index - 1));
+}
+}
+
+MetricSnapshot::MetricSnapshot() :
+    count(0), sum(0), last(0)
+{
+    for(int i = 0; i < METRICS_BUCKET_COUNT; i++)
+        buckets[i] = 0;
+}
+
+double MetricSnapshot::Mean() const
+{
+    if(count == 0)
+        return 0.0;
+    return (double)sum/count;
+}
+
+double MetricSnapshot::Percentile(double fraction) const
+{
+    if(count == 0)
+        return 0.0;
+
+    double target = fraction*count;
+    double seen = 0;
+    for(int i = 0; i < METRICS_BUCKET_COUNT; i++)
+    {
+        if(buckets[i] == 0)
+            continue;
+        if(seen + buckets[i] >= target)
+        {
+            double low = BucketLow(i);
+            double high = (double)(1U << i);
+            return low + (high - low)*(target - seen)/buckets[i];
+        }
+        seen += buckets[i];
+    }
+    return (double)(1U << (METRICS_BUCKET_COUNT - 1));
+}
+
+MetricSnapshot MetricSnapshot::operator-(const MetricSnapshot &older) const
+{
+    //Unsigned arithmetic keeps the difference correct across a wrap around
+    MetricSnapshot result;
+    result.count = count - older.count;
+    result.sum = sum - older.sum;
+    result.last = last;
+    for(int i = 0; i < METRICS_BUCKET_COUNT; i++)
+        result.buckets[i] = buckets[i] - older.buckets[i];
+    return result;
+}
+
+MetricHistogram::MetricHistogram()
+{
+}
+
+void MetricHistogram::Record(qint64 microseconds)
+{
+    quint32 value = microseconds < 0 ? 0 : (quint32)qMin(microseconds, (qint64)0x7FFFFFFF);
+
+    m_buckets[BucketIndex(value)].fetchAndAddRelaxed(1);
+    m_sum.fetchAndAddRelaxed((int)value);
+    m_last.fetchAndStoreRelaxed((int)value);
+    //Counted last so a reader never sees more samples than were bucketed
+    m_count.fetchAndAddRelease(1);
+}
+
+MetricSnapshot MetricHistogram::Snapshot() const
+{
+    MetricSnapshot snapshot;
+    snapshot.count = (quint32)(int)m_count;
+    snapshot.sum = (quint32)(int)m_sum;
+    snapshot.last = (quint32)(int)m_last;
+    for(int i = 0; i < METRICS_BUCKET_COUNT; i++)
+        snapshot.buckets[i] = (quint32)(int)m_buckets[i];
+    return snapshot;
+}
+
+void Metrics::Record(Metric metric, qint64 microseconds)
+{
+    s_histograms[metric].Record(microseconds);
+}
+
+void Metrics::RecordElapsed(Metric metric, const QElapsedTimer &timer)
+{
+    s_histograms[metric].Record(timer.nsecsElapsed()/1000);
+}
+
+MetricSnapshot Metrics::Snapshot(Metric metric)
+{
+    return s_histograms[metric].Snapshot();
+}
+
+const char *Metrics::Name(Metric metric)
+{
+    switch(metric)
+    {
+    case CaptureTime:
+        return "Capture";
+    case PreprocessTime:
+        return "Preprocess";
+    case DetectTime:
+        return "Detect";
+    case TrackerLoopPeriod:
+        return "Tracker loop";
+    case SerialRoundTrip:
+        return "Serial round trip";
+    case ActuatorTimeToTarget:
+        return "Actuator to target";
+    default:
+        return "Unknown";
+    }
+}
+
+MetricsWindow::MetricsWindow()
+{
+    m_timer.start();
+}
+
+QString MetricsWindow::Update()
+{
+    double seconds = m_timer.restart()/1000.0;
+
+    QString report;
+    QTextStream out(&report);
+    out << qSetFieldWidth(20) << left << "Metric" << qSetFieldWidth(10) << right
+        << "Count" << "Rate/s" << "Mean ms" << "p50 ms" << "p95 ms" << "p99 ms" << "Last ms"
+        << qSetFieldWidth(0) << "\n";
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+
+    for(int i = 0; i < Metrics::MetricCount; i++)
+    {
+        Metrics::Metric metric = static_cast<Metrics::Metric>(i);
+        MetricSnapshot current = Metrics::Snapshot(metric);
+        MetricSnapshot window = current - m_previous[i];
+        m_previous[i] = current;
+
+        out << qSetFieldWidth(20) << left << Metrics::Name(metric) << qSetFieldWidth(10) << right
+            << window.count;
+        out.setRealNumberPrecision(1);
+        out << (seconds > 0 ? window.count/seconds : 0.0);
+        out.setRealNumberPrecision(2);
+        out << window.Mean()/1000 << window.Percentile(0.50)/1000
+            << window.Percentile(0.95)/1000 << window.Percentile(0.99)/1000
+            << current.last/1000.0 << qSetFieldWidth(0) << "\n";
+    }
+
+    return report;
+}
+
+MetricsLogger::MetricsLogger(QObject *parent) :
+    QObject(parent)
+{
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(Dump()));
+}
+
+bool MetricsLogger::Start(const QString &filename, int intervalMs)
+{
+    Stop();
+    if(intervalMs <= 0)
+        return true;
+
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    m_file.setFileName(filename);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return false;
+
+    m_timer.start(intervalMs);
+    return true;
+}
+
+void MetricsLogger::Stop()
+{
+    m_timer.stop();
+    if(m_file.isOpen())
+        m_file.close();
+}
+
+QString MetricsLogger::DefaultFilename()
+{
+#if QT_VERSION >= 0x050000
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::DataLocation);
+#else
+    QString directory = QDesktopServices::storageLocation(QDesktopServices::DataLocation);
+#endif
+    return QDir(directory).filePath("metrics.log");
+}
+
+void MetricsLogger::Dump()
+{
+    if(!m_file.isOpen())
+        return;
+
+    if(m_file.size() > METRICS_DUMP_FILE_LIMIT)
+        m_file.resize(0);
+
+    QTextStream out(&m_file);
+    out << QDateTime::currentDateTime().toString(Qt::ISODate) << "\n"
+        << m_window.Update() << "\n";
+    out.flush();
+    m_file.flush();
+}
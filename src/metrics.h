@@ -0,0 +1,166 @@
+/*! \file metrics.h
+    \brief Defines the always-on performance counters
+
+    Timing of the capture, detection and hardware paths is recorded into
+    lock-free histograms that can be read at any time without stopping the
+    threads that record them.
+    \sa Metrics, MetricsWindow, MetricsLogger
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QFile>
+#include <QTimer>
+
+//! \brief Number of histogram buckets, bucket i holds samples in [2^(i-1), 2^i) microseconds
+#define METRICS_BUCKET_COUNT            28
+
+//! \brief Default interval (ms) between dumps of MetricsLogger, 0 disables dumping
+#define DEFAULT_METRICS_DUMP_INTERVAL   60000
+
+//! \brief Size (bytes) at which MetricsLogger starts the dump file over
+#define METRICS_DUMP_FILE_LIMIT         (1024*1024)
+
+/*! \brief Copy of a histogram at one point in time.
+
+  Counters are cumulative and wrap around, subtracting an older snapshot from
+  a newer one gives the statistics of the samples recorded in between.
+*/
+struct MetricSnapshot
+{
+    MetricSnapshot();
+
+    quint32 count;                          //!< Number of samples
+    quint32 sum;                            //!< Sum of all samples (us)
+    quint32 last;                           //!< Most recent sample (us)
+    quint32 buckets[METRICS_BUCKET_COUNT];  //!< Number of samples per bucket
+
+    //! \brief Mean of the samples (us)
+    double Mean() const;
+    /*! \brief Estimated percentile of the samples (us)
+      Interpolates within the histogram bucket the percentile falls in.
+      \param fraction Percentile as a fraction (0.0 .. 1.0)
+    */
+    double Percentile(double fraction) const;
+
+    //! \brief Statistics of the samples recorded between \a older and this snapshot
+    MetricSnapshot operator-(const MetricSnapshot &older) const;
+};
+
+/*! \brief Histogram of durations, safe to record into from any thread.
+
+  Recording is a handful of relaxed atomic increments, no locks are taken.
+*/
+class MetricHistogram
+{
+public:
+    MetricHistogram();
+
+    //! \brief Records one sample (us), negative samples are clamped to 0
+    void Record(qint64 microseconds);
+
+    //! \brief Returns the current counters
+    MetricSnapshot Snapshot() const;
+
+private:
+    QAtomicInt m_count;
+    QAtomicInt m_sum;
+    QAtomicInt m_last;
+    QAtomicInt m_buckets[METRICS_BUCKET_COUNT];
+};
+
+/*! \brief Process wide registry of the recorded metrics.
+
+  \code
+  QElapsedTimer timer;
+  timer.start();
+  // Detect faces...
+  Metrics::RecordElapsed(Metrics::DetectTime, timer);
+  \endcode
+*/
+class Metrics
+{
+public:
+    //! \brief Recorded metrics
+    enum Metric
+    {
+        CaptureTime = 0,        //!< Time the camera driver takes to deliver a frame
+        PreprocessTime,         //!< Gray conversion, scaling and equalization of a frame
+        DetectTime,             //!< Face detection or tracking of a frame
+        TrackerLoopPeriod,      //!< Period of the PositionUpdater loop (its rate is the tracker FPS)
+        SerialRoundTrip,        //!< Request sent to the Arduino until its response arrived
+        ActuatorTimeToTarget,   //!< Position requested until the Arduino reported it reached
+        MetricCount
+    };
+
+    //! \brief Records one sample (us) of \a metric
+    static void Record(Metric metric, qint64 microseconds);
+    //! \brief Records the time elapsed on \a timer as one sample of \a metric
+    static void RecordElapsed(Metric metric, const QElapsedTimer &timer);
+
+    //! \brief Returns the current counters of \a metric
+    static MetricSnapshot Snapshot(Metric metric);
+
+    //! \brief Returns a human readable name of \a metric
+    static const char *Name(Metric metric);
+
+private:
+    static MetricHistogram s_histograms[MetricCount];
+};
+
+/*! \brief Formats the metrics recorded since the previous call.
+
+  Every reader keeps its own MetricsWindow, so readers with different
+  intervals do not disturb each other.
+*/
+class MetricsWindow
+{
+public:
+    MetricsWindow();
+
+    /*! \brief Returns a table of the statistics since the last call
+      The first call reports everything recorded since startup.
+    */
+    QString Update();
+
+private:
+    MetricSnapshot m_previous[Metrics::MetricCount];    //!< Counters at the last call
+    QElapsedTimer m_timer;                              //!< Time since the last call
+};
+
+/*! \brief Periodically appends the metrics to a file.
+
+  The file is started over once it grows beyond METRICS_DUMP_FILE_LIMIT.
+*/
+class MetricsLogger : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsLogger(QObject *parent = 0);
+
+    /*! \brief Starts dumping to \a filename every \a intervalMs milliseconds
+      \returns false if the file could not be opened
+    */
+    bool Start(const QString &filename, int intervalMs = DEFAULT_METRICS_DUMP_INTERVAL);
+    //! \brief Stops dumping
+    void Stop();
+
+    //! \brief Default dump file in the application data directory
+    static QString DefaultFilename();
+
+public slots:
+    //! \brief Appends the metrics since the last dump to the file
+    void Dump();
+
+private:
+    QFile m_file;
+    QTimer m_timer;
+    MetricsWindow m_window;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,35 @@
+#include "metricsdialog.h"
+#include "ui_metricsdialog.h"
+
+MetricsDialog::MetricsDialog(QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::MetricsDialog)
+{
+    ui->setupUi(this);
+    connect(ui->buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+}
+
+MetricsDialog::~MetricsDialog()
+{
+    delete ui;
+}
+
+void MetricsDialog::showEvent(QShowEvent *event)
+{
+    //Start a fresh window, samples from while hidden are not interesting
+    m_window.Update();
+    m_timer.start(METRICS_DIALOG_REFRESH_INTERVAL);
+    QDialog::showEvent(event);
+}
+
+void MetricsDialog::hideEvent(QHideEvent *event)
+{
+    m_timer.stop();
+    QDialog::hideEvent(event);
+}
+
+void MetricsDialog::refresh()
+{
+    ui->statistics->setPlainText(m_window.Update());
+}
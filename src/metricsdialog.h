@@ -0,0 +1,40 @@
+#ifndef METRICSDIALOG_H
+#define METRICSDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include "metrics.h"
+
+//! \brief Refresh interval (ms) of the MetricsDialog statistics
+#define METRICS_DIALOG_REFRESH_INTERVAL 1000
+
+namespace Ui {
+class MetricsDialog;
+}
+
+/*! \brief Shows the live performance statistics recorded by Metrics
+  The table is refreshed every METRICS_DIALOG_REFRESH_INTERVAL while the
+  dialog is visible and covers the samples recorded since the last refresh.
+*/
+class MetricsDialog : public QDialog
+{
+    Q_OBJECT
+    
+public:
+    explicit MetricsDialog(QWidget *parent = 0);
+    ~MetricsDialog();
+
+protected:
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+
+private slots:
+    void refresh();
+    
+private:
+    Ui::MetricsDialog *ui;
+    QTimer m_timer;
+    MetricsWindow m_window;
+};
+
+#endif // METRICSDIALOG_H
@@ -0,0 +1,225 @@
+#include "parallelcascadedetector.h"
+#include "cascadecache.h"
+#include <algorithm>
+
+namespace
+{
+//! Orders rectangles so that exact duplicates become neighbours
+bool RectLess(const cv::Rect &a, const cv::Rect &b)
+{
+    if(a.x != b.x)
+        return a.x < b.x;
+    if(a.y != b.y)
+        return a.y < b.y;
+    if(a.width != b.width)
+        return a.width < b.width;
+    return a.height < b.height;
+}
+}
+
+ParallelCascadeDetector::ParallelCascadeDetector() :
+    m_nextWorkItem(0)
+{
+    //Keep the workers alive between frames
+    m_pool.setExpiryTimeout(-1);
+}
+
+ParallelCascadeDetector::~ParallelCascadeDetector()
+{
+    Unload();
+}
+
+bool ParallelCascadeDetector::Load(const std::string &filename, int threadCount)
+{
+    Unload();
+    if(threadCount < 1)
+        threadCount = 1;
+
+    std::vector<cv::CascadeClassifier*> classifiers;
+    for(int i = 0; i < threadCount; i++)
+    {
+        m_classifiers.push_back(new LevelClassifier);
+        classifiers.push_back(m_classifiers.back());
+    }
+
+    //The file is parsed once for all workers. Old format cascades run through
+    //the C API, which has no single scale pass to split up
+    if(!CascadeCache::Load(filename, classifiers) || m_classifiers[0]->isOldFormatCascade())
+    {
+        Unload();
+        return false;
+    }
+
+    for(int i = 0; i < threadCount; i++)
+    {
+        Worker *worker = new Worker(this, m_classifiers[i]);
+        worker->setAutoDelete(false);
+        m_workers.push_back(worker);
+    }
+
+    m_windowSize = m_classifiers[0]->getOriginalWindowSize();
+    m_pool.setMaxThreadCount(threadCount);
+    return true;
+}
+
+void ParallelCascadeDetector::Unload()
+{
+    m_pool.waitForDone();
+
+    for(size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i];
+    for(size_t i = 0; i < m_classifiers.size(); i++)
+        delete m_classifiers[i];
+
+    m_workers.clear();
+    m_classifiers.clear();
+}
+
+bool ParallelCascadeDetector::IsLoaded() const
+{
+    return !m_classifiers.empty();
+}
+
+int ParallelCascadeDetector::GetThreadCount() const
+{
+    return m_classifiers.size();
+}
+
+void ParallelCascadeDetector::DetectMultiScale(const cv::Mat &image, std::vector<cv::Rect> &objects,
+                                               double scaleFactor, int minNeighbors,
+                                               cv::Size minSize, cv::Size maxSize)
+{
+    objects.clear();
+    if(!IsLoaded() || image.empty())
+        return;
+
+    BuildPyramid(image, scaleFactor, minSize, maxSize);
+    if(m_workItems.empty())
+        return;
+
+    m_nextWorkItem.fetchAndStoreOrdered(0);
+    for(size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_workers[i]->candidates.clear();
+        m_pool.start(m_workers[i]);
+    }
+    m_pool.waitForDone();
+
+    //The unscaled level shares its data with the caller's image, do not keep it
+    if(m_levelScales[0] == 1)
+        m_levels[0].release();
+
+    for(size_t i = 0; i < m_workers.size(); i++)
+        objects.insert(objects.end(), m_workers[i]->candidates.begin(),
+                       m_workers[i]->candidates.end());
+
+    //Workers finish in any order, keep the result independent of it
+    std::sort(objects.begin(), objects.end(), RectLess);
+
+    cv::groupRectangles(objects, minNeighbors, CASCADE_GROUP_EPS);
+}
+
+void ParallelCascadeDetector::BuildPyramid(const cv::Mat &image, double scaleFactor,
+                                           cv::Size minSize, cv::Size maxSize)
+{
+    m_workItems.clear();
+    m_levelScales.clear();
+
+    if(maxSize.width <= 0 || maxSize.height <= 0)
+        maxSize = image.size();
+
+    //Same level selection as detectMultiScale() with CASCADE_SCALE_IMAGE
+    for(double factor = 1; ; factor *= scaleFactor)
+    {
+        cv::Size windowSize(cvRound(m_windowSize.width*factor), cvRound(m_windowSize.height*factor));
+        cv::Size levelSize(cvRound(image.cols/factor), cvRound(image.rows/factor));
+
+        if(levelSize.width <= m_windowSize.width || levelSize.height <= m_windowSize.height)
+            break;
+        if(windowSize.width > maxSize.width || windowSize.height > maxSize.height)
+            break;
+        if(windowSize.width < minSize.width || windowSize.height < minSize.height)
+            continue;
+
+        size_t level = m_levelScales.size();
+        if(m_levels.size() <= level)
+            m_levels.push_back(cv::Mat());
+        if(factor == 1)
+            m_levels[level] = image;
+        else
+            cv::resize(image, m_levels[level], levelSize, 0, 0, cv::INTER_LINEAR);
+        m_levelScales.push_back(factor);
+    }
+
+    if(m_levelScales.empty())
+        return;
+
+    //Split levels so that no work item is much larger than a fair share of the
+    //largest level. Stripes start on even rows so a step of 2 hits the same
+    //window rows as in the unsplit level, and each stripe includes the image
+    //rows its last windows reach into
+    int stripeRows = std::max(m_levels[0].rows/(int)m_classifiers.size(), m_windowSize.height);
+    stripeRows += stripeRows % 2;
+    for(size_t level = 0; level < m_levelScales.size(); level++)
+    {
+        const cv::Mat &levelImage = m_levels[level];
+        //Window positions detectMultiScale() evaluates: 0 .. size - window - 1
+        int positions = levelImage.rows - m_windowSize.height;
+        for(int y = 0; y < positions; y += stripeRows)
+        {
+            WorkItem item;
+            item.level = level;
+            item.rows = std::min(stripeRows, positions - y);
+            item.area = cv::Rect(0, y, levelImage.cols, item.rows + m_windowSize.height);
+            m_workItems.push_back(item);
+        }
+    }
+}
+
+void ParallelCascadeDetector::LevelClassifier::DetectLevel(const cv::Mat &image, int rows, int step,
+                                                           std::vector<cv::Rect> &candidates)
+{
+    candidates.clear();
+    std::vector<int> rejectLevels;
+    std::vector<double> levelWeights;
+
+    //A single strip covering all rows, the work is already split across the pool
+    cv::Size processingRectSize(image.cols - getOriginalWindowSize().width, rows);
+    detectSingleScale(image, 1, processingRectSize, rows, step, 1.0,
+                      candidates, rejectLevels, levelWeights);
+}
+
+ParallelCascadeDetector::Worker::Worker(ParallelCascadeDetector *detector,
+                                        LevelClassifier *classifier) :
+    m_detector(detector), m_classifier(classifier)
+{
+}
+
+void ParallelCascadeDetector::Worker::run()
+{
+    std::vector<cv::Rect> levelCandidates;
+    forever
+    {
+        int index = m_detector->m_nextWorkItem.fetchAndAddOrdered(1);
+        if(index >= (int)m_detector->m_workItems.size())
+            break;
+
+        const WorkItem &item = m_detector->m_workItems[index];
+        double scale = m_detector->m_levelScales[item.level];
+
+        //Same step as detectMultiScale() uses at this scale, the level itself is
+        //searched at factor 1 and would otherwise always get a step of 2
+        int step = scale > 2 ? 1 : 2;
+        m_classifier->DetectLevel(m_detector->m_levels[item.level](item.area), item.rows, step,
+                                  levelCandidates);
+
+        for(std::vector<cv::Rect>::const_iterator itr = levelCandidates.begin();
+            itr != levelCandidates.end(); ++itr)
+        {
+            candidates.push_back(cv::Rect(cvRound((item.area.x + itr->x)*scale),
+                                          cvRound((item.area.y + itr->y)*scale),
+                                          cvRound(itr->width*scale),
+                                          cvRound(itr->height*scale)));
+        }
+    }
+}
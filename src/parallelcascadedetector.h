@@ -0,0 +1,126 @@
+/*! \file parallelcascadedetector.h
+    \brief Defines a multi-threaded replacement for cv::CascadeClassifier::detectMultiScale()
+
+    \sa ParallelCascadeDetector, FaceTracker
+*/
+
+#ifndef PARALLELCASCADEDETECTOR_H
+#define PARALLELCASCADEDETECTOR_H
+
+#include <opencv2/opencv.hpp>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <vector>
+#include <string>
+
+//! \brief Relative distance used when grouping detections, same as OpenCV uses internally
+#define CASCADE_GROUP_EPS               0.2
+
+/*! \brief Evaluates a cascade classifier over an image pyramid using a fixed pool of threads.
+
+  cv::CascadeClassifier::detectMultiScale() walks the scale pyramid one level
+  at a time on the calling thread. ParallelCascadeDetector builds the whole
+  pyramid up front and hands out the levels as work items to a fixed pool of
+  worker threads. Large levels are further split into horizontal stripes
+  starting on even rows, each stripe evaluating a disjoint range of window
+  positions. Every level is scanned with the window step detectMultiScale()
+  would use at its scale (1 above a factor of 2, 2 below), so the raw
+  candidates are the same as in the serial path.
+
+  cv::CascadeClassifier is not safe to use from several threads at once, so
+  every worker owns a separately loaded classifier.
+
+  The raw candidates from all levels are merged with cv::groupRectangles()
+  using the same minimum neighbors semantics as detectMultiScale().
+
+  \code
+  ParallelCascadeDetector detector;
+  detector.Load("lbpcascade_frontalface.xml", QThread::idealThreadCount());
+  std::vector<cv::Rect> faces;
+  detector.DetectMultiScale(grayImage, faces, 1.2, 3, cv::Size(20, 20));
+  \endcode
+*/
+class ParallelCascadeDetector
+{
+public:
+    //! \brief Default constructor, ParallelCascadeDetector::Load must be called before use
+    ParallelCascadeDetector();
+    //! \brief Waits for outstanding work and releases the classifiers
+    ~ParallelCascadeDetector();
+
+    /*! \brief Loads one classifier per worker thread
+      \param filename Full or relative path of the classifier xml file
+      \param threadCount Number of worker threads
+      \returns true if every classifier loaded successfully, false as well for
+      old format cascades CascadeCache could not convert, which can only be
+      run through detectMultiScale()
+    */
+    bool Load(const std::string &filename, int threadCount);
+
+    //! \brief Releases the classifiers
+    void Unload();
+
+    //! \brief Returns true if the classifiers are loaded
+    bool IsLoaded() const;
+
+    //! \brief Returns the number of worker threads
+    int GetThreadCount() const;
+
+    /*! \brief Detects objects in the image
+      Parameters have the same meaning as for cv::CascadeClassifier::detectMultiScale(),
+      the image is always scaled (cv::CASCADE_SCALE_IMAGE).
+      \param image Grayscale image
+      \param objects [out] Bounding rectangles of the detected objects
+    */
+    void DetectMultiScale(const cv::Mat &image, std::vector<cv::Rect> &objects,
+                          double scaleFactor, int minNeighbors,
+                          cv::Size minSize = cv::Size(), cv::Size maxSize = cv::Size());
+
+private:
+    //! \brief A rectangular area of one pyramid level
+    struct WorkItem
+    {
+        int level;      //!< Index into ParallelCascadeDetector::m_levels
+        cv::Rect area;  //!< Area of the level the windows of this item cover
+        int rows;       //!< Number of window rows starting at area.y evaluated by this item
+    };
+
+    //! \brief Gives access to the single scale pass detectMultiScale() is built on
+    class LevelClassifier : public cv::CascadeClassifier
+    {
+    public:
+        /*! \brief Evaluates the windows of \a image whose top left corner lies in the first \a rows rows
+          \param step Distance between evaluated windows in both directions
+          \param candidates [out] Windows accepted by the cascade, in \a image coordinates
+        */
+        void DetectLevel(const cv::Mat &image, int rows, int step, std::vector<cv::Rect> &candidates);
+    };
+
+    //! \brief Pulls work items until there are none left
+    class Worker : public QRunnable
+    {
+    public:
+        Worker(ParallelCascadeDetector *detector, LevelClassifier *classifier);
+        void run();
+
+        std::vector<cv::Rect> candidates;   //!< Raw detections in full image coordinates
+    private:
+        ParallelCascadeDetector *m_detector;
+        LevelClassifier *m_classifier;
+    };
+
+    //! \brief Builds ParallelCascadeDetector::m_levels and ParallelCascadeDetector::m_workItems
+    void BuildPyramid(const cv::Mat &image, double scaleFactor, cv::Size minSize, cv::Size maxSize);
+
+    std::vector<LevelClassifier*> m_classifiers;        //!< One classifier per worker
+    std::vector<Worker*> m_workers;                     //!< One worker per classifier
+    QThreadPool m_pool;                                 //!< Fixed pool running the workers
+    cv::Size m_windowSize;                              //!< Detection window size of the classifier
+
+    std::vector<cv::Mat> m_levels;      //!< Scaled images, reused between calls
+    std::vector<double> m_levelScales;  //!< Scale of each level relative to the original image
+    std::vector<WorkItem> m_workItems;  //!< Work for the current call
+    QAtomicInt m_nextWorkItem;          //!< Next item to be handed out
+};
+
+#endif // PARALLELCASCADEDETECTOR_H
@@ -7,20 +7,37 @@
 #include <QDebug>
 #include <stdio.h>
 #include <termios.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 
 const std::string Serial::DefaultTTYDevice = "/dev/ttyACM0";
 
 Serial::Serial() :
-    m_tty(Serial::DefaultTTYDevice)
+    m_tty(Serial::DefaultTTYDevice), m_fd(-1), m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_failbit(false), m_baudRate(Serial::DefaultBaudRate), m_readStart(0), m_readCount(0)
 {
 }
 
 Serial::Serial(const std::string ttyDevice) :
-    m_tty(ttyDevice)
+    m_tty(ttyDevice), m_fd(-1), m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_failbit(false), m_baudRate(Serial::DefaultBaudRate), m_readStart(0), m_readCount(0)
 {
 }
 
+Serial::~Serial()
+{
+    close();
+    if(m_wakeFd != -1)
+        ::close(m_wakeFd);
+}
+
 bool Serial::is_open() const
 {
     return ((fcntl(m_fd, F_GETFL) != -1) || (errno != EBADF));
@@ -28,22 +45,36 @@ bool Serial::is_open() const
 
 bool Serial::open()
 {
-    if(is_open())
-    {
-        if(::close(m_fd) == false)
-            return false;
-    }
+    if(!close())
+        return false;
 
     m_fd = ::open(m_tty.c_str(), O_RDWR | O_NOCTTY);
+    if(m_fd == -1)
+        return false;
+
     struct termios toptions;
     tcgetattr(m_fd, &toptions);
-    cfsetispeed(&toptions, B9600);
-    cfsetospeed(&toptions, B9600);
     cfmakeraw(&toptions);
+    cfsetispeed(&toptions, speedOf(m_baudRate));
+    cfsetospeed(&toptions, speedOf(m_baudRate));
+    toptions.c_cflag |= CLOCAL | CREAD;
+    //read() returns as soon as a byte is there, waiting is done with poll()
+    toptions.c_cc[VMIN] = 1;
+    toptions.c_cc[VTIME] = 0;
     tcsetattr(m_fd, TCSANOW, &toptions);
     tcflush(m_fd, TCIFLUSH);
 
-    return (m_fd != -1);
+#ifdef ASYNC_LOW_LATENCY
+    //Pass received bytes on at once instead of batching them, drivers without support refuse
+    struct serial_struct info;
+    if(ioctl(m_fd, TIOCGSERIAL, &info) == 0)
+    {
+        info.flags |= ASYNC_LOW_LATENCY;
+        ioctl(m_fd, TIOCSSERIAL, &info);
+    }
+#endif
+
+    return true;
 }
 
 bool Serial::open(const std::string &ttyDevice)
@@ -54,10 +85,13 @@ bool Serial::open(const std::string &ttyDevice)
 
 bool Serial::close()
 {
-    if(is_open())
-        return ::close(m_fd) != -1;
+    if(m_fd == -1)
+        return true;
 
-    return true;
+    int result = ::close(m_fd);
+    m_fd = -1;
+    clearReadBuffer();
+    return result != -1;
 }
 
 int Serial::error() const
@@ -65,32 +99,148 @@ int Serial::error() const
     return errno;
 }
 
+bool Serial::setBaudRate(int baud)
+{
+    speed_t speed = speedOf(baud);
+    if(speed == B0)
+        return false;
+
+    m_baudRate = baud;
+    if(m_fd < 0)
+        return true;
+
+    struct termios toptions;
+    if(tcgetattr(m_fd, &toptions) != 0)
+        return false;
+    cfsetispeed(&toptions, speed);
+    cfsetospeed(&toptions, speed);
+    return tcsetattr(m_fd, TCSADRAIN, &toptions) == 0;
+}
+
+int Serial::baudRate() const
+{
+    return m_baudRate;
+}
+
+bool Serial::isSupportedBaudRate(int baud)
+{
+    return speedOf(baud) != B0;
+}
+
+speed_t Serial::speedOf(int baud)
+{
+    switch(baud)
+    {
+    case 9600:      return B9600;
+    case 19200:     return B19200;
+    case 38400:     return B38400;
+    case 57600:     return B57600;
+    case 115200:    return B115200;
+    case 230400:    return B230400;
+#ifdef B500000
+    case 500000:    return B500000;
+#endif
+#ifdef B1000000
+    case 1000000:   return B1000000;
+#endif
+    default:        return B0;
+    }
+}
+
 int Serial::readBytes(char *buffer, int nbytes) const
 {
-    return read(m_fd, buffer, nbytes);
+    if(m_readCount == 0)
+    {
+        int count = fillReadBuffer();
+        if(count <= 0)
+            return count;
+    }
+
+    int count = peekBytes(buffer, nbytes);
+    skipBytes(count);
+    return count;
 }
 
-bool Serial::readInt(int &data) const
+bool Serial::readAll(char *buffer, int nbytes) const
 {
-    data = 0;
-    quint8 byte;
-    for(unsigned int i = 0; i < sizeof(int); i++)
+    while(nbytes > 0)
     {
-        if(read(m_fd, (void*)&byte, sizeof(quint8)) != sizeof(int))
+        int count = readBytes(buffer, nbytes);
+        if(count <= 0)
             return false;
-        data |= ((unsigned int)byte)<<(i*8);
+        buffer += count;
+        nbytes -= count;
     }
     return true;
 }
 
+bool Serial::readInt(int &data) const
+{
+    quint8 bytes[sizeof(int)];
+    if(!readAll((char*)bytes, sizeof(bytes)))
+        return false;
+
+    data = 0;
+    for(unsigned int i = 0; i < sizeof(int); i++)
+        data |= ((unsigned int)bytes[i])<<(i*8);
+    return true;
+}
+
 bool Serial::readChar(char &data) const
 {
-    return read(m_fd, (void*)&data, sizeof(char)) == sizeof(char);
+    return readAll(&data, sizeof(char));
 }
 
 bool Serial::readByte(quint8 &data) const
 {
-    return read(m_fd, (void*)&data, sizeof(quint8)) == sizeof(quint8);
+    return readAll((char*)&data, sizeof(quint8));
+}
+
+int Serial::fillReadBuffer() const
+{
+    int space = SERIAL_READ_BUFFER_SIZE - m_readCount;
+    if(space == 0)
+        return 0;
+
+    //The free space may wrap around the end of the buffer, read both parts at once
+    int end = (m_readStart + m_readCount) % SERIAL_READ_BUFFER_SIZE;
+    struct iovec parts[2];
+    parts[0].iov_base = m_readBuffer + end;
+    parts[0].iov_len = qMin(space, SERIAL_READ_BUFFER_SIZE - end);
+    parts[1].iov_base = m_readBuffer;
+    parts[1].iov_len = space - parts[0].iov_len;
+
+    int count = readv(m_fd, parts, parts[1].iov_len > 0 ? 2 : 1);
+    if(count > 0)
+        m_readCount += count;
+    return count;
+}
+
+int Serial::bytesBuffered() const
+{
+    return m_readCount;
+}
+
+int Serial::peekBytes(char *buffer, int nbytes) const
+{
+    nbytes = qMin(nbytes, m_readCount);
+    int first = qMin(nbytes, SERIAL_READ_BUFFER_SIZE - m_readStart);
+    memcpy(buffer, m_readBuffer + m_readStart, first);
+    memcpy(buffer + first, m_readBuffer, nbytes - first);
+    return nbytes;
+}
+
+void Serial::skipBytes(int nbytes) const
+{
+    nbytes = qMin(nbytes, m_readCount);
+    m_readStart = (m_readStart + nbytes) % SERIAL_READ_BUFFER_SIZE;
+    m_readCount -= nbytes;
+}
+
+void Serial::clearReadBuffer() const
+{
+    m_readStart = 0;
+    m_readCount = 0;
 }
 
 int Serial::writeBytes(const char *buffer, int nbytes)
@@ -101,15 +251,14 @@ int Serial::writeBytes(const char *buffer, int nbytes)
 bool Serial::writeInt(const int integer)
 {
     unsigned int val = integer;
-    bool retValue = true;
+    quint8 bytes[sizeof(int)];
     for(unsigned int i = 0; i < sizeof(int); i++)
     {
-        quint8 byte = val & 0xFF;
-        retValue &= write(m_fd, (void*)&byte, sizeof(quint8)) == sizeof(quint8);
+        bytes[i] = val & 0xFF;
         val = val >> 8;
     }
 
-    return retValue;
+    return writeBytes((const char*)bytes, sizeof(bytes)) == sizeof(bytes);
 }
 
 bool Serial::writeChar(const char character)
@@ -122,6 +271,39 @@ bool Serial::writeByte(const quint8 &data) const
     return write(m_fd, (void*)&data, sizeof(quint8)) == sizeof(quint8);
 }
 
+Serial::WaitResult Serial::waitForReadyRead(int timeoutMs) const
+{
+    struct pollfd descriptors[2];
+    descriptors[0].fd = m_wakeFd;
+    descriptors[0].events = POLLIN;
+    descriptors[0].revents = 0;
+    //A negative descriptor is ignored by poll(), a closed port only waits for the wake up
+    descriptors[1].fd = m_fd;
+    descriptors[1].events = POLLIN;
+    descriptors[1].revents = 0;
+
+    int result = poll(descriptors, 2, timeoutMs);
+    if(result < 0)
+        return errno == EINTR ? Interrupted : Disconnected;
+    if(result == 0)
+        return TimedOut;
+
+    if(descriptors[0].revents & POLLIN)
+    {
+        eventfd_t count;
+        eventfd_read(m_wakeFd, &count);
+        return Interrupted;
+    }
+    if(descriptors[1].revents & (POLLERR | POLLHUP | POLLNVAL))
+        return Disconnected;
+    return DataReady;
+}
+
+void Serial::interrupt()
+{
+    eventfd_write(m_wakeFd, 1);
+}
+
 Serial &Serial::operator <<(const int &integer)
 {
     m_failbit = !this->writeInt(integer);
@@ -136,8 +318,8 @@ Serial &Serial::operator <<(const char &character)
 
 Serial &Serial::operator <<(const quint16 &data)
 {
-    m_failbit = !this->writeByte((quint8)(data&0xFF));
-    m_failbit |= !this->writeByte((quint8)(data>>8));
+    quint8 bytes[2] = { (quint8)(data&0xFF), (quint8)(data>>8) };
+    m_failbit = this->writeBytes((const char*)bytes, sizeof(bytes)) != sizeof(bytes);
 
     return *this;
 }
@@ -162,11 +344,9 @@ Serial &Serial::operator >>(char &character)
 
 Serial &Serial::operator >>(quint16 &data)
 {
-    data = 0;
-    quint8 lsb, msb;
-    m_failbit = !this->readByte(lsb);
-    m_failbit |= !this->readByte(msb);
-    data = (quint16)lsb| (((quint16)msb) << 8);
+    quint8 bytes[2];
+    m_failbit = !this->readAll((char*)bytes, sizeof(bytes));
+    data = (quint16)bytes[0] | (((quint16)bytes[1]) << 8);
 
     return *this;
 }
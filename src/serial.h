@@ -3,13 +3,37 @@
 
 #include <QtGlobal>
 #include <string>
+#include <termios.h>
 
+//! \brief Size of the buffer bytes read from the port are collected in
+#define SERIAL_READ_BUFFER_SIZE     256
 
+/*! \brief A raw tty.
+
+  Reads go through a ring buffer: Serial::fillReadBuffer takes everything the
+  device sent with a single syscall, and the read, peek and skip functions
+  work out of the buffer. Every write function issues a single write().
+  Reads are meant for a single reader thread, writes may come from another.
+
+  The reader waits with Serial::waitForReadyRead, which any thread can cut
+  short with Serial::interrupt, so it never sits in a syscall that cannot
+  be ended.
+*/
 class Serial
 {
 public:
+    //! \brief Why Serial::waitForReadyRead returned
+    enum WaitResult
+    {
+        DataReady,      //!< The device sent data
+        TimedOut,       //!< Nothing happened within the timeout
+        Interrupted,    //!< Serial::interrupt was called
+        Disconnected    //!< The port hung up or failed, e.g. the device was unplugged
+    };
+
     Serial();
     Serial(const std::string ttyDevice);
+    ~Serial();
 
     bool is_open() const;
     bool open();
@@ -17,6 +41,15 @@ public:
     bool close();
     int error() const;
 
+    /*! \brief Changes the rate of the open port, after sending what was written
+      Takes effect on the next Serial::open too.
+      \returns false if the rate is not supported or could not be set
+    */
+    bool setBaudRate(int baud);
+    int baudRate() const;
+    //! \brief Returns true if the port can run at \a baud
+    static bool isSupportedBaudRate(int baud);
+
     int readBytes(char* buffer, int nbytes) const;
     bool readInt(int &data) const;
     bool readChar(char &data) const;
@@ -27,6 +60,28 @@ public:
     bool writeChar(const char character);
     bool writeByte(const quint8 &data) const;
 
+    /*! \brief Waits until the device sent data, the port failed or Serial::interrupt is called
+      Bytes already in the read buffer do not count. Without an open port
+      only an interrupt or the timeout end the wait.
+    */
+    WaitResult waitForReadyRead(int timeoutMs) const;
+    //! \brief Wakes up Serial::waitForReadyRead, may be called from any thread
+    void interrupt();
+
+    /*! \brief Moves the bytes the device sent into the read buffer
+      Blocks until at least one byte arrived, call Serial::waitForReadyRead first.
+      \returns The number of bytes read, 0 if the buffer is full or the port hung up, -1 on error
+    */
+    int fillReadBuffer() const;
+    //! \brief Returns the number of bytes in the read buffer
+    int bytesBuffered() const;
+    //! \brief Copies up to \a nbytes buffered bytes to \a buffer without consuming them
+    int peekBytes(char *buffer, int nbytes) const;
+    //! \brief Drops up to \a nbytes buffered bytes
+    void skipBytes(int nbytes) const;
+    //! \brief Drops every buffered byte
+    void clearReadBuffer() const;
+
 
     //some overloads for ease of use
     Serial& operator<< (const int &integer);
@@ -43,12 +98,27 @@ public:
     operator bool();
 
 private:
+    //! \brief Reads exactly \a nbytes, blocking until they arrived
+    bool readAll(char *buffer, int nbytes) const;
+
+    //! \brief Returns the termios speed of \a baud, B0 if not supported
+    static speed_t speedOf(int baud);
+
     std::string m_tty;
     int m_fd;
+    int m_wakeFd;   //!< eventfd signalled by Serial::interrupt
     bool m_failbit;
+    int m_baudRate;
+
+    mutable char m_readBuffer[SERIAL_READ_BUFFER_SIZE];
+    mutable int m_readStart;    //!< Index of the oldest buffered byte
+    mutable int m_readCount;    //!< Number of buffered bytes
+
+    Q_DISABLE_COPY(Serial)
 
 public:
     const static std::string DefaultTTYDevice;
+    const static int DefaultBaudRate = 9600;
 };
 
 #endif // SERIAL_H
@@ -0,0 +1,297 @@
+#include "sharedmemoryframesource.h"
+#include <QElapsedTimer>
+#include <new>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/futex.h>
+
+namespace
+{
+//QAtomicInt is a plain int in memory, which is what a futex waits on
+int *FutexWord(const QAtomicInt &value)
+{
+    return (int *)&value;
+}
+
+/*! \brief Sleeps until \a word no longer holds \a expected, it is woken or \a timeoutMs passed
+  Works across processes, the futex is keyed by the shared memory page.
+  \returns false if waiting on the futex is not possible at all
+*/
+bool FutexWait(const QAtomicInt &word, int expected, qint64 timeoutMs)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs/1000;
+    timeout.tv_nsec = (timeoutMs%1000)*1000000;
+    if(syscall(SYS_futex, FutexWord(word), FUTEX_WAIT, expected, &timeout, NULL, 0) == 0)
+        return true;
+    return errno == EAGAIN || errno == ETIMEDOUT || errno == EINTR;
+}
+
+//! \brief Wakes every process waiting on \a word
+void FutexWakeAll(QAtomicInt &word)
+{
+    syscall(SYS_futex, FutexWord(word), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+}
+
+SharedMemoryFramePublisher::SharedMemoryFramePublisher() :
+    m_memory(MAP_FAILED), m_size(0), m_header(NULL), m_sequence(0)
+{
+}
+
+SharedMemoryFramePublisher::~SharedMemoryFramePublisher()
+{
+    Close();
+}
+
+bool SharedMemoryFramePublisher::Create(const std::string &name, int width, int height, int type, int slotCount)
+{
+    if(width <= 0 || height <= 0 || slotCount < 2 || slotCount > SHM_MAX_SLOTS)
+    {
+        Close();
+        return false;
+    }
+
+    int step = width*CV_ELEM_SIZE(type);
+    int slotSize = (step*height + 63) & ~63;
+    size_t size = SharedFrameHeader::DataOffset() + (size_t)slotSize*slotCount;
+
+    //Readers of the current object keep their mapping until it is superseded,
+    //new readers get the new object
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        Close();
+        return false;
+    }
+
+    if(ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        Close();
+        return false;
+    }
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        Close();
+        return false;
+    }
+
+    SharedFrameHeader *header = new(memory) SharedFrameHeader;
+    header->version = SharedFrameHeader::Version;
+    header->width = width;
+    header->height = height;
+    header->type = type;
+    header->step = step;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->closed.fetchAndStoreRelaxed(SharedFrameHeader::Open);
+    header->published.fetchAndStoreRelaxed(0);
+    for(int i = 0; i < SHM_MAX_SLOTS; i++)
+        header->slotSequence[i].fetchAndStoreRelaxed(0);
+    //Written last, readers reject the object until the header is complete
+    header->magic = SharedFrameHeader::Magic;
+    __sync_synchronize();
+
+    //Readers of the previous object only move over once the new one is complete
+    if(m_header)
+        Release(name == m_name ? SharedFrameHeader::Superseded : SharedFrameHeader::Closed);
+
+    m_name = name;
+    m_memory = memory;
+    m_size = size;
+    m_header = header;
+    m_sequence = 0;
+    return true;
+}
+
+bool SharedMemoryFramePublisher::IsOpened() const
+{
+    return m_header != NULL;
+}
+
+bool SharedMemoryFramePublisher::Publish(const cv::Mat &frame)
+{
+    if(!m_header || frame.cols != m_header->width || frame.rows != m_header->height ||
+            frame.type() != m_header->type)
+        return false;
+
+    //Sequence numbers stay positive, 0 is reserved for "being written"
+    m_sequence = m_sequence == INT_MAX ? 1 : m_sequence + 1;
+    int slot = m_sequence % m_header->slotCount;
+    uchar *data = (uchar *)m_memory + SharedFrameHeader::DataOffset() + (size_t)slot*m_header->slotSize;
+
+    m_header->slotSequence[slot].fetchAndStoreOrdered(0);
+    cv::Mat target(m_header->height, m_header->width, m_header->type, data, m_header->step);
+    frame.copyTo(target);
+    m_header->slotSequence[slot].fetchAndStoreRelease(m_sequence);
+    m_header->published.fetchAndStoreRelease(m_sequence);
+    FutexWakeAll(m_header->published);
+    return true;
+}
+
+void SharedMemoryFramePublisher::Close()
+{
+    if(m_header)
+        Release(SharedFrameHeader::Closed);
+}
+
+void SharedMemoryFramePublisher::Release(SharedFrameHeader::State state)
+{
+    m_header->closed.fetchAndStoreRelease(state);
+    //Readers wait on the sequence number, wake them to see the ring is gone
+    FutexWakeAll(m_header->published);
+    munmap(m_memory, m_size);
+    //A superseded object has already been unlinked, the name belongs to its successor
+    if(state == SharedFrameHeader::Closed)
+        shm_unlink(m_name.c_str());
+
+    m_memory = MAP_FAILED;
+    m_header = NULL;
+    m_size = 0;
+}
+
+SharedMemoryFrameSource::SharedMemoryFrameSource(const std::string &name) :
+    m_name(name), m_memory(MAP_FAILED), m_size(0), m_header(NULL), m_lastSequence(0)
+{
+    Open();
+}
+
+SharedMemoryFrameSource::~SharedMemoryFrameSource()
+{
+    Unmap();
+}
+
+bool SharedMemoryFrameSource::Open()
+{
+    int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < SharedFrameHeader::DataOffset())
+    {
+        close(fd);
+        return false;
+    }
+
+    m_size = info.st_size;
+    m_memory = mmap(NULL, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(m_memory == MAP_FAILED)
+        return false;
+
+    const SharedFrameHeader *header = (const SharedFrameHeader *)m_memory;
+    __sync_synchronize();
+    bool valid = header->magic == SharedFrameHeader::Magic &&
+            header->version == SharedFrameHeader::Version &&
+            header->slotCount >= 2 && header->slotCount <= SHM_MAX_SLOTS &&
+            header->step*header->height <= header->slotSize &&
+            SharedFrameHeader::DataOffset() + (size_t)header->slotSize*header->slotCount <= m_size;
+    if(!valid)
+    {
+        munmap(m_memory, m_size);
+        m_memory = MAP_FAILED;
+        return false;
+    }
+
+    m_header = header;
+    m_lastSequence = 0;
+    return true;
+}
+
+void SharedMemoryFrameSource::Unmap()
+{
+    if(m_memory != MAP_FAILED)
+        munmap(m_memory, m_size);
+    m_memory = MAP_FAILED;
+    m_header = NULL;
+    m_size = 0;
+}
+
+bool SharedMemoryFrameSource::IsOpened() const
+{
+    return m_header != NULL;
+}
+
+bool SharedMemoryFrameSource::IsLive() const
+{
+    return true;
+}
+
+bool SharedMemoryFrameSource::Read(cv::Mat &frame)
+{
+    if(!m_header && !Open())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    //The mapping is read only, so no atomic read-modify-write operations here
+    qint64 remaining;
+    while((remaining = DEFAULT_SHM_READ_TIMEOUT - timer.elapsed()) > 0 && !IsEndOfStream())
+    {
+        //The publisher moved to a new object, e.g. for a new frame size
+        if(m_header->closed == SharedFrameHeader::Superseded)
+        {
+            Unmap();
+            while(!Open() && timer.elapsed() < DEFAULT_SHM_READ_TIMEOUT)
+                usleep(1000);
+            if(!m_header)
+                return false;
+            continue;
+        }
+
+        __sync_synchronize();
+        int sequence = m_header->published;
+        if(sequence != 0 && sequence != m_lastSequence && CopySlot(sequence, frame))
+        {
+            m_lastSequence = sequence;
+            return true;
+        }
+
+        //The publisher wakes us as soon as it stored the next sequence number.
+        //Kernels refusing futexes on read only mappings get polled instead
+        if(sequence == m_lastSequence || sequence == 0)
+        {
+            if(!FutexWait(m_header->published, sequence, remaining))
+                usleep(1000);
+        }
+    }
+    return false;
+}
+
+bool SharedMemoryFrameSource::IsEndOfStream() const
+{
+    return m_header && m_header->closed == SharedFrameHeader::Closed;
+}
+
+bool SharedMemoryFrameSource::CopySlot(int sequence, cv::Mat &frame)
+{
+    int slot = sequence % m_header->slotCount;
+    const uchar *data = (const uchar *)m_memory + SharedFrameHeader::DataOffset() + (size_t)slot*m_header->slotSize;
+
+    if(m_header->slotSequence[slot] != sequence)
+        return false;
+    __sync_synchronize();
+
+    cv::Mat source(m_header->height, m_header->width, m_header->type, (void *)data, m_header->step);
+    source.copyTo(frame);
+
+    //The publisher lapped us while copying, the frame may be torn
+    __sync_synchronize();
+    return m_header->slotSequence[slot] == sequence;
+}
@@ -0,0 +1,146 @@
+/*! \file sharedmemoryframesource.h
+    \brief Defines the POSIX shared memory frame ring
+
+    One process captures and publishes frames into a named shared memory
+    object, any number of other processes read them without opening the
+    capture device themselves.
+    \sa SharedMemoryFramePublisher, SharedMemoryFrameSource
+*/
+
+#ifndef SHAREDMEMORYFRAMESOURCE_H
+#define SHAREDMEMORYFRAMESOURCE_H
+
+#include "framesource.h"
+#include <QAtomicInt>
+
+//! \brief Maximum number of frame slots of the shared memory ring
+#define SHM_MAX_SLOTS                   16
+//! \brief Default number of frame slots of the shared memory ring
+#define DEFAULT_SHM_SLOTS               4
+//! \brief Time (ms) SharedMemoryFrameSource::Read waits for a new frame
+#define DEFAULT_SHM_READ_TIMEOUT        1000
+
+/*! \brief Layout of the start of the shared memory object.
+
+  The frame slots follow the header at SharedFrameHeader::DataOffset. A slot
+  sequence number of 0 marks a slot that is being written, readers compare the
+  sequence number before and after copying a slot to detect torn frames.
+  Readers sleep on SharedFrameHeader::published as a futex, the publisher
+  wakes them after every frame and when it closes the ring.
+*/
+struct SharedFrameHeader
+{
+    static const quint32 Magic = 0x4C494652;   //!< "LIFR"
+    static const quint32 Version = 1;
+
+    //! \brief Values of SharedFrameHeader::closed
+    enum State
+    {
+        Open = 0,
+        Closed = 1,     //!< The publisher is gone, no more frames follow
+        Superseded = 2  //!< The publisher recreated the ring under the same name, e.g. for a new frame size
+    };
+
+    quint32 magic;
+    quint32 version;
+    qint32 width;
+    qint32 height;
+    qint32 type;        //!< OpenCV type of the frames, e.g. CV_8UC3
+    qint32 step;        //!< Bytes per row of a slot
+    qint32 slotCount;
+    qint32 slotSize;    //!< Bytes per slot
+    QAtomicInt closed;                      //!< SharedFrameHeader::State of this object
+    QAtomicInt published;                   //!< Sequence number of the newest frame, 0 before the first
+    QAtomicInt slotSequence[SHM_MAX_SLOTS]; //!< Sequence number of the frame held by each slot
+
+    //! \brief Offset of the first slot from the start of the object
+    static size_t DataOffset() { return (sizeof(SharedFrameHeader) + 63) & ~(size_t)63; }
+};
+
+/*! \brief Writes frames into a named shared memory ring.
+
+  \code
+  SharedMemoryFramePublisher publisher;
+  if(publisher.Create("/lockheed-camera", 640, 480, CV_8UC3))
+  {
+      while(capture >> frame, !frame.empty())
+          publisher.Publish(frame);
+  }
+  \endcode
+*/
+class SharedMemoryFramePublisher
+{
+public:
+    SharedMemoryFramePublisher();
+    //! \brief Marks the ring closed and removes the shared memory object
+    ~SharedMemoryFramePublisher();
+
+    /*! \brief Creates (or replaces) the shared memory object \a name
+      A ring this publisher had open is marked superseded once the new one is
+      complete, its readers move over to the new one.
+      \param name POSIX shared memory name, e.g. "/lockheed-camera"
+      \param width Width of the frames
+      \param height Height of the frames
+      \param type OpenCV type of the frames
+      \param slotCount Number of frames kept in the ring (2 .. SHM_MAX_SLOTS)
+      \returns false if the object could not be created
+    */
+    bool Create(const std::string &name, int width, int height, int type, int slotCount = DEFAULT_SHM_SLOTS);
+
+    //! \brief Returns true if the ring has been created
+    bool IsOpened() const;
+
+    /*! \brief Copies \a frame into the next slot and publishes it
+      \returns false if the size or type of \a frame does not match the ring
+    */
+    bool Publish(const cv::Mat &frame);
+
+    //! \brief Marks the ring closed and removes the shared memory object
+    void Close();
+
+private:
+    //! \brief Marks the ring \a state, wakes its readers and unmaps it
+    void Release(SharedFrameHeader::State state);
+
+    std::string m_name;
+    void *m_memory;
+    size_t m_size;
+    SharedFrameHeader *m_header;
+    int m_sequence;         //!< Sequence number of the last published frame
+};
+
+/*! \brief Reads the frames published by a SharedMemoryFramePublisher.
+
+  The source is live, frames published faster than they are read are skipped.
+  SharedMemoryFrameSource::Read sleeps until the publisher signals the next
+  frame instead of polling. When the publisher recreates the ring, e.g. for a
+  new frame size, the source opens the new one and keeps reading.
+*/
+class SharedMemoryFrameSource : public FrameSource
+{
+public:
+    //! \param name POSIX shared memory name, e.g. "/lockheed-camera"
+    explicit SharedMemoryFrameSource(const std::string &name);
+    ~SharedMemoryFrameSource();
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    bool IsEndOfStream() const;
+
+private:
+    //! \brief Maps the shared memory object m_name, returns false if it is missing or invalid
+    bool Open();
+    //! \brief Unmaps the shared memory object
+    void Unmap();
+    //! \brief Copies the slot holding \a sequence, returns false if it was overwritten meanwhile
+    bool CopySlot(int sequence, cv::Mat &frame);
+
+    std::string m_name;
+    void *m_memory;
+    size_t m_size;
+    const SharedFrameHeader *m_header;
+    int m_lastSequence;     //!< Sequence number of the last frame read
+};
+
+#endif // SHAREDMEMORYFRAMESOURCE_H
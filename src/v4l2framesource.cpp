@@ -0,0 +1,242 @@
+#include "v4l2framesource.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#if defined(DEBUG_V4L2)
+#include <QDebug>
+#endif
+
+V4L2FrameSource::V4L2FrameSource(const std::string &device, int bufferCount, int timeoutMs, PixelFormat format) :
+    m_fd(-1), m_requestedBuffers(qMax(bufferCount, 2)), m_timeoutMs(timeoutMs), m_format(format),
+    m_fourcc(0), m_width(0), m_height(0), m_bytesPerLine(0), m_streaming(false)
+{
+    m_fd = open(device.c_str(), O_RDWR | O_NONBLOCK);
+    if(m_fd < 0)
+        return;
+
+    v4l2_capability capability;
+    memset(&capability, 0, sizeof(capability));
+    if(Ioctl(m_fd, VIDIOC_QUERYCAP, &capability) != 0 ||
+            !(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+            !(capability.capabilities & V4L2_CAP_STREAMING) ||
+            !StartStreaming(0, 0))
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+V4L2FrameSource::~V4L2FrameSource()
+{
+    StopStreaming();
+    if(m_fd >= 0)
+        close(m_fd);
+}
+
+bool V4L2FrameSource::IsOpened() const
+{
+    return m_fd >= 0 && m_streaming;
+}
+
+bool V4L2FrameSource::IsLive() const
+{
+    return true;
+}
+
+bool V4L2FrameSource::Read(cv::Mat &frame)
+{
+    if(!IsOpened())
+        return false;
+
+    pollfd descriptor;
+    descriptor.fd = m_fd;
+    descriptor.events = POLLIN;
+    descriptor.revents = 0;
+    if(poll(&descriptor, 1, m_timeoutMs) <= 0)
+        return false;
+
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if(Ioctl(m_fd, VIDIOC_DQBUF, &buffer) != 0)
+        return false;
+
+    bool valid = !(buffer.flags & V4L2_BUF_FLAG_ERROR) && buffer.bytesused > 0;
+    if(valid)
+    {
+        const Buffer &mapped = m_buffers[buffer.index];
+        if(m_fourcc == V4L2_PIX_FMT_YUYV)
+        {
+            //The kernel buffer goes back to the driver below, so the frame needs its own copy
+            cv::Mat yuyv(m_height, m_width, CV_8UC2, mapped.start, m_bytesPerLine);
+            yuyv.copyTo(frame);
+        }
+        else
+        {
+            cv::Mat jpeg(1, buffer.bytesused, CV_8UC1, mapped.start);
+            frame = cv::imdecode(jpeg, 1);
+            valid = !frame.empty();
+        }
+    }
+
+    //Hand the buffer back right away, the driver needs it for the next frames
+    Ioctl(m_fd, VIDIOC_QBUF, &buffer);
+    return valid;
+}
+
+void V4L2FrameSource::SetFrameDimensions(int width, int height)
+{
+    if(m_fd < 0 || (width == m_width && height == m_height))
+        return;
+
+    int previousWidth = m_width;
+    int previousHeight = m_height;
+
+    //Buffers are sized for the old format, they have to be released first
+    StopStreaming();
+    if(!StartStreaming(width, height))
+        StartStreaming(previousWidth, previousHeight);
+}
+
+int V4L2FrameSource::GetBufferCount() const
+{
+    return (int)m_buffers.size();
+}
+
+bool V4L2FrameSource::StartStreaming(int width, int height)
+{
+    if(width <= 0 || height <= 0)
+    {
+        width = m_width;
+        height = m_height;
+    }
+
+    bool formatSet = false;
+    if(m_format == AnyFormat || m_format == YuyvFormat)
+        formatSet = SetFormat(V4L2_PIX_FMT_YUYV, width, height);
+    if(!formatSet && (m_format == AnyFormat || m_format == MjpegFormat))
+        formatSet = SetFormat(V4L2_PIX_FMT_MJPEG, width, height);
+    if(!formatSet)
+        return false;
+
+    v4l2_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = m_requestedBuffers;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if(Ioctl(m_fd, VIDIOC_REQBUFS, &request) != 0 || request.count < 2)
+        return false;
+
+    for(unsigned int i = 0; i < request.count; i++)
+    {
+        v4l2_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if(Ioctl(m_fd, VIDIOC_QUERYBUF, &buffer) != 0)
+        {
+            StopStreaming();
+            return false;
+        }
+
+        Buffer mapped;
+        mapped.length = buffer.length;
+        mapped.start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buffer.m.offset);
+        if(mapped.start == MAP_FAILED)
+        {
+            StopStreaming();
+            return false;
+        }
+        m_buffers.push_back(mapped);
+
+        if(Ioctl(m_fd, VIDIOC_QBUF, &buffer) != 0)
+        {
+            StopStreaming();
+            return false;
+        }
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(Ioctl(m_fd, VIDIOC_STREAMON, &type) != 0)
+    {
+        StopStreaming();
+        return false;
+    }
+
+    m_streaming = true;
+#if defined(DEBUG_V4L2)
+    qDebug() << "V4L2FrameSource: streaming" << m_width << "x" << m_height
+             << (m_fourcc == V4L2_PIX_FMT_YUYV ? "YUYV" : "MJPEG") << "with" << m_buffers.size() << "buffers";
+#endif
+    return true;
+}
+
+void V4L2FrameSource::StopStreaming()
+{
+    if(m_fd < 0)
+        return;
+
+    if(m_streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        Ioctl(m_fd, VIDIOC_STREAMOFF, &type);
+        m_streaming = false;
+    }
+
+    for(size_t i = 0; i < m_buffers.size(); i++)
+        munmap(m_buffers[i].start, m_buffers[i].length);
+    m_buffers.clear();
+
+    //Frees the kernel buffers so the format can change
+    v4l2_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = 0;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    Ioctl(m_fd, VIDIOC_REQBUFS, &request);
+}
+
+bool V4L2FrameSource::SetFormat(quint32 fourcc, int width, int height)
+{
+    v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(Ioctl(m_fd, VIDIOC_G_FMT, &format) != 0)
+        return false;
+
+    if(width > 0 && height > 0)
+    {
+        format.fmt.pix.width = width;
+        format.fmt.pix.height = height;
+    }
+    format.fmt.pix.pixelformat = fourcc;
+    format.fmt.pix.field = V4L2_FIELD_ANY;
+
+    //Drivers adjust unsupported formats instead of failing, check what was granted
+    if(Ioctl(m_fd, VIDIOC_S_FMT, &format) != 0 || format.fmt.pix.pixelformat != fourcc)
+        return false;
+
+    m_fourcc = fourcc;
+    m_width = format.fmt.pix.width;
+    m_height = format.fmt.pix.height;
+    m_bytesPerLine = qMax((int)format.fmt.pix.bytesperline, 2*m_width);
+    return true;
+}
+
+int V4L2FrameSource::Ioctl(int fd, unsigned long request, void *arg)
+{
+    int result;
+    do
+    {
+        result = ioctl(fd, request, arg);
+    }
+    while(result == -1 && errno == EINTR);
+    return result;
+}
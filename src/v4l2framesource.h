@@ -0,0 +1,95 @@
+/*! \file v4l2framesource.h
+    \brief Defines the native Video4Linux2 capture backend
+
+    \sa V4L2FrameSource
+*/
+
+#ifndef V4L2FRAMESOURCE_H
+#define V4L2FRAMESOURCE_H
+
+#include "framesource.h"
+#include <QtGlobal>
+#include <vector>
+
+//! \brief Default number of kernel buffers V4L2FrameSource requests
+#define DEFAULT_V4L2_BUFFER_COUNT       4
+//! \brief Default time (ms) V4L2FrameSource::Read waits for the driver to deliver a frame
+#define DEFAULT_V4L2_TIMEOUT            2000
+
+/*! \brief Captures from a V4L2 device through memory mapped kernel buffers.
+
+  Unlike cv::VideoCapture, both the number of buffers queued in the driver and
+  the time to wait for a frame can be chosen. Some cameras (e.g. the Logitech
+  C525) need far more time for the first frames than the default of the
+  OpenCV backend allows.
+
+  YUYV frames are delivered as they come from the driver, as two channel
+  (CV_8UC2) images whose first channel is the Y plane. FrameProcessing uses
+  that plane as the grayscale detection input directly, the frame is only
+  converted to color when it is displayed. MJPEG frames are decoded to BGR.
+*/
+class V4L2FrameSource : public FrameSource
+{
+public:
+    //! \brief Pixel formats the source can negotiate with the device
+    enum PixelFormat
+    {
+        AnyFormat = 0,  //!< YUYV if the device supports it, MJPEG otherwise
+        YuyvFormat,     //!< Packed YUV 4:2:2
+        MjpegFormat     //!< Motion JPEG, for resolutions YUYV can not deliver at full frame rate
+    };
+
+    /*! \brief Opens the device and starts streaming
+      \param device Device node, e.g. "/dev/video0"
+      \param bufferCount Number of kernel buffers to request, the driver may grant more or fewer
+      \param timeoutMs Time to wait for a frame before FrameSource::Read gives up
+      \param format Pixel format to negotiate
+    */
+    explicit V4L2FrameSource(const std::string &device, int bufferCount = DEFAULT_V4L2_BUFFER_COUNT,
+                             int timeoutMs = DEFAULT_V4L2_TIMEOUT, PixelFormat format = AnyFormat);
+    //! \brief Stops streaming and closes the device
+    ~V4L2FrameSource();
+
+    bool IsOpened() const;
+    bool IsLive() const;
+    bool Read(cv::Mat &frame);
+    //! \brief Restarts streaming at the new size, the driver picks the closest size it supports
+    void SetFrameDimensions(int width, int height);
+
+    //! \brief Returns the number of buffers the driver granted
+    int GetBufferCount() const;
+
+private:
+    //! \brief Memory mapped kernel buffer
+    struct Buffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    /*! \brief Negotiates the format, maps the buffers and starts streaming
+      \param width Requested width, 0 to keep the current one
+      \param height Requested height, 0 to keep the current one
+    */
+    bool StartStreaming(int width, int height);
+    //! \brief Stops streaming and unmaps the buffers
+    void StopStreaming();
+    //! \brief Sets the format to \a fourcc at the requested size, returns false if the device refuses it
+    bool SetFormat(quint32 fourcc, int width, int height);
+
+    //! \brief ioctl() which retries when interrupted by a signal
+    static int Ioctl(int fd, unsigned long request, void *arg);
+
+    int m_fd;                       //!< Device file descriptor, -1 if not open
+    int m_requestedBuffers;
+    int m_timeoutMs;
+    PixelFormat m_format;           //!< Format requested by the user
+    quint32 m_fourcc;               //!< Format negotiated with the device
+    int m_width;
+    int m_height;
+    int m_bytesPerLine;
+    std::vector<Buffer> m_buffers;
+    bool m_streaming;
+};
+
+#endif // V4L2FRAMESOURCE_H
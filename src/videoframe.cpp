@@ -0,0 +1,104 @@
+#include "videoframe.h"
+#include <algorithm>
+
+VideoFrame::VideoFrame()
+{
+}
+
+VideoFrame::VideoFrame(const cv::Mat &image, const QRect &faceRect) :
+    m_image(image), m_faceRect(faceRect)
+{
+}
+
+bool VideoFrame::IsNull() const
+{
+    return m_image.empty();
+}
+
+int VideoFrame::GetWidth() const
+{
+    return m_image.cols;
+}
+
+int VideoFrame::GetHeight() const
+{
+    return m_image.rows;
+}
+
+QImage VideoFrame::GetImage() const
+{
+    if(m_image.empty())
+        return QImage();
+
+    return QImage(m_image.data, m_image.cols, m_image.rows,
+                  m_image.step, QImage::Format_RGB888);
+}
+
+const cv::Mat &VideoFrame::GetMat() const
+{
+    return m_image;
+}
+
+QRect VideoFrame::GetFaceRect() const
+{
+    return m_faceRect;
+}
+
+void VideoFrame::SetFaceRect(const QRect &faceRect)
+{
+    m_faceRect = faceRect;
+}
+
+VideoFrame VideoFrame::GetFaceFrame() const
+{
+    if(!m_faceRect.isValid())
+        return VideoFrame();
+
+    return GetSubFrame(m_faceRect);
+}
+
+VideoFrame VideoFrame::GetSubFrame(const QRect &rect) const
+{
+    cv::Rect area(rect.x(), rect.y(), rect.width(), rect.height());
+    area &= cv::Rect(0, 0, m_image.cols, m_image.rows);
+    if(area.area() == 0)
+        return VideoFrame();
+
+    return VideoFrame(m_image(area));
+}
+
+VideoFramePool::VideoFramePool(int bufferCount) :
+    m_buffers(std::max(bufferCount, 1)), m_next(0), m_droppedCount(0)
+{
+}
+
+cv::Mat VideoFramePool::Acquire(cv::Size size, int type)
+{
+    if(m_buffers[0].empty())
+    {
+        for(size_t i = 0; i < m_buffers.size(); i++)
+            m_buffers[i].create(size, type);
+    }
+
+    for(size_t i = 0; i < m_buffers.size(); i++)
+    {
+        size_t index = (m_next + i) % m_buffers.size();
+        cv::Mat &buffer = m_buffers[index];
+
+        //Only referenced by the pool, every exported frame has been released
+        if(buffer.refcount && *buffer.refcount == 1)
+        {
+            buffer.create(size, type);
+            m_next = (index + 1) % m_buffers.size();
+            return buffer;
+        }
+    }
+
+    m_droppedCount++;
+    return cv::Mat();
+}
+
+int VideoFramePool::GetDroppedCount() const
+{
+    return m_droppedCount;
+}
@@ -0,0 +1,127 @@
+/*! \file videoframe.h
+    \brief Defines the reference counted frame handle exported by FaceTracker
+
+    \sa VideoFrame, VideoFramePool, FaceTracker::GetLastFrame
+*/
+
+#ifndef VIDEOFRAME_H
+#define VIDEOFRAME_H
+
+#include <opencv2/opencv.hpp>
+#include <QMetaType>
+#include <QImage>
+#include <QRect>
+#include <vector>
+
+//! \brief Default number of buffers in the VideoFramePool ring
+#define DEFAULT_FRAME_POOL_SIZE         4
+
+/*! \brief Cheap, reference counted handle to an RGB frame.
+
+  VideoFrame shares its pixel buffer with every copy of it and with every
+  sub-frame created from it, copying a VideoFrame never copies pixels. The
+  buffer is released when the last handle referencing it goes away, which
+  makes it safe to pass VideoFrame through queued signal/slot connections.
+
+  A frame optionally carries the rectangle of the tracked face, which is
+  used by VideoFrame::GetFaceFrame and for highlighting the face.
+
+  \code
+  VideoFrame frame = faceTracker.GetLastFrame();
+  label->setPixmap(QPixmap::fromImage(frame.GetImage()));
+  playerImage = QPixmap::fromImage(frame.GetFaceFrame().GetImage());
+  \endcode
+*/
+class VideoFrame
+{
+public:
+    //! \brief Creates a null frame
+    VideoFrame();
+
+    /*! \brief Creates a frame sharing the pixels of \a image
+      \param image 8 bit, 3 channel RGB image
+      \param faceRect Rectangle of the tracked face, invalid if there is none
+    */
+    explicit VideoFrame(const cv::Mat &image, const QRect &faceRect = QRect());
+
+    //! \brief Returns true if the frame holds no image
+    bool IsNull() const;
+
+    //! \brief Returns the width of the frame in pixels
+    int GetWidth() const;
+    //! \brief Returns the height of the frame in pixels
+    int GetHeight() const;
+
+    /*! \brief Returns a QImage viewing the pixels of the frame
+      No pixels are copied, the returned image is only valid while this frame
+      (or a copy of it) is alive. Painting on the image paints on the frame.
+    */
+    QImage GetImage() const;
+
+    //! \brief Returns the underlying RGB image
+    const cv::Mat &GetMat() const;
+
+    //! \brief Returns the rectangle of the tracked face, invalid if there is none
+    QRect GetFaceRect() const;
+    //! \brief Sets the rectangle of the tracked face, pass QRect() to clear it
+    void SetFaceRect(const QRect &faceRect);
+
+    /*! \brief Returns a frame viewing only the tracked face
+      The returned frame shares the pixels of this frame.
+      \returns Null frame if there is no face
+    */
+    VideoFrame GetFaceFrame() const;
+
+    /*! \brief Returns a frame viewing only \a rect
+      The returned frame shares the pixels of this frame.
+      \returns Null frame if \a rect does not intersect the frame
+    */
+    VideoFrame GetSubFrame(const QRect &rect) const;
+
+private:
+    cv::Mat m_image;    //!< RGB pixels, shared between copies
+    QRect m_faceRect;   //!< Rectangle of the tracked face in frame coordinates
+};
+
+Q_DECLARE_METATYPE(VideoFrame)
+
+/*! \brief Fixed ring of recycled pixel buffers for exported frames.
+
+  All buffers are allocated on the first VideoFramePool::Acquire. A buffer is
+  handed out again once every VideoFrame referencing it has been destroyed, so
+  in steady state exporting frames does not allocate.
+
+  The pool never grows. When every buffer is still referenced, for example
+  because queued signals are waiting for a slow GUI thread, Acquire fails and
+  the frame should be dropped. This bounds the number of frames in flight to
+  the size of the pool.
+
+  Only one thread may call VideoFramePool::Acquire, the buffers themselves may
+  be released from any thread.
+*/
+class VideoFramePool
+{
+public:
+    /*! \brief Constructor
+      \param bufferCount Number of buffers in the ring
+    */
+    explicit VideoFramePool(int bufferCount = DEFAULT_FRAME_POOL_SIZE);
+
+    /*! \brief Returns a buffer nobody else references
+      Buffers are reallocated only if \a size or \a type change.
+      \param size Dimensions of the buffer
+      \param type OpenCV type of the buffer
+      \returns Empty matrix if all buffers are in use
+    */
+    cv::Mat Acquire(cv::Size size, int type);
+
+    //! \brief Returns the number of failed VideoFramePool::Acquire calls
+    int GetDroppedCount() const;
+
+private:
+    std::vector<cv::Mat> m_buffers; //!< Ring of buffers, each also referenced by the pool
+    size_t m_next;                  //!< Ring position the next search starts at
+    int m_droppedCount;             //!< Number of failed VideoFramePool::Acquire calls
+};
+
+#endif // VIDEOFRAME_H